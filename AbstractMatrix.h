@@ -1,23 +1,51 @@
 #ifndef ABSTRACT_MATRIX_H
 #define ABSTRACT_MATRIX_H
 
+#include "MatrixAllocator.h"
+#include "MatrixRef.h"
+#include "MatrixStorage.h"
+#include "Reduction.h"
+#include "TextIO.h"
 #include <algorithm>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <iostream>
 
+template <class Scalar> class MatrixView;
+template <class Scalar> class VectorView;
+
 template <class Scalar_>
 class AbstractMatrix {
 public:
     typedef Scalar_ Scalar;
-    typedef typename std::vector<Scalar>::iterator iterator;
-    typedef typename std::vector<Scalar>::const_iterator const_iterator;
+    typedef Scalar* iterator;
+    typedef const Scalar* const_iterator;
 
     virtual bool isSquare() const = 0;
     virtual bool isVector() const = 0;
     virtual bool isDiagonal() const = 0;
     virtual bool isZero() const = 0;
     virtual bool isIdentity() const = 0;
+
+    // A == A^T, compared exactly or, with a tolerance, up to it; a NaN off
+    // the diagonal makes A unsymmetric. Tiles below the diagonal are
+    // compared with their mirror images so both stay in cache.
+    bool isSymmetric(Scalar tolerance = Scalar()) const {
+        if (!isSquare())
+            return false;
+        MatrixRef<const Scalar> m = ref();
+        const unsigned tile = 32, n = getRows();
+        for (unsigned i0 = 0; i0 < n; i0 += tile)
+            for (unsigned j0 = 0; j0 <= i0; j0 += tile)
+                for (unsigned i = i0; i < std::min(n, i0 + tile); i++)
+                    for (unsigned j = j0; j < std::min(i, j0 + tile); j++){
+                        Scalar a = m(i, j), b = m(j, i);
+                        if (a != b && !((a > b ? a - b : b - a) <= tolerance))
+                            return false;
+                    }
+        return true;
+    }
     
     virtual unsigned getRows() const = 0;
     virtual unsigned getColumns() const = 0;
@@ -27,17 +55,60 @@ public:
     virtual const_iterator begin() const = 0;
     virtual const_iterator end() const = 0;
     
+    // The storage of Matrix, SquareMatrix and Vector, so conversions
+    // between them keep sharing elements; null for other matrices.
+    virtual const MatrixStorage<Scalar>* getStorage() const { return nullptr; }
+
+    // The elements as new storage: shared with this matrix if its storage
+    // is shared, a copy otherwise.
+    MatrixStorage<Scalar> copyElements() const {
+        if (const MatrixStorage<Scalar>* s = getStorage())
+            return *s;
+        return MatrixStorage<Scalar>(MatrixBuffer<Scalar>(begin(), end()));
+    }
+
+    const Scalar* data() const { return begin(); }
+    Scalar* data() { return begin(); }
+    MatrixRef<const Scalar> ref() const { return MatrixRef<const Scalar>(data(), getRows(), getColumns()); }
+    MatrixRef<Scalar> ref() { return MatrixRef<Scalar>(data(), getRows(), getColumns()); }
+    
+    // Zero-copy views of the whole matrix, a block, a row, a column or the
+    // diagonal; see MatrixView.h.
+    MatrixView<const Scalar> view() const { return MatrixView<const Scalar>(ref()); }
+    MatrixView<Scalar> view() { return MatrixView<Scalar>(ref()); }
+    MatrixView<const Scalar> block(unsigned r, unsigned c, unsigned rows, unsigned columns) const {
+        return view().block(r, c, rows, columns);
+    }
+    MatrixView<Scalar> block(unsigned r, unsigned c, unsigned rows, unsigned columns) {
+        return view().block(r, c, rows, columns);
+    }
+    VectorView<const Scalar> rowView(unsigned r) const { return view().rowView(r); }
+    VectorView<Scalar> rowView(unsigned r) { return view().rowView(r); }
+    VectorView<const Scalar> columnView(unsigned c) const { return view().columnView(c); }
+    VectorView<Scalar> columnView(unsigned c) { return view().columnView(c); }
+    VectorView<const Scalar> diagonal() const { return view().diagonal(); }
+    VectorView<Scalar> diagonal() { return view().diagonal(); }
+    
     virtual Scalar operator()(unsigned r, unsigned c) const = 0;
     virtual Scalar& operator()(unsigned r, unsigned c) = 0;
     virtual bool operator==(const AbstractMatrix<Scalar>& m) const = 0;
     bool operator!=(const AbstractMatrix<Scalar>& m) const { return !(*this == m); }
     
     virtual Scalar max() const {
-        return *std::max_element(begin(), end());
+        return parallelMax(data(), (std::size_t)getRows() * getColumns());
     }
     
     virtual Scalar min() const {
-        return *std::min_element(begin(), end());
+        return parallelMin(data(), (std::size_t)getRows() * getColumns());
+    }
+
+    // Minimum, maximum, sum and Frobenius norm of the elements, computed
+    // in one parallel pass; see Reduction.h.
+    MatrixSummary<Scalar> summary() const {
+        std::size_t n = (std::size_t)getRows() * getColumns();
+        if (n == 0)
+            throw std::runtime_error("Wrong size");
+        return parallelSummary(data(), n);
     }
     
     virtual Scalar trace() const = 0;
@@ -51,12 +122,35 @@ public:
 
 template<class Scalar>
 std::ostream& operator<<(std::ostream& out, const AbstractMatrix<Scalar>& m){
-    for (unsigned i = 0; i<m.getRows(); i++){
-        for (unsigned j = 0; j<m.getColumns(); j++)
-            out << m(i,j) << "  ";
-        out << std::endl;
+    MatrixRef<const Scalar> elements = m.ref();
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return elements(i, j); });
+}
+
+// Reads matrix text (see TextIO.h) into m, which takes the shape of the
+// text. Sets failbit, leaving m unchanged, if there is no matrix or it
+// does not fit m's type.
+template<class M>
+typename std::enable_if<std::is_base_of<AbstractMatrix<typename M::Scalar>, M>::value, std::istream&>::type
+operator>>(std::istream& in, M& m){
+    typedef typename M::Scalar Scalar;
+    MatrixBuffer<Scalar> elements;
+    unsigned columns;
+    try{
+        unsigned rows = readTextElements(in, elements, columns);
+        if (!rows){
+            in.setstate(std::ios::failbit);
+            return in;
+        }
+        m = MatrixView<const Scalar>(elements.data(), rows, columns);
+    }
+    catch (const std::runtime_error&){
+        in.setstate(std::ios::failbit);
+        return in;
     }
-    return out;
+    if (in.eof())
+        in.clear(std::ios::eofbit);
+    return in;
 }
 
 #endif
@@ -0,0 +1,422 @@
+#ifndef ALIGNED_MATRIX_H
+#define ALIGNED_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Gemm.h"
+#include "LU.h"
+#include "Matrix.h"
+#include "Simd.h"
+#include "Transpose.h"
+#include "Vector.h"
+#include <iterator>
+
+enum class MatrixLayout { RowMajor, ColumnMajor };
+
+// Dense matrix with a storage policy: elements are kept in rows (row-major)
+// or in columns (column-major), and each of these lines starts at a multiple
+// of the leading dimension (stride). The default stride rounds the line
+// length up to a 64-byte cache line, so with the 64-byte aligned buffer
+// every line starts aligned and SIMD kernels never split a load at its
+// start. Padding elements are kept zero.
+//
+// Matrix, SquareMatrix and Vector stay contiguous and row-major, as
+// AbstractMatrix promises; use this class where the layout matters. Element
+// access and the iterators are logical (row by row in either layout), so
+// only speed depends on the layout. transponeThis() only flips the layout
+// and swaps the dimensions; products with column-major operands run on the
+// transposed problem instead of repacking whenever that is possible.
+template <class Scalar_>
+class AlignedMatrix {
+public:
+    typedef Scalar_ Scalar;
+
+    // Line lengths are padded to multiples of this many elements.
+    static constexpr unsigned lineElements = sizeof(Scalar) < 64 ? 64 / sizeof(Scalar) : 1;
+
+    static unsigned paddedStride(unsigned extent) {
+        return (extent + lineElements - 1) / lineElements * lineElements;
+    }
+
+    template <bool Const>
+    class Iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Scalar value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const Scalar*, Scalar*>::type pointer;
+        typedef typename std::conditional<Const, const Scalar&, Scalar&>::type reference;
+        typedef typename std::conditional<Const, const AlignedMatrix*, AlignedMatrix*>::type Owner;
+
+        Iterator() {}
+        Iterator(Owner m, unsigned r, unsigned c) : m(m), r(r), c(c) {}
+
+        reference operator*() const { return m->storage[m->index(r, c)]; }
+        pointer operator->() const { return &**this; }
+
+        Iterator& operator++() {
+            if (++c == m->columns){
+                c = 0;
+                r++;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator i(*this);
+            ++*this;
+            return i;
+        }
+
+        bool operator==(const Iterator& i) const { return r == i.r && c == i.c; }
+        bool operator!=(const Iterator& i) const { return !(*this == i); }
+
+    private:
+        Owner m = nullptr;
+        unsigned r = 0, c = 0;
+    };
+
+    typedef Iterator<false> iterator;
+    typedef Iterator<true> const_iterator;
+
+    AlignedMatrix() {}
+
+    AlignedMatrix(unsigned rows, unsigned columns, MatrixLayout layout = MatrixLayout::RowMajor,
+                  Scalar value = Scalar()) :
+        rows(rows), columns(columns), layout(layout) {
+        stride = paddedStride(extent());
+        storage.assign((std::size_t)lines() * stride, Scalar(0));
+        if (value != Scalar(0))
+            for (unsigned i = 0; i < lines(); i++)
+                std::fill(line(i), line(i) + extent(), value);
+    }
+
+    explicit AlignedMatrix(const AbstractMatrix<Scalar>& m, MatrixLayout layout = MatrixLayout::RowMajor) :
+        AlignedMatrix(m.getRows(), m.getColumns(), layout) {
+        MatrixRef<const Scalar> dense = m.ref();
+        if (layout == MatrixLayout::RowMajor)
+            for (unsigned i = 0; i < rows; i++)
+                std::copy(dense.row(i), dense.row(i) + columns, line(i));
+        else
+            transpose(rows, columns, dense.data(), columns, storage.data(), stride);
+    }
+
+    // Zero matrix with an explicit leading dimension of at least the line
+    // length, e.g. to match an external buffer or to avoid strides that are
+    // a multiple of the cache set size.
+    static AlignedMatrix withStride(unsigned rows, unsigned columns, MatrixLayout layout, unsigned stride) {
+        AlignedMatrix m;
+        m.rows = rows;
+        m.columns = columns;
+        m.layout = layout;
+        if (stride < m.extent())
+            throw std::runtime_error("Wrong size");
+        m.stride = stride;
+        m.storage.assign((std::size_t)m.lines() * stride, Scalar(0));
+        return m;
+    }
+
+    unsigned getRows() const { return rows; }
+    unsigned getColumns() const { return columns; }
+    unsigned getStride() const { return stride; }
+    MatrixLayout getLayout() const { return layout; }
+    bool isRowMajor() const { return layout == MatrixLayout::RowMajor; }
+    bool isSquare() const { return rows == columns; }
+    bool isVector() const { return rows == 1 || columns == 1; }
+
+    bool isZero() const {
+        for (unsigned i = 0; i < lines(); i++)
+            if (!simdIsZero(line(i), extent()))
+                return false;
+        return true;
+    }
+
+    // The stored lines: rows of this matrix if it is row-major, rows of its
+    // transpose otherwise.
+    Scalar* data() { return storage.data(); }
+    const Scalar* data() const { return storage.data(); }
+    MatrixRef<Scalar> lineRef() { return MatrixRef<Scalar>(storage.data(), lines(), extent(), stride); }
+    MatrixRef<const Scalar> lineRef() const {
+        return MatrixRef<const Scalar>(storage.data(), lines(), extent(), stride);
+    }
+
+    iterator begin() { return iterator(this, 0, 0); }
+    iterator end() { return iterator(this, columns ? rows : 0, 0); }
+    const_iterator begin() const { return const_iterator(this, 0, 0); }
+    const_iterator end() const { return const_iterator(this, columns ? rows : 0, 0); }
+
+    Scalar& unchecked(unsigned r, unsigned c) {
+        assert(r < rows && c < columns);
+        return storage[index(r, c)];
+    }
+
+    const Scalar& unchecked(unsigned r, unsigned c) const {
+        assert(r < rows && c < columns);
+        return storage[index(r, c)];
+    }
+
+    Scalar& operator()(unsigned r, unsigned c) {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("AlignedMatrix::operator()");
+        return storage[index(r, c)];
+    }
+
+    const Scalar& operator()(unsigned r, unsigned c) const {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("AlignedMatrix::operator()");
+        return storage[index(r, c)];
+    }
+
+    Matrix<Scalar> toDense() const {
+        MatrixBuffer<Scalar> elements((std::size_t)rows * columns);
+        if (isRowMajor())
+            for (unsigned i = 0; i < rows; i++)
+                std::copy(line(i), line(i) + columns, elements.data() + (std::size_t)i * columns);
+        else
+            transpose(columns, rows, storage.data(), stride, elements.data(), columns);
+        return Matrix<Scalar>(rows, columns, std::move(elements));
+    }
+
+    // Copy of this matrix stored in the given layout, with the default stride.
+    AlignedMatrix toLayout(MatrixLayout target) const {
+        AlignedMatrix m(rows, columns, target);
+        if (target == layout)
+            for (unsigned i = 0; i < lines(); i++)
+                std::copy(line(i), line(i) + extent(), m.line(i));
+        else
+            transpose(lines(), extent(), storage.data(), stride, m.storage.data(), m.stride);
+        return m;
+    }
+
+    AlignedMatrix transpone() const {
+        AlignedMatrix m(*this);
+        m.transponeThis();
+        return m;
+    }
+
+    void transponeThis() {
+        std::swap(rows, columns);
+        layout = isRowMajor() ? MatrixLayout::ColumnMajor : MatrixLayout::RowMajor;
+    }
+
+    bool operator==(const AlignedMatrix& m) const {
+        if (rows != m.rows || columns != m.columns)
+            return false;
+        if (layout == m.layout){
+            for (unsigned i = 0; i < lines(); i++)
+                if (!simdEqual(line(i), m.line(i), extent()))
+                    return false;
+            return true;
+        }
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned j = 0; j < columns; j++)
+                if (unchecked(i, j) != m.unchecked(i, j))
+                    return false;
+        return true;
+    }
+
+    bool operator!=(const AlignedMatrix& m) const { return !(*this == m); }
+
+    bool operator==(const AbstractMatrix<Scalar>& m) const {
+        if (rows != m.getRows() || columns != m.getColumns())
+            return false;
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned j = 0; j < columns; j++)
+                if (unchecked(i, j) != dense(i, j))
+                    return false;
+        return true;
+    }
+
+    bool operator!=(const AbstractMatrix<Scalar>& m) const { return !(*this == m); }
+
+    Scalar max() const {
+        if (rows == 0 || columns == 0)
+            throw std::runtime_error("Wrong size");
+        Scalar result = simdMax(line(0), extent());
+        for (unsigned i = 1; i < lines(); i++)
+            result = std::max(result, simdMax(line(i), extent()));
+        return result;
+    }
+
+    Scalar min() const {
+        if (rows == 0 || columns == 0)
+            throw std::runtime_error("Wrong size");
+        Scalar result = simdMin(line(0), extent());
+        for (unsigned i = 1; i < lines(); i++)
+            result = std::min(result, simdMin(line(i), extent()));
+        return result;
+    }
+
+    AlignedMatrix& operator+=(const AlignedMatrix& m) {
+        if (rows != m.rows || columns != m.columns)
+            throw std::runtime_error("Wrong size");
+        if (layout != m.layout)
+            return *this += m.toLayout(layout);
+        for (unsigned i = 0; i < lines(); i++)
+            simdAdd(line(i), m.line(i), extent());
+        return *this;
+    }
+
+    AlignedMatrix& operator-=(const AlignedMatrix& m) {
+        if (rows != m.rows || columns != m.columns)
+            throw std::runtime_error("Wrong size");
+        if (layout != m.layout)
+            return *this -= m.toLayout(layout);
+        for (unsigned i = 0; i < lines(); i++)
+            simdSub(line(i), m.line(i), extent());
+        return *this;
+    }
+
+    AlignedMatrix& operator*=(const Scalar& c) {
+        for (unsigned i = 0; i < lines(); i++)
+            simdScale(line(i), c, extent());
+        return *this;
+    }
+
+    AlignedMatrix operator+(const AlignedMatrix& m) const {
+        AlignedMatrix r(*this);
+        r += m;
+        return r;
+    }
+
+    AlignedMatrix operator-(const AlignedMatrix& m) const {
+        AlignedMatrix r(*this);
+        r -= m;
+        return r;
+    }
+
+    // Row-major operands multiply directly and give a row-major product.
+    // Two column-major ones give a column-major product from C^T = B^T A^T,
+    // which is the same kernel on their stored lines. Mixed layouts repack
+    // the column-major operand.
+    AlignedMatrix operator*(const AlignedMatrix& m) const {
+        if (columns != m.rows)
+            throw std::runtime_error("Wrong size");
+        if (layout != m.layout)
+            return isRowMajor() ? *this * m.toLayout(layout) : toLayout(m.layout) * m;
+        AlignedMatrix r(rows, m.columns, layout);
+        if (isRowMajor())
+            gemm(rows, m.columns, columns, storage.data(), stride, m.storage.data(), m.stride,
+                 r.storage.data(), r.stride);
+        else
+            gemm(m.columns, rows, columns, m.storage.data(), m.stride, storage.data(), stride,
+                 r.storage.data(), r.stride);
+        return r;
+    }
+
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
+        if (columns != m.getRows())
+            throw std::runtime_error("Wrong size");
+        if (!isRowMajor())
+            return toLayout(MatrixLayout::RowMajor) * m;
+        Matrix<Scalar> r(rows, m.getColumns());
+        gemm(rows, m.getColumns(), columns, storage.data(), stride, m.data(), m.getColumns(),
+             r.data(), m.getColumns());
+        return r;
+    }
+
+    // y = A x for a column vector x; a column-major A computes y^T = x^T A^T.
+    Vector<Scalar> operator*(const Vector<Scalar>& x) const {
+        if (x.getRows() != columns)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> y(rows, 0);
+        if (isRowMajor())
+            gemm(rows, 1u, columns, storage.data(), stride, x.data(), 1u, y.data(), 1u);
+        else
+            gemm(1u, rows, columns, x.data(), columns, storage.data(), stride, y.data(), rows);
+        return Vector<Scalar>(rows, true, std::move(y));
+    }
+
+    // The stored lines of a column-major A are A^T, and det(A^T) = det(A),
+    // inv(A^T) = inv(A)^T, so both work on the lines in either layout.
+    template<typename T = double>
+    T det() const {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        return LU<T>(rows, packed<T>()).det();
+    }
+
+    template<typename T = double>
+    AlignedMatrix<T> invert() const {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        LU<T> lu(rows, packed<T>());
+        if (lu.isSingular())
+            throw std::runtime_error("Singular matrix");
+        Matrix<T> inverse = lu.invert();
+        AlignedMatrix<T> r(rows, rows, layout);
+        for (unsigned i = 0; i < rows; i++)
+            std::copy(inverse.data() + (std::size_t)i * rows, inverse.data() + (std::size_t)(i + 1) * rows,
+                      r.data() + (std::size_t)i * r.getStride());
+        return r;
+    }
+
+    void makeIdentity() {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        std::fill(storage.begin(), storage.end(), Scalar(0));
+        for (unsigned i = 0; i < rows; i++)
+            storage[(std::size_t)i * stride + i] = 1;
+    }
+
+private:
+    unsigned lines() const { return isRowMajor() ? rows : columns; }
+    unsigned extent() const { return isRowMajor() ? columns : rows; }
+    Scalar* line(unsigned i) { return storage.data() + (std::size_t)i * stride; }
+    const Scalar* line(unsigned i) const { return storage.data() + (std::size_t)i * stride; }
+
+    std::size_t index(unsigned r, unsigned c) const {
+        return isRowMajor() ? (std::size_t)r * stride + c : (std::size_t)c * stride + r;
+    }
+
+    // The stored lines without padding, converted to T.
+    template <class T>
+    MatrixBuffer<T> packed() const {
+        MatrixBuffer<T> elements((std::size_t)lines() * extent());
+        for (unsigned i = 0; i < lines(); i++)
+            std::copy(line(i), line(i) + extent(), elements.data() + (std::size_t)i * extent());
+        return elements;
+    }
+
+    MatrixBuffer<Scalar> storage;
+    unsigned rows = 0, columns = 0, stride = 0;
+    MatrixLayout layout = MatrixLayout::RowMajor;
+};
+
+template<typename Scalar>
+AlignedMatrix<Scalar> operator*(const Scalar& c, const AlignedMatrix<Scalar>& m) {
+    AlignedMatrix<Scalar> r(m);
+    r *= c;
+    return r;
+}
+
+// C = A * B with a row-major B straight from its padded rows.
+template<class Scalar>
+Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& a, const AlignedMatrix<Scalar>& b) {
+    if (a.getColumns() != b.getRows())
+        throw std::runtime_error("Wrong size");
+    if (!b.isRowMajor())
+        return a * b.toLayout(MatrixLayout::RowMajor);
+    Matrix<Scalar> r(a.getRows(), b.getColumns());
+    gemm(a.getRows(), b.getColumns(), a.getColumns(), a.data(), a.getColumns(), b.data(), b.getStride(),
+         r.data(), b.getColumns());
+    return r;
+}
+
+template<class Scalar>
+bool operator==(const AbstractMatrix<Scalar>& a, const AlignedMatrix<Scalar>& b) {
+    return b == a;
+}
+
+template<class Scalar>
+bool operator!=(const AbstractMatrix<Scalar>& a, const AlignedMatrix<Scalar>& b) {
+    return b != a;
+}
+
+template <class Scalar>
+std::ostream& operator<<(std::ostream& out, const AlignedMatrix<Scalar>& m){
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return m.unchecked(i, j); });
+}
+
+#endif
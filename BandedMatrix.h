@@ -0,0 +1,503 @@
+#ifndef BANDED_MATRIX_H
+#define BANDED_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Vector.h"
+#include <cmath>
+
+// Row-pivoted LU decomposition of a banded matrix with lower bandwidth kl
+// and upper bandwidth ku, in band storage. Pivoting can push U out to
+// bandwidth kl + ku, so every row keeps 2 kl + ku + 1 slots; the
+// multipliers of L are kept apart, kl per step, and applied together with
+// the row swaps in order. Factoring costs O(n kl (kl + ku)) and every
+// solve O(n (2 kl + ku)) per right-hand side.
+template <class Scalar>
+class BandedLU {
+public:
+    template <class Other>
+    BandedLU(unsigned size, unsigned lower, unsigned upper, const Other* values) :
+        band((std::size_t)size * (2 * lower + upper + 1), 0), multipliers((std::size_t)size * lower, 0),
+        pivots(size), size(size), lower(lower), upper(lower + upper) {
+        unsigned width = lower + upper + 1;
+        for (unsigned i = 0; i < size; i++){
+            unsigned first = i > lower ? i - lower : 0, last = std::min(size, i + upper + 1);
+            for (unsigned j = first; j < last; j++)
+                at(i, j) = (Scalar)values[(std::size_t)i * width + j + lower - i];
+        }
+        factor();
+    }
+
+    unsigned getSize() const { return size; }
+    bool isSingular() const { return singular; }
+
+    Scalar det() const {
+        if (singular)
+            return 0;
+        Scalar det = 1;
+        for (unsigned i = 0; i < size; i++)
+            det *= at(i, i);
+        return swaps % 2 ? -det : det;
+    }
+
+    Matrix<Scalar> invert() const {
+        MatrixBuffer<Scalar> r((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            r[(std::size_t)i * size + i] = 1;
+        solveInPlace(r.data(), size);
+        return Matrix<Scalar>(size, size, std::move(r));
+    }
+
+    Vector<Scalar> solve(const Vector<Scalar>& b) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), 1);
+        return Vector<Scalar>(size, b.getRows() != 1, std::move(x));
+    }
+
+    Matrix<Scalar> solve(const AbstractMatrix<Scalar>& b) const {
+        if (b.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), b.getColumns());
+        return Matrix<Scalar>(size, b.getColumns(), std::move(x));
+    }
+
+    // Overwrites the row-major size x columns block b with A^-1 * b.
+    void solveInPlace(Scalar* b, unsigned columns) const {
+        if (singular)
+            throw std::runtime_error("Singular matrix");
+        for (unsigned k = 0; k < size; k++){
+            Scalar* bk = b + (std::size_t)k * columns;
+            if (pivots[k] != k){
+                Scalar* bp = b + (std::size_t)pivots[k] * columns;
+                for (unsigned j = 0; j < columns; j++)
+                    std::swap(bk[j], bp[j]);
+            }
+            unsigned last = std::min(size, k + lower + 1);
+            for (unsigned i = k + 1; i < last; i++){
+                Scalar l = multipliers[(std::size_t)k * lower + i - k - 1];
+                Scalar* bi = b + (std::size_t)i * columns;
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] -= l * bk[j];
+            }
+        }
+
+        for (unsigned i = size; i-- > 0; ){
+            Scalar* bi = b + (std::size_t)i * columns;
+            unsigned last = std::min(size, i + upper + 1);
+            for (unsigned k = i + 1; k < last; k++){
+                Scalar u = at(i, k);
+                const Scalar* bk = b + (std::size_t)k * columns;
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] -= u * bk[j];
+            }
+            Scalar diagonal = at(i, i);
+            for (unsigned j = 0; j < columns; j++)
+                bi[j] /= diagonal;
+        }
+    }
+
+private:
+    // Element (i, j) for i - lower <= j <= i + upper.
+    Scalar& at(unsigned i, unsigned j) {
+        return band[(std::size_t)i * (lower + upper + 1) + j + lower - i];
+    }
+
+    Scalar at(unsigned i, unsigned j) const {
+        return band[(std::size_t)i * (lower + upper + 1) + j + lower - i];
+    }
+
+    void factor() {
+        for (unsigned k = 0; k < size; k++){
+            unsigned lastRow = std::min(size, k + lower + 1);
+            unsigned lastColumn = std::min(size, k + upper + 1);
+            unsigned pivot = k;
+            for (unsigned i = k + 1; i < lastRow; i++)
+                if (std::abs(at(i, k)) > std::abs(at(pivot, k)))
+                    pivot = i;
+            pivots[k] = pivot;
+            if (pivot != k){
+                for (unsigned j = k; j < lastColumn; j++)
+                    std::swap(at(k, j), at(pivot, j));
+                swaps++;
+            }
+            Scalar diagonal = at(k, k);
+            if (diagonal == Scalar(0)){
+                singular = true;
+                continue;
+            }
+            for (unsigned i = k + 1; i < lastRow; i++){
+                Scalar factor = at(i, k) / diagonal;
+                multipliers[(std::size_t)k * lower + i - k - 1] = factor;
+                for (unsigned j = k + 1; j < lastColumn; j++)
+                    at(i, j) -= factor * at(k, j);
+            }
+        }
+    }
+
+    MatrixBuffer<Scalar> band;
+    MatrixBuffer<Scalar> multipliers;
+    std::vector<unsigned> pivots;
+    unsigned size = 0, lower = 0, upper = 0;
+    unsigned swaps = 0;
+    bool singular = false;
+};
+
+// Square matrix that is zero outside lower sub-diagonals and upper
+// super-diagonals. Row i is stored as lower + upper + 1 consecutive slots
+// holding columns i - lower .. i + upper; slots that fall outside the
+// matrix are kept zero. Products cost O(n * bandwidth) per column, and
+// det(), invert() and solve() go through BandedLU.
+template <class Scalar_>
+class BandedMatrix {
+public:
+    typedef Scalar_ Scalar;
+
+    BandedMatrix() {}
+
+    BandedMatrix(unsigned size, unsigned lower, unsigned upper, Scalar value = Scalar()) :
+        band((std::size_t)size * (lower + upper + 1), value), size(size), lower(lower), upper(upper) {
+        clearPadding();
+    }
+
+    // Band storage, row by row; values in slots outside the matrix are
+    // ignored.
+    BandedMatrix(unsigned size, unsigned lower, unsigned upper, MatrixBuffer<Scalar> values) :
+        band(std::move(values)), size(size), lower(lower), upper(upper) {
+        if (band.size() != (std::size_t)size * getWidth())
+            throw std::runtime_error("Wrong number of elements");
+        clearPadding();
+    }
+
+    // The band of m; everything outside it must be zero.
+    BandedMatrix(const AbstractMatrix<Scalar>& m, unsigned lower, unsigned upper) :
+        band((std::size_t)m.getRows() * (lower + upper + 1), 0), size(m.getRows()), lower(lower), upper(upper) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++){
+            const Scalar* row = dense.row(i);
+            for (unsigned j = 0; j < size; j++)
+                if (inBand(i, j))
+                    at(i, j) = row[j];
+                else if (row[j] != Scalar(0))
+                    throw std::runtime_error("Not a banded matrix");
+        }
+    }
+
+    Matrix<Scalar> toDense() const {
+        MatrixBuffer<Scalar> elements((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = first(i); j < last(i); j++)
+                elements[(std::size_t)i * size + j] = at(i, j);
+        return Matrix<Scalar>(size, size, std::move(elements));
+    }
+
+    unsigned getRows() const { return size; }
+    unsigned getColumns() const { return size; }
+    unsigned getLowerBandwidth() const { return lower; }
+    unsigned getUpperBandwidth() const { return upper; }
+    unsigned getWidth() const { return lower + upper + 1; }
+    bool isSquare() const { return true; }
+    bool isVector() const { return size == 1; }
+    bool isZero() const { return simdIsZero(band.data(), band.size()); }
+
+    bool isDiagonal() const {
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = first(i); j < last(i); j++)
+                if (i != j && at(i, j) != Scalar(0))
+                    return false;
+        return true;
+    }
+
+    bool isIdentity() const {
+        if (!isDiagonal())
+            return false;
+        for (unsigned i = 0; i < size; i++)
+            if (at(i, i) != Scalar(1))
+                return false;
+        return true;
+    }
+
+    const MatrixBuffer<Scalar>& getBand() const { return band; }
+    Scalar* data() { return band.data(); }
+    const Scalar* data() const { return band.data(); }
+
+    // Columns [first(r), last(r)) of row r that lie inside the band.
+    unsigned first(unsigned r) const { return r > lower ? r - lower : 0; }
+    unsigned last(unsigned r) const { return std::min(size, r + upper + 1); }
+
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < size && c < size);
+        return inBand(r, c) ? at(r, c) : Scalar(0);
+    }
+
+    Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= size || c >= size)
+            throw std::out_of_range("BandedMatrix::operator()");
+        return inBand(r, c) ? at(r, c) : Scalar(0);
+    }
+
+    // Only elements inside the band can be written.
+    Scalar& operator()(unsigned r, unsigned c) {
+        if (r >= size || c >= size || !inBand(r, c))
+            throw std::out_of_range("BandedMatrix::operator()");
+        return at(r, c);
+    }
+
+    bool operator==(const BandedMatrix& m) const {
+        if (size != m.size)
+            return false;
+        if (lower == m.lower && upper == m.upper)
+            return band == m.band;
+        for (unsigned i = 0; i < size; i++){
+            unsigned from = std::min(first(i), m.first(i)), to = std::max(last(i), m.last(i));
+            for (unsigned j = from; j < to; j++)
+                if (unchecked(i, j) != m.unchecked(i, j))
+                    return false;
+        }
+        return true;
+    }
+
+    bool operator!=(const BandedMatrix& m) const { return !(*this == m); }
+
+    bool operator==(const AbstractMatrix<Scalar>& m) const {
+        if (size != m.getRows() || size != m.getColumns())
+            return false;
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = 0; j < size; j++)
+                if (dense(i, j) != unchecked(i, j))
+                    return false;
+        return true;
+    }
+
+    bool operator!=(const AbstractMatrix<Scalar>& m) const { return !(*this == m); }
+
+    // Only the in-band slots of each row count; the zeros outside the band
+    // are mixed in separately, since the padding slots are not elements.
+    Scalar max() const {
+        if (size == 0)
+            return simdMax(band.data(), 0);
+        Scalar result = simdMax(bandRow(0), last(0) - first(0));
+        for (unsigned i = 1; i < size; i++){
+            Scalar value = simdMax(bandRow(i), last(i) - first(i));
+            if (result < value)
+                result = value;
+        }
+        return hasZeros() && result < Scalar(0) ? Scalar(0) : result;
+    }
+
+    Scalar min() const {
+        if (size == 0)
+            return simdMin(band.data(), 0);
+        Scalar result = simdMin(bandRow(0), last(0) - first(0));
+        for (unsigned i = 1; i < size; i++){
+            Scalar value = simdMin(bandRow(i), last(i) - first(i));
+            if (value < result)
+                result = value;
+        }
+        return hasZeros() && Scalar(0) < result ? Scalar(0) : result;
+    }
+
+    Scalar trace() const {
+        Scalar trace = 0;
+        for (unsigned i = 0; i < size; i++)
+            trace += at(i, i);
+        return trace;
+    }
+
+    BandedMatrix& operator+=(const BandedMatrix& m) {
+        if (size != m.size || lower != m.lower || upper != m.upper)
+            throw std::runtime_error("Wrong size");
+        simdAdd(band.data(), m.band.data(), band.size());
+        return *this;
+    }
+
+    BandedMatrix& operator-=(const BandedMatrix& m) {
+        if (size != m.size || lower != m.lower || upper != m.upper)
+            throw std::runtime_error("Wrong size");
+        simdSub(band.data(), m.band.data(), band.size());
+        return *this;
+    }
+
+    BandedMatrix& operator*=(const Scalar& c) {
+        simdScale(band.data(), c, band.size());
+        return *this;
+    }
+
+    // y = A * x for a column vector x.
+    Vector<Scalar> operator*(const Vector<Scalar>& x) const {
+        if (x.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> y(size);
+        const Scalar* xs = x.data();
+        for (unsigned i = 0; i < size; i++){
+            Scalar sum = 0;
+            for (unsigned j = first(i); j < last(i); j++)
+                sum += at(i, j) * xs[j];
+            y[i] = sum;
+        }
+        return Vector<Scalar>(size, true, std::move(y));
+    }
+
+    // C = A * B: row i of C adds the rows of B inside the band of row i.
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
+        if (m.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        unsigned columns = m.getColumns();
+        MatrixBuffer<Scalar> elements((std::size_t)size * columns, 0);
+        const Scalar* b = m.data();
+        ThreadPool& pool = ThreadPool::global();
+        unsigned long long work = (unsigned long long)band.size() * columns;
+        unsigned grain = pool.useParallel(work) ? 1 + 16384ull * size / (work + 1) : size;
+        pool.parallelFor(0, size, grain, [&](unsigned lo, unsigned hi) {
+            for (unsigned i = lo; i < hi; i++){
+                Scalar* c = elements.data() + (std::size_t)i * columns;
+                for (unsigned k = first(i); k < last(i); k++){
+                    Scalar a = at(i, k);
+                    const Scalar* bRow = b + (std::size_t)k * columns;
+                    for (unsigned j = 0; j < columns; j++)
+                        c[j] += a * bRow[j];
+                }
+            }
+        });
+        return Matrix<Scalar>(size, columns, std::move(elements));
+    }
+
+    // The bandwidths of a product add up.
+    BandedMatrix operator*(const BandedMatrix& m) const {
+        if (size != m.size)
+            throw std::runtime_error("Wrong size");
+        BandedMatrix result(size, std::min(size ? size - 1 : 0, lower + m.lower),
+                            std::min(size ? size - 1 : 0, upper + m.upper), Scalar(0));
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned k = first(i); k < last(i); k++){
+                Scalar a = at(i, k);
+                for (unsigned j = m.first(k); j < m.last(k); j++)
+                    result.at(i, j) += a * m.at(k, j);
+            }
+        return result;
+    }
+
+    template<typename T = double>
+    BandedLU<T> lu() const {
+        return BandedLU<T>(size, lower, upper, band.data());
+    }
+
+    template<typename T = double>
+    T det() const {
+        return lu<T>().det();
+    }
+
+    // The inverse of a banded matrix is dense in general.
+    template<typename T = double>
+    Matrix<T> invert() const {
+        return lu<T>().invert();
+    }
+
+    template<typename T>
+    Vector<T> solve(const Vector<T>& b) const {
+        return lu<T>().solve(b);
+    }
+
+    template<typename T>
+    Matrix<T> solve(const AbstractMatrix<T>& b) const {
+        return lu<T>().solve(b);
+    }
+
+    BandedMatrix transpone() const {
+        BandedMatrix t(size, upper, lower, Scalar(0));
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = first(i); j < last(i); j++)
+                t.at(j, i) = at(i, j);
+        return t;
+    }
+
+    void transponeThis() {
+        *this = transpone();
+    }
+
+    void makeIdentity() {
+        std::fill(band.begin(), band.end(), Scalar(0));
+        for (unsigned i = 0; i < size; i++)
+            at(i, i) = 1;
+    }
+
+private:
+    bool inBand(unsigned r, unsigned c) const { return c + lower >= r && c <= r + upper; }
+
+    Scalar& at(unsigned r, unsigned c) { return band[(std::size_t)r * getWidth() + c + lower - r]; }
+    Scalar at(unsigned r, unsigned c) const { return band[(std::size_t)r * getWidth() + c + lower - r]; }
+
+    // The slots of columns [first(r), last(r)) of row r.
+    const Scalar* bandRow(unsigned r) const { return &band[(std::size_t)r * getWidth() + first(r) + lower - r]; }
+
+    // Whether some element lies outside the band.
+    bool hasZeros() const { return size > 1 && (lower + 1 < size || upper + 1 < size); }
+
+    void clearPadding() {
+        for (unsigned i = 0; i < size; i++){
+            Scalar* row = band.data() + (std::size_t)i * getWidth();
+            for (unsigned s = 0; s < getWidth(); s++){
+                unsigned long long column = (unsigned long long)i + s;
+                if (column < lower || column - lower >= size)
+                    row[s] = 0;
+            }
+        }
+    }
+
+    MatrixBuffer<Scalar> band;
+    unsigned size = 0, lower = 0, upper = 0;
+};
+
+template<typename Scalar>
+BandedMatrix<Scalar> operator*(const Scalar& c, const BandedMatrix<Scalar>& m) {
+    BandedMatrix<Scalar> r(m);
+    r *= c;
+    return r;
+}
+
+// C = A * B for a dense A: row i of C adds the band of row k of B scaled by
+// A(i,k).
+template<class Scalar>
+Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& a, const BandedMatrix<Scalar>& b) {
+    if (a.getColumns() != b.getRows())
+        throw std::runtime_error("Wrong size");
+    unsigned rows = a.getRows(), size = b.getRows();
+    MatrixBuffer<Scalar> elements((std::size_t)rows * size, 0);
+    MatrixRef<const Scalar> dense = a.ref();
+    for (unsigned i = 0; i < rows; i++){
+        Scalar* c = elements.data() + (std::size_t)i * size;
+        for (unsigned k = 0; k < size; k++){
+            Scalar factor = dense(i, k);
+            if (factor == Scalar(0))
+                continue;
+            for (unsigned j = b.first(k); j < b.last(k); j++)
+                c[j] += factor * b.unchecked(k, j);
+        }
+    }
+    return Matrix<Scalar>(rows, size, std::move(elements));
+}
+
+template<class Scalar>
+bool operator==(const AbstractMatrix<Scalar>& a, const BandedMatrix<Scalar>& b) {
+    return b == a;
+}
+
+template<class Scalar>
+bool operator!=(const AbstractMatrix<Scalar>& a, const BandedMatrix<Scalar>& b) {
+    return b != a;
+}
+
+template <class Scalar>
+std::ostream& operator<<(std::ostream& out, const BandedMatrix<Scalar>& m){
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return m.unchecked(i, j); });
+}
+
+#endif
@@ -0,0 +1,541 @@
+#ifndef CHOLESKY_H
+#define CHOLESKY_H
+
+#include "AbstractMatrix.h"
+#include "Gemm.h"
+#include <cmath>
+
+template <class Scalar> class Matrix;
+template <class Scalar> class Vector;
+
+// Factorization behind det(), invert() and solve() of SquareMatrix.
+// Automatic uses Cholesky for symmetric positive definite matrices and LU
+// for everything else. MixedPrecision solves through MixedPrecisionLU
+// (float factors refined in double); det() has no refinement and uses LU.
+enum class Factorization { LU, Cholesky, LDLT, Automatic, MixedPrecision };
+
+// A22 -= W * L^T for the lower triangle of the rest x rest block A22 (lda),
+// with W and L both rest x kb. Rows are updated in tiles up to the
+// diagonal, so about half the flops of the full product are spent.
+template <class Scalar>
+void symmetricUpdate(unsigned rest, unsigned kb, const Scalar* w, const Scalar* l, Scalar* a, unsigned lda) {
+    const unsigned tile = 256;
+    MatrixBuffer<Scalar> lt((std::size_t)kb * rest);
+    for (unsigned i = 0; i < rest; i++)
+        for (unsigned k = 0; k < kb; k++)
+            lt[(std::size_t)k * rest + i] = l[(std::size_t)i * kb + k];
+    for (unsigned i0 = 0; i0 < rest; i0 += tile){
+        unsigned rows = std::min(tile, rest - i0);
+        gemm(rows, i0 + rows, kb, w + (std::size_t)i0 * kb, kb, lt.data(), rest,
+             a + (std::size_t)i0 * lda, lda);
+    }
+}
+
+// Overwrites the size x columns block b with L^-1 b, for the lower
+// triangle of l (row-major, size x size) with a unit diagonal if unit is
+// set. Blocks of 64 rows are solved directly and then subtracted from the
+// rest of b with gemm.
+template <class Scalar>
+void lowerSolve(const Scalar* l, unsigned size, Scalar* b, unsigned columns, bool unit) {
+    const unsigned block = 64;
+    MatrixBuffer<Scalar> panel;
+    for (unsigned k0 = 0; k0 < size; k0 += block){
+        unsigned k1 = std::min(size, k0 + block), kb = k1 - k0;
+        for (unsigned i = k0; i < k1; i++){
+            Scalar* bi = b + (std::size_t)i * columns;
+            for (unsigned k = k0; k < i; k++){
+                Scalar factor = l[(std::size_t)i * size + k];
+                const Scalar* bk = b + (std::size_t)k * columns;
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] -= factor * bk[j];
+            }
+            if (!unit){
+                Scalar diagonal = l[(std::size_t)i * size + i];
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] /= diagonal;
+            }
+        }
+        if (k1 == size)
+            break;
+        // b[k1:] -= L[k1:, k0:k1] * b[k0:k1]
+        unsigned rest = size - k1;
+        panel.resize((std::size_t)rest * kb);
+        for (unsigned i = 0; i < rest; i++)
+            for (unsigned k = 0; k < kb; k++)
+                panel[(std::size_t)i * kb + k] = -l[(std::size_t)(k1 + i) * size + k0 + k];
+        gemm(rest, columns, kb, panel.data(), kb, b + (std::size_t)k0 * columns, columns,
+             b + (std::size_t)k1 * columns, columns);
+    }
+}
+
+// Overwrites b with L^-T b, as lowerSolve, from the last block up.
+template <class Scalar>
+void lowerTransposeSolve(const Scalar* l, unsigned size, Scalar* b, unsigned columns, bool unit) {
+    const unsigned block = 64;
+    MatrixBuffer<Scalar> panel;
+    for (unsigned k1 = size; k1 > 0; ){
+        unsigned k0 = k1 > block ? k1 - block : 0, kb = k1 - k0;
+        for (unsigned i = k1; i-- > k0; ){
+            Scalar* bi = b + (std::size_t)i * columns;
+            if (!unit){
+                Scalar diagonal = l[(std::size_t)i * size + i];
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] /= diagonal;
+            }
+            for (unsigned k = k0; k < i; k++){
+                Scalar factor = l[(std::size_t)i * size + k];
+                Scalar* bk = b + (std::size_t)k * columns;
+                for (unsigned j = 0; j < columns; j++)
+                    bk[j] -= factor * bi[j];
+            }
+        }
+        // b[:k0] -= L[k0:k1, :k0]^T * b[k0:k1]
+        if (k0 > 0){
+            panel.resize((std::size_t)k0 * kb);
+            for (unsigned k = 0; k < kb; k++)
+                for (unsigned i = 0; i < k0; i++)
+                    panel[(std::size_t)i * kb + k] = -l[(std::size_t)(k0 + k) * size + i];
+            gemm(k0, columns, kb, panel.data(), kb, b + (std::size_t)k0 * columns, columns, b, columns);
+        }
+        k1 = k0;
+    }
+}
+
+// Blocked Cholesky decomposition A = L L^T of a symmetric positive definite
+// matrix, about half the work of LU. Only the lower triangle of A is read,
+// and L is stored in the lower triangle of the factors. If A is not
+// positive definite the factorization stops and isPositiveDefinite() is
+// false; det() and the solves then throw.
+template <class Scalar>
+class Cholesky {
+public:
+    static constexpr unsigned blockSize = 64;
+
+    template <class Other>
+    explicit Cholesky(const AbstractMatrix<Other>& m) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        size = m.getRows();
+        factors.assign(m.begin(), m.end());
+        factor();
+    }
+
+    Cholesky(unsigned size, MatrixBuffer<Scalar> values) : factors(std::move(values)), size(size) {
+        if ((std::size_t)size * size != factors.size())
+            throw std::runtime_error("Wrong number of elements");
+        factor();
+    }
+
+    unsigned getSize() const { return size; }
+    bool isPositiveDefinite() const { return positiveDefinite; }
+
+    const MatrixBuffer<Scalar>& getFactors() const { return factors; }
+
+    Scalar det() const {
+        check();
+        Scalar det = 1;
+        for (unsigned i = 0; i < size; i++)
+            det *= at(i, i) * at(i, i);
+        return det;
+    }
+
+    // log(det(A)), which does not overflow for large matrices.
+    Scalar logDet() const {
+        check();
+        Scalar sum = 0;
+        for (unsigned i = 0; i < size; i++)
+            sum += std::log(at(i, i));
+        return 2 * sum;
+    }
+
+    Matrix<Scalar> invert() const {
+        MatrixBuffer<Scalar> r((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            r[(std::size_t)i * size + i] = 1;
+        solveInPlace(r.data(), size);
+        return Matrix<Scalar>(size, size, std::move(r));
+    }
+
+    Vector<Scalar> solve(const Vector<Scalar>& b) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), 1);
+        return Vector<Scalar>(size, b.getRows() != 1, std::move(x));
+    }
+
+    Matrix<Scalar> solve(const AbstractMatrix<Scalar>& b) const {
+        if (b.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), b.getColumns());
+        return Matrix<Scalar>(size, b.getColumns(), std::move(x));
+    }
+
+    // Overwrites the row-major size x columns block b with A^-1 * b.
+    void solveInPlace(Scalar* b, unsigned columns) const {
+        check();
+        lowerSolve(factors.data(), size, b, columns, false);
+        lowerTransposeSolve(factors.data(), size, b, columns, false);
+    }
+
+private:
+    Scalar at(unsigned r, unsigned c) const { return factors[(std::size_t)r * size + c]; }
+
+    void check() const {
+        if (!positiveDefinite)
+            throw std::runtime_error("Not positive definite");
+    }
+
+    // Columns [k0, k1) of L over rows [k0, size), left-looking inside the
+    // panel.
+    bool factorPanel(unsigned k0, unsigned k1) {
+        Scalar* a = factors.data();
+        for (unsigned k = k0; k < k1; k++){
+            Scalar* rowK = a + (std::size_t)k * size;
+            Scalar diagonal = rowK[k];
+            for (unsigned p = k0; p < k; p++)
+                diagonal -= rowK[p] * rowK[p];
+            if (!(diagonal > Scalar(0)))
+                return false;
+            diagonal = std::sqrt(diagonal);
+            rowK[k] = diagonal;
+            for (unsigned i = k + 1; i < size; i++){
+                Scalar* rowI = a + (std::size_t)i * size;
+                Scalar sum = rowI[k];
+                for (unsigned p = k0; p < k; p++)
+                    sum -= rowI[p] * rowK[p];
+                rowI[k] = sum / diagonal;
+            }
+        }
+        return true;
+    }
+
+    void factor() {
+        Scalar* a = factors.data();
+        MatrixBuffer<Scalar> l21, w;
+        for (unsigned k0 = 0; k0 < size; k0 += blockSize){
+            unsigned k1 = std::min(size, k0 + blockSize);
+            unsigned kb = k1 - k0;
+            if (!factorPanel(k0, k1)){
+                positiveDefinite = false;
+                return;
+            }
+            if (k1 == size)
+                break;
+
+            // A22 -= L21 * L21^T
+            unsigned rest = size - k1;
+            l21.resize((std::size_t)rest * kb);
+            w.resize((std::size_t)rest * kb);
+            for (unsigned i = 0; i < rest; i++)
+                for (unsigned k = 0; k < kb; k++){
+                    l21[(std::size_t)i * kb + k] = a[(std::size_t)(k1 + i) * size + k0 + k];
+                    w[(std::size_t)i * kb + k] = -l21[(std::size_t)i * kb + k];
+                }
+            symmetricUpdate(rest, kb, w.data(), l21.data(), a + (std::size_t)k1 * size + k1, size);
+        }
+    }
+
+    MatrixBuffer<Scalar> factors;
+    unsigned size = 0;
+    bool positiveDefinite = true;
+};
+
+// Blocked LDL^T decomposition P A P^T = L D L^T of a symmetric matrix with
+// Bunch-Kaufman pivoting: L is unit lower triangular, D is block diagonal
+// with 1x1 and 2x2 blocks, and P swaps rows and columns symmetrically. Like
+// Cholesky it reads only the lower triangle and needs no square roots, and
+// the pivoting keeps it stable on symmetric indefinite matrices, including
+// ones with zeros on the diagonal. Only a zero column left in the reduced
+// matrix, which makes A singular, stops the factorization. L is stored
+// below the diagonal of the factors, the diagonal of D on it; the pivots
+// are interchanges as in LU.
+template <class Scalar>
+class LDLT {
+public:
+    static constexpr unsigned blockSize = 64;
+
+    template <class Other>
+    explicit LDLT(const AbstractMatrix<Other>& m) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        size = m.getRows();
+        factors.assign(m.begin(), m.end());
+        factor();
+    }
+
+    LDLT(unsigned size, MatrixBuffer<Scalar> values) : factors(std::move(values)), size(size) {
+        if ((std::size_t)size * size != factors.size())
+            throw std::runtime_error("Wrong number of elements");
+        factor();
+    }
+
+    unsigned getSize() const { return size; }
+    bool isSingular() const { return singular; }
+
+    const MatrixBuffer<Scalar>& getFactors() const { return factors; }
+    const std::vector<unsigned>& getPivots() const { return pivots; }
+
+    // Off-diagonal element of D at (i + 1, i) if a 2x2 block starts at i,
+    // otherwise zero.
+    const MatrixBuffer<Scalar>& getOffDiagonal() const { return offDiagonal; }
+
+    // det(P A P^T) = det(A), so only the blocks of D count.
+    Scalar det() const {
+        if (singular)
+            return 0;
+        Scalar det = 1;
+        for (unsigned i = 0; i < size; i++)
+            if (isBlock(i)){
+                det *= at(i, i) * at(i + 1, i + 1) - offDiagonal[i] * offDiagonal[i];
+                i++;
+            }
+            else
+                det *= at(i, i);
+        return det;
+    }
+
+    // Number of negative eigenvalues of A (Sylvester's law of inertia).
+    unsigned negativeEigenvalues() const {
+        unsigned count = 0;
+        for (unsigned i = 0; i < size; i++)
+            if (isBlock(i)){
+                Scalar a = at(i, i), b = at(i + 1, i + 1), e = offDiagonal[i];
+                count += a * b - e * e < Scalar(0) ? 1 : a + b < Scalar(0) ? 2 : 0;
+                i++;
+            }
+            else if (at(i, i) < Scalar(0))
+                count++;
+        return count;
+    }
+
+    Matrix<Scalar> invert() const {
+        MatrixBuffer<Scalar> r((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            r[(std::size_t)i * size + i] = 1;
+        solveInPlace(r.data(), size);
+        return Matrix<Scalar>(size, size, std::move(r));
+    }
+
+    Vector<Scalar> solve(const Vector<Scalar>& b) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), 1);
+        return Vector<Scalar>(size, b.getRows() != 1, std::move(x));
+    }
+
+    Matrix<Scalar> solve(const AbstractMatrix<Scalar>& b) const {
+        if (b.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), b.getColumns());
+        return Matrix<Scalar>(size, b.getColumns(), std::move(x));
+    }
+
+    // Overwrites the row-major size x columns block b with A^-1 * b.
+    void solveInPlace(Scalar* b, unsigned columns) const {
+        if (singular)
+            throw std::runtime_error("Singular matrix");
+        for (unsigned k = 0; k < size; k++)
+            if (pivots[k] != k)
+                swapRows(b, columns, k, pivots[k]);
+        lowerSolve(factors.data(), size, b, columns, true);
+        for (unsigned i = 0; i < size; i++){
+            Scalar* bi = b + (std::size_t)i * columns;
+            if (isBlock(i)){
+                // [x_i; x_i+1] = [a e; e c]^-1 [b_i; b_i+1]
+                Scalar* next = bi + columns;
+                Scalar a = at(i, i), c = at(i + 1, i + 1), e = offDiagonal[i];
+                Scalar determinant = a * c - e * e;
+                for (unsigned j = 0; j < columns; j++){
+                    Scalar first = bi[j], second = next[j];
+                    bi[j] = (c * first - e * second) / determinant;
+                    next[j] = (a * second - e * first) / determinant;
+                }
+                i++;
+            }
+            else{
+                Scalar diagonal = at(i, i);
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] /= diagonal;
+            }
+        }
+        lowerTransposeSolve(factors.data(), size, b, columns, true);
+        for (unsigned k = size; k-- > 0; )
+            if (pivots[k] != k)
+                swapRows(b, columns, k, pivots[k]);
+    }
+
+private:
+    Scalar at(unsigned r, unsigned c) const { return factors[(std::size_t)r * size + c]; }
+    bool isBlock(unsigned i) const { return offDiagonal[i] != Scalar(0); }
+
+    static void swapRows(Scalar* b, unsigned columns, unsigned first, unsigned second) {
+        std::swap_ranges(b + (std::size_t)first * columns, b + (std::size_t)(first + 1) * columns,
+                         b + (std::size_t)second * columns);
+    }
+
+    // Swaps rows and columns p < q of the symmetric matrix held in the lower
+    // triangle, including the rows of L computed so far, and rows p and q of
+    // the panel workspace w (ldw, starting at row k0).
+    void interchange(unsigned p, unsigned q, Scalar* w, unsigned ldw, unsigned k0) {
+        Scalar* a = factors.data();
+        std::swap_ranges(a + (std::size_t)p * size, a + (std::size_t)p * size + p, a + (std::size_t)q * size);
+        for (unsigned c = p + 1; c < q; c++)
+            std::swap(a[(std::size_t)c * size + p], a[(std::size_t)q * size + c]);
+        std::swap(a[(std::size_t)p * size + p], a[(std::size_t)q * size + q]);
+        for (unsigned i = q + 1; i < size; i++)
+            std::swap(a[(std::size_t)i * size + p], a[(std::size_t)i * size + q]);
+        std::swap_ranges(w + (std::size_t)(p - k0) * ldw, w + (std::size_t)(p - k0 + 1) * ldw,
+                         w + (std::size_t)(q - k0) * ldw);
+    }
+
+    // Rows [k, size) of column c of the reduced matrix: the lower triangle
+    // minus the columns [k0, k) of the panel, L(i, j) * W(c, j), where W
+    // holds L D.
+    void reducedColumn(unsigned c, unsigned k0, unsigned k, const Scalar* w, unsigned ldw, Scalar* column) const {
+        const Scalar* a = factors.data();
+        const Scalar* wc = w + (std::size_t)(c - k0) * ldw;
+        for (unsigned i = k; i < size; i++){
+            Scalar value = i >= c ? a[(std::size_t)i * size + c] : a[(std::size_t)c * size + i];
+            const Scalar* li = a + (std::size_t)i * size + k0;
+            for (unsigned j = 0; j < k - k0; j++)
+                value -= li[j] * wc[j];
+            column[i - k] = value;
+        }
+    }
+
+    // Columns [k0, k1) of L and D over rows [k0, size), left-looking inside
+    // the panel; a 2x2 block starting at k1 - 1 takes column k1 too. Returns
+    // the end of the panel, or 0 if A is singular. Column j - k0 of w
+    // (ldw) receives L D for column j.
+    unsigned factorPanel(unsigned k0, unsigned k1, Scalar* w, unsigned ldw) {
+        // Bunch-Kaufman bound on the growth of the elements
+        const Scalar alpha = (Scalar(1) + std::sqrt(Scalar(17))) / Scalar(8);
+        Scalar* a = factors.data();
+        MatrixBuffer<Scalar> first(size - k0), second(size - k0);
+        unsigned k = k0;
+        while (k < k1){
+            Scalar* ck = first.data();
+            reducedColumn(k, k0, k, w, ldw, ck);
+            unsigned n = size - k, imax = 0;
+            Scalar diagonal = std::abs(ck[0]), columnMax = 0;
+            for (unsigned i = 1; i < n; i++)
+                if (std::abs(ck[i]) > columnMax){
+                    columnMax = std::abs(ck[i]);
+                    imax = i;
+                }
+            if (diagonal == Scalar(0) && columnMax == Scalar(0))
+                return 0;
+
+            bool block = false;
+            if (!(diagonal >= alpha * columnMax)){
+                Scalar* cr = second.data();
+                reducedColumn(k + imax, k0, k, w, ldw, cr);
+                Scalar rowMax = 0;
+                for (unsigned i = 0; i < n; i++)
+                    if (i != imax)
+                        rowMax = std::max(rowMax, std::abs(cr[i]));
+                if (!(diagonal >= alpha * columnMax * (columnMax / rowMax))){
+                    if (std::abs(cr[imax]) >= alpha * rowMax){
+                        // 1x1 pivot from the diagonal at k + imax
+                        interchange(k, k + imax, w, ldw, k0);
+                        std::swap(cr[0], cr[imax]);
+                        std::swap(first, second);
+                        ck = first.data();
+                        pivots[k] = k + imax;
+                    }
+                    else
+                        block = true;
+                }
+            }
+
+            if (!block){
+                Scalar d = ck[0];
+                a[(std::size_t)k * size + k] = d;
+                w[(std::size_t)(k - k0) * ldw + k - k0] = d;
+                for (unsigned i = 1; i < n; i++){
+                    a[(std::size_t)(k + i) * size + k] = ck[i] / d;
+                    w[(std::size_t)(k + i - k0) * ldw + k - k0] = ck[i];
+                }
+                k++;
+                continue;
+            }
+
+            // 2x2 pivot on rows k and k + imax, moved next to each other.
+            Scalar* cr = second.data();
+            if (imax != 1){
+                interchange(k + 1, k + imax, w, ldw, k0);
+                std::swap(ck[1], ck[imax]);
+                std::swap(cr[1], cr[imax]);
+            }
+            pivots[k + 1] = k + imax;
+            Scalar d0 = ck[0], e = ck[1], d1 = cr[1];
+            // [L(i, k) L(i, k + 1)] = [ck(i) cr(i)] D^-1, scaled by e against
+            // overflow.
+            Scalar r0 = d1 / e, r1 = d0 / e;
+            Scalar scale = (Scalar(1) / (r0 * r1 - Scalar(1))) / e;
+            a[(std::size_t)k * size + k] = d0;
+            a[(std::size_t)(k + 1) * size + k + 1] = d1;
+            a[(std::size_t)(k + 1) * size + k] = 0;
+            offDiagonal[k] = e;
+            Scalar* wk = w + (std::size_t)(k - k0) * ldw + k - k0;
+            wk[0] = d0;
+            wk[1] = e;
+            wk[ldw] = e;
+            wk[ldw + 1] = d1;
+            for (unsigned i = 2; i < n; i++){
+                a[(std::size_t)(k + i) * size + k] = scale * (r0 * ck[i] - cr[i]);
+                a[(std::size_t)(k + i) * size + k + 1] = scale * (r1 * cr[i] - ck[i]);
+                w[(std::size_t)(k + i - k0) * ldw + k - k0] = ck[i];
+                w[(std::size_t)(k + i - k0) * ldw + k + 1 - k0] = cr[i];
+            }
+            k += 2;
+        }
+        return k;
+    }
+
+    void factor() {
+        pivots.resize(size);
+        for (unsigned i = 0; i < size; i++)
+            pivots[i] = i;
+        offDiagonal.assign(size, 0);
+        Scalar* a = factors.data();
+        const unsigned ldw = blockSize + 1;
+        MatrixBuffer<Scalar> w, l21, w21;
+        for (unsigned k0 = 0, k1; k0 < size; k0 = k1){
+            w.assign((std::size_t)(size - k0) * ldw, 0);
+            k1 = factorPanel(k0, std::min(size, k0 + blockSize), w.data(), ldw);
+            if (k1 == 0){
+                singular = true;
+                return;
+            }
+            if (k1 == size)
+                break;
+
+            // A22 -= L21 * (L21 D)^T
+            unsigned rest = size - k1, kb = k1 - k0;
+            l21.resize((std::size_t)rest * kb);
+            w21.resize((std::size_t)rest * kb);
+            for (unsigned i = 0; i < rest; i++)
+                for (unsigned k = 0; k < kb; k++){
+                    l21[(std::size_t)i * kb + k] = a[(std::size_t)(k1 + i) * size + k0 + k];
+                    w21[(std::size_t)i * kb + k] = -w[(std::size_t)(k1 - k0 + i) * ldw + k];
+                }
+            symmetricUpdate(rest, kb, w21.data(), l21.data(), a + (std::size_t)k1 * size + k1, size);
+        }
+    }
+
+    MatrixBuffer<Scalar> factors;
+    MatrixBuffer<Scalar> offDiagonal;
+    std::vector<unsigned> pivots;
+    unsigned size = 0;
+    bool singular = false;
+};
+
+#include "Matrix.h"
+#include "Vector.h"
+
+#endif
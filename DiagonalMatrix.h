@@ -0,0 +1,255 @@
+#ifndef DIAGONAL_MATRIX_H
+#define DIAGONAL_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "Simd.h"
+#include "Vector.h"
+
+// Square matrix that is zero off the diagonal, stored as its n diagonal
+// elements. Products scale rows or columns in O(n) per row or column, and
+// det(), invert() and solve() are O(n).
+template <class Scalar_>
+class DiagonalMatrix {
+public:
+    typedef Scalar_ Scalar;
+
+    DiagonalMatrix() {}
+
+    DiagonalMatrix(unsigned size, Scalar value = Scalar()) : diagonal(size, value), size(size) {}
+
+    DiagonalMatrix(unsigned size, MatrixBuffer<Scalar> values) : diagonal(std::move(values)), size(size) {
+        if (diagonal.size() != size)
+            throw std::runtime_error("Wrong number of elements");
+    }
+
+    explicit DiagonalMatrix(const AbstractMatrix<Scalar>& m) : diagonal(m.getRows()), size(m.getRows()) {
+        if (!m.isDiagonal())
+            throw std::runtime_error("Not a diagonal matrix");
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++)
+            diagonal[i] = dense(i, i);
+    }
+
+    static DiagonalMatrix identity(unsigned size) { return DiagonalMatrix(size, Scalar(1)); }
+
+    Matrix<Scalar> toDense() const {
+        MatrixBuffer<Scalar> elements((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            elements[(std::size_t)i * size + i] = diagonal[i];
+        return Matrix<Scalar>(size, size, std::move(elements));
+    }
+
+    unsigned getRows() const { return size; }
+    unsigned getColumns() const { return size; }
+    bool isSquare() const { return true; }
+    bool isVector() const { return size == 1; }
+    bool isDiagonal() const { return true; }
+    bool isSymmetric() const { return true; }
+    bool isZero() const { return simdIsZero(diagonal.data(), size); }
+
+    bool isIdentity() const {
+        for (const Scalar& d : diagonal)
+            if (d != Scalar(1))
+                return false;
+        return true;
+    }
+
+    const MatrixBuffer<Scalar>& getDiagonal() const { return diagonal; }
+    Scalar* data() { return diagonal.data(); }
+    const Scalar* data() const { return diagonal.data(); }
+
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < size && c < size);
+        return r == c ? diagonal[r] : Scalar(0);
+    }
+
+    Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= size || c >= size)
+            throw std::out_of_range("DiagonalMatrix::operator()");
+        return r == c ? diagonal[r] : Scalar(0);
+    }
+
+    Scalar& operator()(unsigned p) {
+        if (p >= size)
+            throw std::out_of_range("DiagonalMatrix::operator()");
+        return diagonal[p];
+    }
+
+    Scalar operator()(unsigned p) const {
+        if (p >= size)
+            throw std::out_of_range("DiagonalMatrix::operator()");
+        return diagonal[p];
+    }
+
+    bool operator==(const DiagonalMatrix& m) const { return size == m.size && diagonal == m.diagonal; }
+    bool operator!=(const DiagonalMatrix& m) const { return !(*this == m); }
+
+    bool operator==(const AbstractMatrix<Scalar>& m) const {
+        if (size != m.getRows() || size != m.getColumns())
+            return false;
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = 0; j < size; j++)
+                if (dense(i, j) != (i == j ? diagonal[i] : Scalar(0)))
+                    return false;
+        return true;
+    }
+
+    bool operator!=(const AbstractMatrix<Scalar>& m) const { return !(*this == m); }
+
+    Scalar max() const {
+        Scalar result = simdMax(diagonal.data(), size);
+        return size > 1 && result < Scalar(0) ? Scalar(0) : result;
+    }
+
+    Scalar min() const {
+        Scalar result = simdMin(diagonal.data(), size);
+        return size > 1 && Scalar(0) < result ? Scalar(0) : result;
+    }
+
+    Scalar trace() const {
+        Scalar trace = 0;
+        for (const Scalar& d : diagonal)
+            trace += d;
+        return trace;
+    }
+
+    DiagonalMatrix& operator+=(const DiagonalMatrix& m) {
+        if (size != m.size)
+            throw std::runtime_error("Wrong size");
+        simdAdd(diagonal.data(), m.diagonal.data(), size);
+        return *this;
+    }
+
+    DiagonalMatrix& operator-=(const DiagonalMatrix& m) {
+        if (size != m.size)
+            throw std::runtime_error("Wrong size");
+        simdSub(diagonal.data(), m.diagonal.data(), size);
+        return *this;
+    }
+
+    DiagonalMatrix& operator*=(const Scalar& c) {
+        simdScale(diagonal.data(), c, size);
+        return *this;
+    }
+
+    DiagonalMatrix& operator*=(const DiagonalMatrix& m) {
+        if (size != m.size)
+            throw std::runtime_error("Wrong size");
+        for (unsigned i = 0; i < size; i++)
+            diagonal[i] *= m.diagonal[i];
+        return *this;
+    }
+
+    DiagonalMatrix operator*(const DiagonalMatrix& m) const {
+        DiagonalMatrix r(*this);
+        r *= m;
+        return r;
+    }
+
+    // y = D * x for a column vector x.
+    Vector<Scalar> operator*(const Vector<Scalar>& x) const {
+        if (x.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> y(size);
+        const Scalar* xs = x.data();
+        for (unsigned i = 0; i < size; i++)
+            y[i] = diagonal[i] * xs[i];
+        return Vector<Scalar>(size, true, std::move(y));
+    }
+
+    // C = D * B: row i of B scaled by D(i,i).
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
+        if (m.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        unsigned columns = m.getColumns();
+        MatrixBuffer<Scalar> elements(m.begin(), m.end());
+        for (unsigned i = 0; i < size; i++)
+            simdScale(elements.data() + (std::size_t)i * columns, diagonal[i], columns);
+        return Matrix<Scalar>(size, columns, std::move(elements));
+    }
+
+    template<typename T = double>
+    T det() const {
+        T det = 1;
+        for (const Scalar& d : diagonal)
+            det *= (T)d;
+        return det;
+    }
+
+    template<typename T = double>
+    DiagonalMatrix<T> invert() const {
+        MatrixBuffer<T> inverse(size);
+        for (unsigned i = 0; i < size; i++){
+            if (diagonal[i] == Scalar(0))
+                throw std::runtime_error("Singular matrix");
+            inverse[i] = 1 / (T)diagonal[i];
+        }
+        return DiagonalMatrix<T>(size, std::move(inverse));
+    }
+
+    template<typename T>
+    Vector<T> solve(const Vector<T>& b) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        Vector<T> x(b);
+        T* xs = x.data();
+        for (unsigned i = 0; i < size; i++){
+            if (diagonal[i] == Scalar(0))
+                throw std::runtime_error("Singular matrix");
+            xs[i] /= (T)diagonal[i];
+        }
+        return x;
+    }
+
+    DiagonalMatrix transpone() const { return *this; }
+    void transponeThis() {}
+
+    void makeIdentity() { std::fill(diagonal.begin(), diagonal.end(), Scalar(1)); }
+
+private:
+    MatrixBuffer<Scalar> diagonal;
+    unsigned size = 0;
+};
+
+template<typename Scalar>
+DiagonalMatrix<Scalar> operator*(const Scalar& c, const DiagonalMatrix<Scalar>& m) {
+    DiagonalMatrix<Scalar> r(m);
+    r *= c;
+    return r;
+}
+
+// C = A * D: column j of A scaled by D(j,j).
+template<class Scalar>
+Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& a, const DiagonalMatrix<Scalar>& d) {
+    if (a.getColumns() != d.getRows())
+        throw std::runtime_error("Wrong size");
+    unsigned rows = a.getRows(), columns = d.getColumns();
+    MatrixBuffer<Scalar> elements(a.begin(), a.end());
+    const Scalar* diagonal = d.data();
+    for (unsigned i = 0; i < rows; i++){
+        Scalar* row = elements.data() + (std::size_t)i * columns;
+        for (unsigned j = 0; j < columns; j++)
+            row[j] *= diagonal[j];
+    }
+    return Matrix<Scalar>(rows, columns, std::move(elements));
+}
+
+template<class Scalar>
+bool operator==(const AbstractMatrix<Scalar>& a, const DiagonalMatrix<Scalar>& d) {
+    return d == a;
+}
+
+template<class Scalar>
+bool operator!=(const AbstractMatrix<Scalar>& a, const DiagonalMatrix<Scalar>& d) {
+    return d != a;
+}
+
+template <class Scalar>
+std::ostream& operator<<(std::ostream& out, const DiagonalMatrix<Scalar>& m){
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return m.unchecked(i, j); });
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include "AbstractMatrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include <cstddef>
+#include <type_traits>
+
+template <class Scalar> class Matrix;
+
+// Elementwise arithmetic (+, -, unary -, scalar *) on matrices builds a tree
+// of lightweight expression nodes instead of computing temporaries. The tree
+// is evaluated in a single pass when it is assigned to a Matrix,
+// SquareMatrix or Vector. Nodes refer to their matrix operands, so an
+// expression must not outlive the statement that creates it.
+template <class E>
+class MatrixExpression {
+public:
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    template <class F = E>
+    Matrix<typename F::Scalar> eval() const { return Matrix<typename F::Scalar>(*this); }
+};
+
+template <class Scalar_>
+class MatrixOperand : public MatrixExpression<MatrixOperand<Scalar_>> {
+public:
+    typedef Scalar_ Scalar;
+
+    MatrixOperand(const AbstractMatrix<Scalar>& m) :
+        data(m.data()),
+        rows(m.getRows()), columns(m.getColumns()) {}
+
+    unsigned getRows() const { return rows; }
+    unsigned getColumns() const { return columns; }
+    Scalar at(unsigned r, unsigned c) const { return data[(std::size_t)r * columns + c]; }
+    const Scalar* getData() const { return data; }
+
+private:
+    const Scalar* data;
+    unsigned rows, columns;
+};
+
+struct ExpressionPlus {
+    template <class Scalar>
+    static Scalar apply(const Scalar& a, const Scalar& b) { return a + b; }
+};
+
+struct ExpressionMinus {
+    template <class Scalar>
+    static Scalar apply(const Scalar& a, const Scalar& b) { return a - b; }
+};
+
+template <class L, class R, class Op>
+class ElementwiseExpression : public MatrixExpression<ElementwiseExpression<L, R, Op>> {
+public:
+    typedef typename L::Scalar Scalar;
+
+    ElementwiseExpression(const L& l, const R& r) : l(l), r(r) {
+        if (l.getRows() != r.getRows() || l.getColumns() != r.getColumns())
+            throw std::runtime_error("Wrong size");
+    }
+
+    unsigned getRows() const { return l.getRows(); }
+    unsigned getColumns() const { return l.getColumns(); }
+    Scalar at(unsigned i, unsigned j) const { return Op::apply(l.at(i, j), r.at(i, j)); }
+
+private:
+    L l;
+    R r;
+};
+
+template <class E>
+class ScaledExpression : public MatrixExpression<ScaledExpression<E>> {
+public:
+    typedef typename E::Scalar Scalar;
+
+    ScaledExpression(const E& e, const Scalar& c) : e(e), c(c) {}
+
+    unsigned getRows() const { return e.getRows(); }
+    unsigned getColumns() const { return e.getColumns(); }
+    Scalar at(unsigned r, unsigned j) const { return e.at(r, j) * c; }
+
+private:
+    E e;
+    Scalar c;
+};
+
+template <class E>
+class NegatedExpression : public MatrixExpression<NegatedExpression<E>> {
+public:
+    typedef typename E::Scalar Scalar;
+
+    NegatedExpression(const E& e) : e(e) {}
+
+    unsigned getRows() const { return e.getRows(); }
+    unsigned getColumns() const { return e.getColumns(); }
+    Scalar at(unsigned r, unsigned c) const { return -e.at(r, c); }
+    const E& operand() const { return e; }
+
+private:
+    E e;
+};
+
+// out(r, c) = Op::apply(out(r, c), e(r, c)) over a row-major block with the
+// given stride. Elementwise nodes only read (r, c) to produce element
+// (r, c), so out may be one of the operands, but must not partially
+// overlap one.
+template <class Op, class Scalar, class E>
+void updateExpression(Scalar* out, std::size_t stride, const MatrixExpression<E>& e) {
+    const E& x = e.self();
+    unsigned rows = x.getRows(), columns = x.getColumns();
+    for (unsigned r = 0; r < rows; r++){
+        Scalar* row = out + r * stride;
+        for (unsigned c = 0; c < columns; c++)
+            row[c] = Op::apply(row[c], x.at(r, c));
+    }
+}
+
+struct ExpressionAssign {
+    template <class Scalar>
+    static Scalar apply(const Scalar&, const Scalar& b) { return b; }
+};
+
+// Evaluates e into out. If the size changes, e is evaluated into a new
+// buffer first, since it may read from out through a view.
+template <class Scalar, class E>
+void assignExpression(MatrixBuffer<Scalar>& out, const MatrixExpression<E>& e) {
+    std::size_t size = (std::size_t)e.self().getRows() * e.self().getColumns();
+    if (out.size() != size){
+        MatrixBuffer<Scalar> result(size);
+        updateExpression<ExpressionAssign>(result.data(), e.self().getColumns(), e);
+        out = std::move(result);
+    }
+    else
+        updateExpression<ExpressionAssign>(out.data(), e.self().getColumns(), e);
+}
+
+template <class Scalar>
+void assignExpression(MatrixBuffer<Scalar>& out,
+                      const MatrixExpression<NegatedExpression<MatrixOperand<Scalar>>>& e) {
+    const MatrixOperand<Scalar>& m = e.self().operand();
+    unsigned size = m.getRows() * m.getColumns();
+    if (out.size() != size)
+        out.resize(size);
+    simdNegate(out.data(), m.getData(), size);
+}
+
+// Maps an operand type to the node stored in the expression tree: matrices
+// are referenced through MatrixOperand, expressions are stored by value.
+template <class T, class Enable = void>
+struct ExpressionTraits {
+    static const bool isOperand = false;
+};
+
+template <class T>
+struct ExpressionTraits<T, typename std::enable_if<
+        std::is_base_of<AbstractMatrix<typename T::Scalar>, T>::value>::type> {
+    static const bool isOperand = true;
+    typedef typename T::Scalar Scalar;
+    typedef MatrixOperand<Scalar> Type;
+    static Type wrap(const T& m) { return Type(m); }
+};
+
+template <class T>
+struct ExpressionTraits<T, typename std::enable_if<
+        std::is_base_of<MatrixExpression<T>, T>::value>::type> {
+    static const bool isOperand = true;
+    typedef typename T::Scalar Scalar;
+    typedef T Type;
+    static const T& wrap(const T& e) { return e; }
+};
+
+template <class L, class R>
+typename std::enable_if<ExpressionTraits<L>::isOperand && ExpressionTraits<R>::isOperand,
+    ElementwiseExpression<typename ExpressionTraits<L>::Type,
+                          typename ExpressionTraits<R>::Type, ExpressionPlus>>::type
+operator+(const L& l, const R& r) {
+    return ElementwiseExpression<typename ExpressionTraits<L>::Type,
+                                 typename ExpressionTraits<R>::Type, ExpressionPlus>(
+        ExpressionTraits<L>::wrap(l), ExpressionTraits<R>::wrap(r));
+}
+
+template <class L, class R>
+typename std::enable_if<ExpressionTraits<L>::isOperand && ExpressionTraits<R>::isOperand,
+    ElementwiseExpression<typename ExpressionTraits<L>::Type,
+                          typename ExpressionTraits<R>::Type, ExpressionMinus>>::type
+operator-(const L& l, const R& r) {
+    return ElementwiseExpression<typename ExpressionTraits<L>::Type,
+                                 typename ExpressionTraits<R>::Type, ExpressionMinus>(
+        ExpressionTraits<L>::wrap(l), ExpressionTraits<R>::wrap(r));
+}
+
+template <class E>
+typename std::enable_if<ExpressionTraits<E>::isOperand,
+    NegatedExpression<typename ExpressionTraits<E>::Type>>::type
+operator-(const E& e) {
+    return NegatedExpression<typename ExpressionTraits<E>::Type>(ExpressionTraits<E>::wrap(e));
+}
+
+template <class E>
+typename std::enable_if<ExpressionTraits<E>::isOperand,
+    ScaledExpression<typename ExpressionTraits<E>::Type>>::type
+operator*(const E& e, const typename ExpressionTraits<E>::Scalar& c) {
+    return ScaledExpression<typename ExpressionTraits<E>::Type>(ExpressionTraits<E>::wrap(e), c);
+}
+
+template <class E>
+typename std::enable_if<ExpressionTraits<E>::isOperand,
+    ScaledExpression<typename ExpressionTraits<E>::Type>>::type
+operator*(const typename ExpressionTraits<E>::Scalar& c, const E& e) {
+    return ScaledExpression<typename ExpressionTraits<E>::Type>(ExpressionTraits<E>::wrap(e), c);
+}
+
+// Products are not elementwise; expression operands are evaluated first.
+template <class E>
+Matrix<typename E::Scalar> operator*(const MatrixExpression<E>& e,
+                                     const AbstractMatrix<typename E::Scalar>& m) {
+    return e.eval() * m;
+}
+
+template <class E>
+Matrix<typename E::Scalar> operator*(const AbstractMatrix<typename E::Scalar>& m,
+                                     const MatrixExpression<E>& e) {
+    typedef typename E::Scalar Scalar;
+    Matrix<Scalar> right = e.eval();
+    if (m.getColumns() != right.getRows())
+        throw std::runtime_error("Wrong size");
+    MatrixBuffer<Scalar> elements(m.getRows() * right.getColumns(), 0);
+    if (!elements.empty() && m.getColumns() != 0)
+        gemm(m.getRows(), right.getColumns(), m.getColumns(), m.data(), m.getColumns(),
+             right.data(), right.getColumns(), elements.data(), right.getColumns());
+    return Matrix<Scalar>(m.getRows(), right.getColumns(), std::move(elements));
+}
+
+template <class L, class R>
+Matrix<typename L::Scalar> operator*(const MatrixExpression<L>& l, const MatrixExpression<R>& r) {
+    return l.eval() * r.eval();
+}
+
+template <class E>
+std::ostream& operator<<(std::ostream& out, const MatrixExpression<E>& e) {
+    return printMatrix<typename E::Scalar>(out, e.self().getRows(), e.self().getColumns(),
+                                           [&](unsigned i, unsigned j) { return e.self().at(i, j); });
+}
+
+#endif
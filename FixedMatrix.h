@@ -0,0 +1,447 @@
+#ifndef FIXED_MATRIX_H
+#define FIXED_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "SquareMatrix.h"
+#include <initializer_list>
+
+template <class Scalar, unsigned N>
+struct FixedMatrixKernels;
+
+// Stack-allocated R x C matrix with the dimensions in the type, so size
+// mismatches in +, - and * are compile errors instead of "Wrong size"
+// exceptions. Everything except the conversions to and from the heap-based
+// classes is constexpr; det() and invert() are unrolled for 2x2, 3x3 and
+// 4x4.
+template <class Scalar_, unsigned R, unsigned C>
+class FixedMatrix {
+    static_assert(R > 0 && C > 0, "FixedMatrix dimensions must be positive");
+
+public:
+    typedef Scalar_ Scalar;
+    typedef Scalar* iterator;
+    typedef const Scalar* const_iterator;
+
+    static constexpr unsigned rows = R;
+    static constexpr unsigned columns = C;
+
+    constexpr FixedMatrix() : elements() {}
+
+    constexpr explicit FixedMatrix(Scalar value) : elements() {
+        for (unsigned i = 0; i < R * C; i++)
+            elements[i] = value;
+    }
+
+    constexpr FixedMatrix(std::initializer_list<Scalar> values) : elements() {
+        if (values.size() != R * C)
+            throw std::runtime_error("Wrong number of elements");
+        unsigned i = 0;
+        for (Scalar v : values)
+            elements[i++] = v;
+    }
+
+    explicit FixedMatrix(const AbstractMatrix<Scalar>& m) : elements() {
+        if (m.getRows() != R || m.getColumns() != C)
+            throw std::runtime_error("Wrong size");
+        const Scalar* data = m.data();
+        for (unsigned i = 0; i < R * C; i++)
+            elements[i] = data[i];
+    }
+
+    operator Matrix<Scalar>() const {
+        return Matrix<Scalar>(R, C, MatrixBuffer<Scalar>(begin(), end()));
+    }
+
+    operator SquareMatrix<Scalar>() const {
+        static_assert(R == C, "Not a square matrix");
+        return SquareMatrix<Scalar>(R, MatrixBuffer<Scalar>(begin(), end()));
+    }
+
+    static constexpr FixedMatrix identity() {
+        static_assert(R == C, "Not a square matrix");
+        FixedMatrix m;
+        for (unsigned i = 0; i < R; i++)
+            m.elements[i * C + i] = 1;
+        return m;
+    }
+
+    constexpr bool isSquare() const { return R == C; }
+    constexpr bool isVector() const { return R == 1 || C == 1; }
+
+    constexpr bool isDiagonal() const {
+        if (R != C)
+            return false;
+        for (unsigned i = 0; i < R; i++)
+            for (unsigned j = 0; j < C; j++)
+                if (i != j && elements[i * C + j] != 0)
+                    return false;
+        return true;
+    }
+
+    constexpr bool isZero() const {
+        for (unsigned i = 0; i < R * C; i++)
+            if (elements[i] != 0)
+                return false;
+        return true;
+    }
+
+    constexpr bool isIdentity() const {
+        if (!isDiagonal())
+            return false;
+        for (unsigned i = 0; i < R; i++)
+            if (elements[i * C + i] != 1)
+                return false;
+        return true;
+    }
+
+    constexpr unsigned getRows() const { return R; }
+    constexpr unsigned getColumns() const { return C; }
+
+    constexpr iterator begin() { return elements; }
+    constexpr iterator end() { return elements + R * C; }
+    constexpr const_iterator begin() const { return elements; }
+    constexpr const_iterator end() const { return elements + R * C; }
+    constexpr Scalar* data() { return elements; }
+    constexpr const Scalar* data() const { return elements; }
+
+    constexpr Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= R || c >= C)
+            throw std::out_of_range("FixedMatrix::operator()");
+        return elements[r * C + c];
+    }
+
+    constexpr Scalar& operator()(unsigned r, unsigned c) {
+        if (r >= R || c >= C)
+            throw std::out_of_range("FixedMatrix::operator()");
+        return elements[r * C + c];
+    }
+
+    constexpr Scalar unchecked(unsigned r, unsigned c) const { return elements[r * C + c]; }
+    constexpr Scalar& unchecked(unsigned r, unsigned c) { return elements[r * C + c]; }
+
+    constexpr bool operator==(const FixedMatrix& m) const {
+        for (unsigned i = 0; i < R * C; i++)
+            if (elements[i] != m.elements[i])
+                return false;
+        return true;
+    }
+
+    constexpr bool operator!=(const FixedMatrix& m) const { return !(*this == m); }
+
+    constexpr Scalar max() const {
+        Scalar result = elements[0];
+        for (unsigned i = 1; i < R * C; i++)
+            if (result < elements[i])
+                result = elements[i];
+        return result;
+    }
+
+    constexpr Scalar min() const {
+        Scalar result = elements[0];
+        for (unsigned i = 1; i < R * C; i++)
+            if (elements[i] < result)
+                result = elements[i];
+        return result;
+    }
+
+    constexpr FixedMatrix operator-() const {
+        FixedMatrix result;
+        for (unsigned i = 0; i < R * C; i++)
+            result.elements[i] = -elements[i];
+        return result;
+    }
+
+    constexpr FixedMatrix& operator+=(const FixedMatrix& m) {
+        for (unsigned i = 0; i < R * C; i++)
+            elements[i] += m.elements[i];
+        return *this;
+    }
+
+    constexpr FixedMatrix operator+(const FixedMatrix& m) const {
+        FixedMatrix copy(*this);
+        copy += m;
+        return copy;
+    }
+
+    constexpr FixedMatrix& operator-=(const FixedMatrix& m) {
+        for (unsigned i = 0; i < R * C; i++)
+            elements[i] -= m.elements[i];
+        return *this;
+    }
+
+    constexpr FixedMatrix operator-(const FixedMatrix& m) const {
+        FixedMatrix copy(*this);
+        copy -= m;
+        return copy;
+    }
+
+    constexpr FixedMatrix& operator*=(const Scalar& c) {
+        for (unsigned i = 0; i < R * C; i++)
+            elements[i] *= c;
+        return *this;
+    }
+
+    constexpr FixedMatrix operator*(const Scalar& c) const {
+        FixedMatrix copy(*this);
+        copy *= c;
+        return copy;
+    }
+
+    template <unsigned K>
+    constexpr FixedMatrix<Scalar, R, K> operator*(const FixedMatrix<Scalar, C, K>& m) const {
+        FixedMatrix<Scalar, R, K> result;
+        for (unsigned i = 0; i < R; i++)
+            for (unsigned j = 0; j < C; j++){
+                Scalar a = elements[i * C + j];
+                for (unsigned k = 0; k < K; k++)
+                    result.unchecked(i, k) += a * m.unchecked(j, k);
+            }
+        return result;
+    }
+
+    constexpr FixedMatrix& operator*=(const FixedMatrix<Scalar, C, C>& m) {
+        *this = *this * m;
+        return *this;
+    }
+
+    constexpr Scalar trace() const {
+        static_assert(R == C, "Not a square matrix");
+        Scalar trace = 0;
+        for (unsigned i = 0; i < R; i++)
+            trace += elements[i * C + i];
+        return trace;
+    }
+
+    template<typename T = double>
+    constexpr T det() const {
+        static_assert(R == C, "Not a square matrix");
+        FixedMatrix<T, R, C> m;
+        for (unsigned i = 0; i < R * C; i++)
+            m.data()[i] = elements[i];
+        return FixedMatrixKernels<T, R>::det(m.data());
+    }
+
+    template<typename T = double>
+    constexpr FixedMatrix<T, R, C> invert() const {
+        static_assert(R == C, "Not a square matrix");
+        FixedMatrix<T, R, C> m, r;
+        for (unsigned i = 0; i < R * C; i++)
+            m.data()[i] = elements[i];
+        FixedMatrixKernels<T, R>::invert(m.data(), r.data());
+        return r;
+    }
+
+    constexpr FixedMatrix<Scalar, C, R> transpone() const {
+        FixedMatrix<Scalar, C, R> result;
+        for (unsigned i = 0; i < R; i++)
+            for (unsigned j = 0; j < C; j++)
+                result.unchecked(j, i) = elements[i * C + j];
+        return result;
+    }
+
+    constexpr void makeIdentity() {
+        *this = identity();
+    }
+
+private:
+    Scalar elements[R * C];
+};
+
+template <class Scalar, unsigned R, unsigned C>
+constexpr FixedMatrix<Scalar, R, C> operator*(const Scalar& c, const FixedMatrix<Scalar, R, C>& m) {
+    return m * c;
+}
+
+template <class Scalar, unsigned R, unsigned C>
+std::ostream& operator<<(std::ostream& out, const FixedMatrix<Scalar, R, C>& m){
+    return printMatrix<Scalar>(out, R, C, [&](unsigned i, unsigned j) { return m.unchecked(i, j); });
+}
+
+// Generic N x N kernels: Gaussian elimination with partial pivoting.
+template <class Scalar, unsigned N>
+struct FixedMatrixKernels {
+    static constexpr Scalar abs(Scalar x) { return x < 0 ? -x : x; }
+
+    static constexpr Scalar det(Scalar* a) {
+        Scalar det = 1;
+        for (unsigned k = 0; k < N; k++){
+            unsigned pivot = k;
+            for (unsigned i = k + 1; i < N; i++)
+                if (abs(a[i * N + k]) > abs(a[pivot * N + k]))
+                    pivot = i;
+            if (a[pivot * N + k] == 0)
+                return 0;
+            if (pivot != k){
+                for (unsigned j = 0; j < N; j++){
+                    Scalar t = a[k * N + j];
+                    a[k * N + j] = a[pivot * N + j];
+                    a[pivot * N + j] = t;
+                }
+                det = -det;
+            }
+            det *= a[k * N + k];
+            for (unsigned i = k + 1; i < N; i++){
+                Scalar factor = a[i * N + k] / a[k * N + k];
+                for (unsigned j = k; j < N; j++)
+                    a[i * N + j] -= factor * a[k * N + j];
+            }
+        }
+        return det;
+    }
+
+    static constexpr void invert(Scalar* a, Scalar* r) {
+        for (unsigned i = 0; i < N * N; i++)
+            r[i] = 0;
+        for (unsigned i = 0; i < N; i++)
+            r[i * N + i] = 1;
+        for (unsigned k = 0; k < N; k++){
+            unsigned pivot = k;
+            for (unsigned i = k + 1; i < N; i++)
+                if (abs(a[i * N + k]) > abs(a[pivot * N + k]))
+                    pivot = i;
+            if (a[pivot * N + k] == 0)
+                throw std::runtime_error("Singular matrix");
+            if (pivot != k)
+                for (unsigned j = 0; j < N; j++){
+                    Scalar t = a[k * N + j];
+                    a[k * N + j] = a[pivot * N + j];
+                    a[pivot * N + j] = t;
+                    t = r[k * N + j];
+                    r[k * N + j] = r[pivot * N + j];
+                    r[pivot * N + j] = t;
+                }
+            Scalar diagonal = a[k * N + k];
+            for (unsigned j = 0; j < N; j++){
+                a[k * N + j] /= diagonal;
+                r[k * N + j] /= diagonal;
+            }
+            for (unsigned i = 0; i < N; i++){
+                if (i == k)
+                    continue;
+                Scalar factor = a[i * N + k];
+                for (unsigned j = 0; j < N; j++){
+                    a[i * N + j] -= factor * a[k * N + j];
+                    r[i * N + j] -= factor * r[k * N + j];
+                }
+            }
+        }
+    }
+};
+
+template <class Scalar>
+struct FixedMatrixKernels<Scalar, 1> {
+    static constexpr Scalar det(const Scalar* a) { return a[0]; }
+
+    static constexpr void invert(const Scalar* a, Scalar* r) {
+        if (a[0] == 0)
+            throw std::runtime_error("Singular matrix");
+        r[0] = 1 / a[0];
+    }
+};
+
+template <class Scalar>
+struct FixedMatrixKernels<Scalar, 2> {
+    static constexpr Scalar det(const Scalar* a) {
+        return a[0] * a[3] - a[1] * a[2];
+    }
+
+    static constexpr void invert(const Scalar* a, Scalar* r) {
+        Scalar d = det(a);
+        if (d == 0)
+            throw std::runtime_error("Singular matrix");
+        r[0] = a[3] / d;
+        r[1] = -a[1] / d;
+        r[2] = -a[2] / d;
+        r[3] = a[0] / d;
+    }
+};
+
+template <class Scalar>
+struct FixedMatrixKernels<Scalar, 3> {
+    static constexpr Scalar det(const Scalar* a) {
+        return a[0] * (a[4] * a[8] - a[5] * a[7])
+             - a[1] * (a[3] * a[8] - a[5] * a[6])
+             + a[2] * (a[3] * a[7] - a[4] * a[6]);
+    }
+
+    static constexpr void invert(const Scalar* a, Scalar* r) {
+        Scalar c00 = a[4] * a[8] - a[5] * a[7];
+        Scalar c01 = a[5] * a[6] - a[3] * a[8];
+        Scalar c02 = a[3] * a[7] - a[4] * a[6];
+        Scalar d = a[0] * c00 + a[1] * c01 + a[2] * c02;
+        if (d == 0)
+            throw std::runtime_error("Singular matrix");
+        Scalar inv = 1 / d;
+        r[0] = c00 * inv;
+        r[1] = (a[2] * a[7] - a[1] * a[8]) * inv;
+        r[2] = (a[1] * a[5] - a[2] * a[4]) * inv;
+        r[3] = c01 * inv;
+        r[4] = (a[0] * a[8] - a[2] * a[6]) * inv;
+        r[5] = (a[2] * a[3] - a[0] * a[5]) * inv;
+        r[6] = c02 * inv;
+        r[7] = (a[1] * a[6] - a[0] * a[7]) * inv;
+        r[8] = (a[0] * a[4] - a[1] * a[3]) * inv;
+    }
+};
+
+template <class Scalar>
+struct FixedMatrixKernels<Scalar, 4> {
+    // 2x2 minors of the top two rows (s) and the bottom two rows (c).
+    struct Minors {
+        Scalar s0, s1, s2, s3, s4, s5;
+        Scalar c0, c1, c2, c3, c4, c5;
+    };
+
+    static constexpr Minors minors(const Scalar* a) {
+        return Minors{
+            a[0] * a[5] - a[4] * a[1],
+            a[0] * a[6] - a[4] * a[2],
+            a[0] * a[7] - a[4] * a[3],
+            a[1] * a[6] - a[5] * a[2],
+            a[1] * a[7] - a[5] * a[3],
+            a[2] * a[7] - a[6] * a[3],
+            a[8] * a[13] - a[12] * a[9],
+            a[8] * a[14] - a[12] * a[10],
+            a[8] * a[15] - a[12] * a[11],
+            a[9] * a[14] - a[13] * a[10],
+            a[9] * a[15] - a[13] * a[11],
+            a[10] * a[15] - a[14] * a[11]
+        };
+    }
+
+    static constexpr Scalar det(const Minors& m) {
+        return m.s0 * m.c5 - m.s1 * m.c4 + m.s2 * m.c3
+             + m.s3 * m.c2 - m.s4 * m.c1 + m.s5 * m.c0;
+    }
+
+    static constexpr Scalar det(const Scalar* a) {
+        return det(minors(a));
+    }
+
+    static constexpr void invert(const Scalar* a, Scalar* r) {
+        Minors m = minors(a);
+        Scalar d = det(m);
+        if (d == 0)
+            throw std::runtime_error("Singular matrix");
+        Scalar inv = 1 / d;
+        r[0]  = ( a[5] * m.c5 - a[6] * m.c4 + a[7] * m.c3) * inv;
+        r[1]  = (-a[1] * m.c5 + a[2] * m.c4 - a[3] * m.c3) * inv;
+        r[2]  = ( a[13] * m.s5 - a[14] * m.s4 + a[15] * m.s3) * inv;
+        r[3]  = (-a[9] * m.s5 + a[10] * m.s4 - a[11] * m.s3) * inv;
+        r[4]  = (-a[4] * m.c5 + a[6] * m.c2 - a[7] * m.c1) * inv;
+        r[5]  = ( a[0] * m.c5 - a[2] * m.c2 + a[3] * m.c1) * inv;
+        r[6]  = (-a[12] * m.s5 + a[14] * m.s2 - a[15] * m.s1) * inv;
+        r[7]  = ( a[8] * m.s5 - a[10] * m.s2 + a[11] * m.s1) * inv;
+        r[8]  = ( a[4] * m.c4 - a[5] * m.c2 + a[7] * m.c0) * inv;
+        r[9]  = (-a[0] * m.c4 + a[1] * m.c2 - a[3] * m.c0) * inv;
+        r[10] = ( a[12] * m.s4 - a[13] * m.s2 + a[15] * m.s0) * inv;
+        r[11] = (-a[8] * m.s4 + a[9] * m.s2 - a[11] * m.s0) * inv;
+        r[12] = (-a[4] * m.c3 + a[5] * m.c1 - a[6] * m.c0) * inv;
+        r[13] = ( a[0] * m.c3 - a[1] * m.c1 + a[2] * m.c0) * inv;
+        r[14] = (-a[12] * m.s3 + a[13] * m.s1 - a[14] * m.s0) * inv;
+        r[15] = ( a[8] * m.s3 - a[9] * m.s1 + a[10] * m.s0) * inv;
+    }
+};
+
+#endif
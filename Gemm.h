@@ -0,0 +1,167 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "MatrixAllocator.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+// Blocking parameters of the multiply engine. MR x NR is the register tile
+// computed by the micro-kernel, KC x NR panels of B stay in L1, MC x KC
+// blocks of A in L2 and KC x NC panels of B in L3.
+template <class Scalar>
+struct GemmBlocking {
+    static constexpr unsigned MR = 4;
+    static constexpr unsigned NR = sizeof(Scalar) <= 4 ? 16 : 8;
+    static constexpr unsigned KC = 256;
+    static constexpr unsigned MC = 128;
+    static constexpr unsigned NC = 2048;
+};
+
+template <class Scalar>
+void gemmPackA(const Scalar* a, unsigned lda, unsigned mc, unsigned kc, Scalar* buffer) {
+    const unsigned MR = GemmBlocking<Scalar>::MR;
+    for (unsigned i0 = 0; i0 < mc; i0 += MR){
+        unsigned mr = std::min(MR, mc - i0);
+        for (unsigned p = 0; p < kc; p++){
+            for (unsigned i = 0; i < mr; i++)
+                buffer[i] = a[(i0 + i) * lda + p];
+            for (unsigned i = mr; i < MR; i++)
+                buffer[i] = Scalar();
+            buffer += MR;
+        }
+    }
+}
+
+template <class Scalar>
+void gemmPackB(const Scalar* b, unsigned ldb, unsigned kc, unsigned nc, Scalar* buffer) {
+    const unsigned NR = GemmBlocking<Scalar>::NR;
+    for (unsigned j0 = 0; j0 < nc; j0 += NR){
+        unsigned nr = std::min(NR, nc - j0);
+        for (unsigned p = 0; p < kc; p++){
+            const Scalar* row = b + p * ldb + j0;
+            for (unsigned j = 0; j < nr; j++)
+                buffer[j] = row[j];
+            for (unsigned j = nr; j < NR; j++)
+                buffer[j] = Scalar();
+            buffer += NR;
+        }
+    }
+}
+
+// C[mr x nr] += packed A panel * packed B panel. The accumulator tile is
+// sized so the compiler keeps it in vector registers.
+template <class Scalar>
+void gemmMicroKernel(unsigned kc, const Scalar* a, const Scalar* b,
+                     Scalar* c, unsigned ldc, unsigned mr, unsigned nr) {
+    const unsigned MR = GemmBlocking<Scalar>::MR;
+    const unsigned NR = GemmBlocking<Scalar>::NR;
+    Scalar acc[MR][NR];
+    for (unsigned i = 0; i < MR; i++)
+        for (unsigned j = 0; j < NR; j++)
+            acc[i][j] = Scalar();
+    for (unsigned p = 0; p < kc; p++){
+        for (unsigned i = 0; i < MR; i++){
+            Scalar ai = a[i];
+            for (unsigned j = 0; j < NR; j++)
+                acc[i][j] += ai * b[j];
+        }
+        a += MR;
+        b += NR;
+    }
+    for (unsigned i = 0; i < mr; i++)
+        for (unsigned j = 0; j < nr; j++)
+            c[i * ldc + j] += acc[i][j];
+}
+
+template <class Scalar>
+void gemmSmall(unsigned m, unsigned n, unsigned k, const Scalar* a, unsigned lda,
+               const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc) {
+    for (unsigned i = 0; i < m; i++){
+        Scalar* row = c + i * ldc;
+        for (unsigned p = 0; p < k; p++){
+            Scalar aip = a[i * lda + p];
+            const Scalar* bp = b + p * ldb;
+            for (unsigned j = 0; j < n; j++)
+                row[j] += aip * bp[j];
+        }
+    }
+}
+
+template <class Scalar>
+void gemmSerial(unsigned m, unsigned n, unsigned k, const Scalar* a, unsigned lda,
+          const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc) {
+    typedef GemmBlocking<Scalar> B;
+    if (m == 0 || n == 0 || k == 0)
+        return;
+    if ((unsigned long long)m * n * k <= 32 * 32 * 32){
+        gemmSmall(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    unsigned kcMax = std::min(B::KC, k);
+    unsigned mcMax = std::min(B::MC, m);
+    unsigned ncMax = std::min(B::NC, n);
+    MatrixBuffer<Scalar> packedA(kcMax * ((mcMax + B::MR - 1) / B::MR * B::MR));
+    MatrixBuffer<Scalar> packedB(kcMax * ((ncMax + B::NR - 1) / B::NR * B::NR));
+
+    for (unsigned jc = 0; jc < n; jc += B::NC){
+        unsigned nc = std::min(B::NC, n - jc);
+        for (unsigned pc = 0; pc < k; pc += B::KC){
+            unsigned kc = std::min(B::KC, k - pc);
+            gemmPackB(b + pc * ldb + jc, ldb, kc, nc, packedB.data());
+            for (unsigned ic = 0; ic < m; ic += B::MC){
+                unsigned mc = std::min(B::MC, m - ic);
+                gemmPackA(a + ic * lda + pc, lda, mc, kc, packedA.data());
+                for (unsigned jr = 0; jr < nc; jr += B::NR){
+                    unsigned nr = std::min(B::NR, nc - jr);
+                    const Scalar* bPanel = packedB.data() + jr * kc;
+                    for (unsigned ir = 0; ir < mc; ir += B::MR){
+                        unsigned mr = std::min(B::MR, mc - ir);
+                        gemmMicroKernel(kc, packedA.data() + ir * kc, bPanel,
+                                        c + (ic + ir) * ldc + jc + jr, ldc, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// C += A * B for row-major A (m x k), B (k x n) and C (m x n) with leading
+// dimensions lda, ldb and ldc. Large products are split into 2-D tiles of C
+// that run on the global thread pool.
+template <class Scalar>
+void gemm(unsigned m, unsigned n, unsigned k, const Scalar* a, unsigned lda,
+          const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc) {
+    typedef GemmBlocking<Scalar> B;
+    ThreadPool& pool = ThreadPool::global();
+    if (!pool.useParallel((unsigned long long)m * n * k)){
+        gemmSerial(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    unsigned tileRows = B::MC, tileColumns = 32 * B::NR;
+    unsigned wanted = 4 * pool.getThreadCount();
+    for (;;){
+        unsigned tiles = ((m + tileRows - 1) / tileRows) * ((n + tileColumns - 1) / tileColumns);
+        if (tiles >= wanted)
+            break;
+        if (tileRows > B::MR && tileRows >= tileColumns / 2)
+            tileRows /= 2;
+        else if (tileColumns > B::NR)
+            tileColumns /= 2;
+        else
+            break;
+    }
+    unsigned tilesM = (m + tileRows - 1) / tileRows;
+    unsigned tilesN = (n + tileColumns - 1) / tileColumns;
+    pool.parallelFor(0, tilesM * tilesN, 1, [=](unsigned lo, unsigned hi) {
+        for (unsigned t = lo; t < hi; t++){
+            unsigned i0 = (t / tilesN) * tileRows;
+            unsigned j0 = (t % tilesN) * tileColumns;
+            gemmSerial(std::min(tileRows, m - i0), std::min(tileColumns, n - j0), k,
+                       a + i0 * lda, lda, b + j0, ldb, c + i0 * ldc + j0, ldc);
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Opt-in profiling of the public operations of Matrix, SquareMatrix and
+// Vector. Compile with -DMATRIX_INSTRUMENTATION to record, per operation,
+// the number of calls, a histogram of operand shapes, the floating point
+// operations and the wall time, plus the number and bytes of element
+// buffers allocated (every matrix and temporary owns one). Without the
+// macro the hooks expand to nothing and none of their arguments are
+// evaluated.
+//
+// Counters are thread-local; snapshots merge every thread, including the
+// ones that have exited:
+//
+//     resetMatrixProfile();
+//     setMatrixTracing(true);             // also keep one event per call
+//     run();
+//     writeMatrixProfileJson(std::cout);
+//     std::ofstream trace("trace.json");
+//     writeMatrixTrace(trace);            // chrome://tracing, Perfetto
+//
+// Times are inclusive: invert() also counts the time of the product it
+// may call, under its own name.
+
+#ifdef MATRIX_INSTRUMENTATION
+#define MATRIX_PROFILE(name, rows, columns, flops) \
+    MatrixOperationScope matrixOperationScope(name, rows, columns, flops)
+#define MATRIX_COUNT_ALLOCATION(bytes) matrixThreadProfile().allocation(bytes)
+#else
+#define MATRIX_PROFILE(name, rows, columns, flops) ((void)0)
+#define MATRIX_COUNT_ALLOCATION(bytes) ((void)0)
+#endif
+
+constexpr bool matrixInstrumentationEnabled() {
+#ifdef MATRIX_INSTRUMENTATION
+    return true;
+#else
+    return false;
+#endif
+}
+
+struct MatrixOperationStats {
+    unsigned long long calls = 0, flops = 0, nanoseconds = 0;
+    // Calls by shape of the result or main operand, with both dimensions
+    // rounded up to a power of two.
+    std::map<std::pair<unsigned, unsigned>, unsigned long long> shapes;
+
+    void merge(const MatrixOperationStats& s) {
+        calls += s.calls;
+        flops += s.flops;
+        nanoseconds += s.nanoseconds;
+        for (const auto& shape : s.shapes)
+            shapes[shape.first] += shape.second;
+    }
+};
+
+struct MatrixTraceEvent {
+    const char* name;
+    unsigned long long start, duration;     // ns since the profile was reset
+    unsigned rows, columns;
+    unsigned thread;
+};
+
+struct MatrixProfile {
+    std::map<std::string, MatrixOperationStats> operations;
+    unsigned long long allocations = 0, allocatedBytes = 0;
+    std::vector<MatrixTraceEvent> events;
+
+    void merge(const MatrixProfile& p) {
+        for (const auto& op : p.operations)
+            operations[op.first].merge(op.second);
+        allocations += p.allocations;
+        allocatedBytes += p.allocatedBytes;
+        events.insert(events.end(), p.events.begin(), p.events.end());
+    }
+};
+
+class MatrixThreadProfile;
+
+// Registry of the per-thread profiles. Threads register on their first
+// recorded event and fold their counters into retired when they exit.
+// The registry is never destroyed: pool threads may exit after static
+// destruction, when a function-local static registry would be gone.
+class MatrixProfiler {
+public:
+    static MatrixProfiler& global() {
+        static MatrixProfiler* profiler = new MatrixProfiler;
+        return *profiler;
+    }
+
+    bool isTracing() const { return tracing; }
+    void setTracing(bool enabled) { tracing = enabled; }
+
+    inline MatrixProfile snapshot();
+    inline void reset();
+
+private:
+    friend class MatrixThreadProfile;
+
+    std::mutex lock;
+    std::vector<MatrixThreadProfile*> threads;
+    MatrixProfile retired;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<bool> tracing{false};
+    unsigned nextThread = 0;
+};
+
+class MatrixThreadProfile {
+public:
+    MatrixThreadProfile() : profiler(MatrixProfiler::global()) {
+        std::lock_guard<std::mutex> guard(profiler.lock);
+        profiler.threads.push_back(this);
+        thread = profiler.nextThread++;
+        start = profiler.start;
+    }
+
+    ~MatrixThreadProfile() {
+        std::lock_guard<std::mutex> guard(profiler.lock);
+        profiler.retired.merge(collect());
+        profiler.threads.erase(std::find(profiler.threads.begin(), profiler.threads.end(), this));
+    }
+
+    MatrixThreadProfile(const MatrixThreadProfile&) = delete;
+    MatrixThreadProfile& operator=(const MatrixThreadProfile&) = delete;
+
+    void allocation(unsigned long long bytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        allocations++;
+        allocatedBytes += bytes;
+    }
+
+    void operation(const char* name, unsigned rows, unsigned columns, unsigned long long flops,
+                   std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+        unsigned long long duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        std::lock_guard<std::mutex> guard(lock);
+        MatrixOperationStats& stats = operations[name];
+        stats.calls++;
+        stats.flops += flops;
+        stats.nanoseconds += duration;
+        stats.shapes[std::make_pair(roundUp(rows), roundUp(columns))]++;
+        if (profiler.isTracing() && begin >= start){
+            unsigned long long offset = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - start).count();
+            events.push_back({name, offset, duration, rows, columns, thread});
+        }
+    }
+
+private:
+    friend class MatrixProfiler;
+
+    static unsigned roundUp(unsigned n) {
+        unsigned power = 1;
+        while (power < n && power < (1u << 31))
+            power <<= 1;
+        return n ? power : 0;
+    }
+
+    // Called with profiler.lock held.
+    MatrixProfile collect() {
+        std::lock_guard<std::mutex> guard(lock);
+        MatrixProfile p;
+        for (const auto& op : operations)
+            p.operations[op.first].merge(op.second);
+        p.allocations = allocations;
+        p.allocatedBytes = allocatedBytes;
+        p.events = events;
+        return p;
+    }
+
+    // Called with profiler.lock held.
+    void clear(std::chrono::steady_clock::time_point newStart) {
+        std::lock_guard<std::mutex> guard(lock);
+        operations.clear();
+        events.clear();
+        allocations = allocatedBytes = 0;
+        start = newStart;
+    }
+
+    MatrixProfiler& profiler;
+    std::mutex lock;
+    std::unordered_map<const char*, MatrixOperationStats> operations;
+    std::vector<MatrixTraceEvent> events;
+    unsigned long long allocations = 0, allocatedBytes = 0;
+    std::chrono::steady_clock::time_point start;
+    unsigned thread = 0;
+};
+
+MatrixProfile MatrixProfiler::snapshot() {
+    std::lock_guard<std::mutex> guard(lock);
+    MatrixProfile p = retired;
+    for (MatrixThreadProfile* t : threads)
+        p.merge(t->collect());
+    return p;
+}
+
+void MatrixProfiler::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    retired = MatrixProfile();
+    start = std::chrono::steady_clock::now();
+    for (MatrixThreadProfile* t : threads)
+        t->clear(start);
+}
+
+inline MatrixThreadProfile& matrixThreadProfile() {
+    static thread_local MatrixThreadProfile profile;
+    return profile;
+}
+
+// Times one call of an operation; created by MATRIX_PROFILE.
+class MatrixOperationScope {
+public:
+    MatrixOperationScope(const char* name, unsigned rows, unsigned columns, unsigned long long flops) :
+        name(name), rows(rows), columns(columns), flops(flops), begin(std::chrono::steady_clock::now()) {}
+
+    ~MatrixOperationScope() {
+        matrixThreadProfile().operation(name, rows, columns, flops, begin, std::chrono::steady_clock::now());
+    }
+
+    MatrixOperationScope(const MatrixOperationScope&) = delete;
+    MatrixOperationScope& operator=(const MatrixOperationScope&) = delete;
+
+private:
+    const char* name;
+    unsigned rows, columns;
+    unsigned long long flops;
+    std::chrono::steady_clock::time_point begin;
+};
+
+inline MatrixProfile matrixProfileSnapshot() {
+    return MatrixProfiler::global().snapshot();
+}
+
+inline void resetMatrixProfile() {
+    MatrixProfiler::global().reset();
+}
+
+// Events for writeMatrixTrace() are only kept while tracing is on.
+inline void setMatrixTracing(bool enabled) {
+    MatrixProfiler::global().setTracing(enabled);
+}
+
+// Writes nanoseconds / 10^digits in fixed notation, digits in {3, 9}.
+// Integer arithmetic keeps every digit of long runs, which the stream's
+// default six significant digits would round away.
+inline void writeNanoseconds(std::ostream& out, unsigned long long nanoseconds, int digits) {
+    unsigned long long scale = digits == 9 ? 1000000000ull : 1000ull;
+    char text[48];
+    std::snprintf(text, sizeof text, "%llu.%0*llu", nanoseconds / scale, digits, nanoseconds % scale);
+    out << text;
+}
+
+inline void writeMatrixProfileJson(std::ostream& out, const MatrixProfile& p) {
+    out << "{\n  \"allocations\": " << p.allocations << ",\n  \"allocatedBytes\": " << p.allocatedBytes
+        << ",\n  \"operations\": {";
+    const char* separator = "\n";
+    for (const auto& op : p.operations){
+        const MatrixOperationStats& s = op.second;
+        out << separator << "    \"" << op.first << "\": {\"calls\": " << s.calls << ", \"flops\": " << s.flops
+            << ", \"seconds\": ";
+        writeNanoseconds(out, s.nanoseconds, 9);
+        out << ", \"shapes\": {";
+        const char* shapeSeparator = "";
+        for (const auto& shape : s.shapes){
+            out << shapeSeparator << "\"" << shape.first.first << "x" << shape.first.second << "\": " << shape.second;
+            shapeSeparator = ", ";
+        }
+        out << "}}";
+        separator = ",\n";
+    }
+    out << "\n  }\n}\n";
+}
+
+inline void writeMatrixProfileJson(std::ostream& out) {
+    writeMatrixProfileJson(out, matrixProfileSnapshot());
+}
+
+// Chrome trace event format: one complete ("X") event per recorded call,
+// timestamps in microseconds with nanosecond digits.
+inline void writeMatrixTrace(std::ostream& out, const MatrixProfile& p) {
+    out << "{\"traceEvents\": [";
+    const char* separator = "\n";
+    for (const MatrixTraceEvent& e : p.events){
+        out << separator << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e.thread
+            << ", \"ts\": ";
+        writeNanoseconds(out, e.start, 3);
+        out << ", \"dur\": ";
+        writeNanoseconds(out, e.duration, 3);
+        out << ", \"args\": {\"rows\": " << e.rows << ", \"columns\": " << e.columns << "}}";
+        separator = ",\n";
+    }
+    out << "\n], \"displayTimeUnit\": \"ns\"}\n";
+}
+
+inline void writeMatrixTrace(std::ostream& out) {
+    writeMatrixTrace(out, matrixProfileSnapshot());
+}
+
+#endif
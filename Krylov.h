@@ -0,0 +1,496 @@
+#ifndef KRYLOV_H
+#define KRYLOV_H
+
+#include "AbstractMatrix.h"
+#include "MatrixAllocator.h"
+#include "Simd.h"
+#include "SparseMatrix.h"
+#include "ThreadPool.h"
+#include "Vector.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Iterative solvers for A x = b that only need products y = A x, so A can
+// be a dense matrix, a SparseMatrix or anything else that can be applied
+// to a vector (see applyOperator). Every iteration costs one or two
+// products plus O(n) vector work on the thread pool, and memory is a few
+// vectors (restart + 1 of them for GMRES) instead of a factorization.
+//
+//     Vector<double> x;
+//     JacobiPreconditioner<double> jacobi(a);
+//     SolverResult<double> r = conjugateGradient(a, b, x, SolverOptions<double>(), jacobi);
+
+// Vector kernels over fixed chunks of krylovChunk elements. Reductions
+// add the chunk sums in order, so results do not depend on the number of
+// threads.
+constexpr unsigned krylovChunk = 4096;
+
+template <class F>
+void forChunks(std::size_t n, F f) {
+    unsigned chunks = (unsigned)((n + krylovChunk - 1) / krylovChunk);
+    ThreadPool& pool = ThreadPool::global();
+    unsigned grain = pool.useParallel(n) ? 1 + 16384 / krylovChunk : chunks;
+    pool.parallelFor(0, chunks, grain, [&](unsigned lo, unsigned hi) {
+        f((std::size_t)lo * krylovChunk, std::min(n, (std::size_t)hi * krylovChunk));
+    });
+}
+
+template <class Scalar>
+Scalar parallelDot(const Scalar* x, const Scalar* y, std::size_t n) {
+    std::vector<Scalar> partial((n + krylovChunk - 1) / krylovChunk, Scalar());
+    forChunks(n, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t c = lo; c < hi; c += krylovChunk){
+            Scalar sum = 0;
+            for (std::size_t i = c; i < std::min(hi, c + krylovChunk); i++)
+                sum += x[i] * y[i];
+            partial[c / krylovChunk] = sum;
+        }
+    });
+    Scalar sum = 0;
+    for (Scalar s : partial)
+        sum += s;
+    return sum;
+}
+
+template <class Scalar>
+Scalar parallelNorm(const Scalar* x, std::size_t n) {
+    return std::sqrt(parallelDot(x, x, n));
+}
+
+// y += alpha * x
+template <class Scalar>
+void parallelAxpy(Scalar alpha, const Scalar* x, Scalar* y, std::size_t n) {
+    forChunks(n, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t i = lo; i < hi; i++)
+            y[i] += alpha * x[i];
+    });
+}
+
+// y = x + beta * y
+template <class Scalar>
+void parallelXpby(const Scalar* x, Scalar beta, Scalar* y, std::size_t n) {
+    forChunks(n, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t i = lo; i < hi; i++)
+            y[i] = x[i] + beta * y[i];
+    });
+}
+
+// Operators: y = A x for a square A of any of the supported kinds. Other
+// types become operators by overloading applyOperator and operatorSize.
+
+template <class Scalar>
+void applyOperator(const AbstractMatrix<Scalar>& a, const Scalar* x, Scalar* y) {
+    MatrixRef<const Scalar> m = a.ref();
+    unsigned rows = m.getRows(), columns = m.getColumns();
+    ThreadPool& pool = ThreadPool::global();
+    unsigned long long work = (unsigned long long)rows * columns;
+    unsigned grain = pool.useParallel(work) ? 1 + 16384ull * rows / (work + 1) : rows;
+    pool.parallelFor(0, rows, grain, [&](unsigned lo, unsigned hi) {
+        for (unsigned i = lo; i < hi; i++){
+            const Scalar* row = m.row(i);
+            Scalar sum = 0;
+            for (unsigned j = 0; j < columns; j++)
+                sum += row[j] * x[j];
+            y[i] = sum;
+        }
+    });
+}
+
+template <class Scalar>
+unsigned operatorSize(const AbstractMatrix<Scalar>& a) {
+    if (!a.isSquare())
+        throw std::runtime_error("Not a square matrix");
+    return a.getRows();
+}
+
+template <class Scalar>
+void applyOperator(const SparseMatrix<Scalar>& a, const Scalar* x, Scalar* y) {
+    const std::vector<unsigned>& pointers = a.getRowPointers();
+    const std::vector<unsigned>& indices = a.getColumnIndices();
+    const std::vector<Scalar>& values = a.getValues();
+    unsigned rows = a.getRows();
+    ThreadPool& pool = ThreadPool::global();
+    unsigned grain = pool.useParallel(values.size()) ? 1 + 16384ull * rows / (values.size() + 1) : rows;
+    pool.parallelFor(0, rows, grain, [&](unsigned lo, unsigned hi) {
+        for (unsigned i = lo; i < hi; i++){
+            Scalar sum = 0;
+            for (unsigned k = pointers[i]; k < pointers[i + 1]; k++)
+                sum += values[k] * x[indices[k]];
+            y[i] = sum;
+        }
+    });
+}
+
+template <class Scalar>
+unsigned operatorSize(const SparseMatrix<Scalar>& a) {
+    if (!a.isSquare())
+        throw std::runtime_error("Not a square matrix");
+    return a.getRows();
+}
+
+// Matrix-free operator: apply(x, y) writes A x to y.
+template <class Scalar>
+class LinearOperator {
+public:
+    typedef std::function<void(const Scalar*, Scalar*)> Apply;
+
+    LinearOperator(unsigned size, Apply apply) : size(size), apply(std::move(apply)) {}
+
+    // Any A with a product A * Vector<Scalar>; the product is copied out
+    // of whatever A returns.
+    template <class A>
+    static LinearOperator product(const A& a, unsigned size) {
+        return LinearOperator(size, [&a, size](const Scalar* x, Scalar* y) {
+            Vector<Scalar> v(size, true, MatrixBuffer<Scalar>(x, x + size));
+            auto result = a * v;
+            std::copy(result.begin(), result.end(), y);
+        });
+    }
+
+    unsigned getSize() const { return size; }
+    void operator()(const Scalar* x, Scalar* y) const { apply(x, y); }
+
+private:
+    unsigned size;
+    Apply apply;
+};
+
+template <class Scalar>
+void applyOperator(const LinearOperator<Scalar>& a, const Scalar* x, Scalar* y) { a(x, y); }
+
+template <class Scalar>
+unsigned operatorSize(const LinearOperator<Scalar>& a) { return a.getSize(); }
+
+// Preconditioners: apply(r, z) sets z = M^-1 r for an M close to A.
+
+template <class Scalar>
+class IdentityPreconditioner {
+public:
+    void apply(const Scalar* r, Scalar* z, std::size_t n) const { std::copy(r, r + n, z); }
+};
+
+// M = diag(A).
+template <class Scalar>
+class JacobiPreconditioner {
+public:
+    explicit JacobiPreconditioner(const AbstractMatrix<Scalar>& a) {
+        MatrixRef<const Scalar> m = a.ref();
+        for (unsigned i = 0; i < operatorSize(a); i++)
+            add(m(i, i));
+    }
+
+    explicit JacobiPreconditioner(const SparseMatrix<Scalar>& a) {
+        for (unsigned i = 0; i < operatorSize(a); i++)
+            add(a(i, i));
+    }
+
+    void apply(const Scalar* r, Scalar* z, std::size_t n) const {
+        if (n != inverse.size())
+            throw std::runtime_error("Wrong size");
+        const Scalar* d = inverse.data();
+        forChunks(n, [&](std::size_t lo, std::size_t hi) {
+            for (std::size_t i = lo; i < hi; i++)
+                z[i] = d[i] * r[i];
+        });
+    }
+
+private:
+    void add(Scalar diagonal) {
+        if (diagonal == Scalar(0))
+            throw std::runtime_error("Singular matrix");
+        inverse.push_back(1 / diagonal);
+    }
+
+    MatrixBuffer<Scalar> inverse;
+};
+
+// Incomplete LU without fill-in: L and U keep exactly the sparsity pattern
+// of A, stored together in A's CSR arrays (L below the diagonal, unit
+// diagonal implied). Every row needs a diagonal entry.
+template <class Scalar>
+class Ilu0Preconditioner {
+public:
+    explicit Ilu0Preconditioner(const SparseMatrix<Scalar>& a) :
+        pointers(a.getRowPointers()), indices(a.getColumnIndices()), values(a.getValues()),
+        diagonal(operatorSize(a)) {
+        unsigned n = a.getRows();
+        std::vector<unsigned> position(n, UINT_MAX);
+        for (unsigned i = 0; i < n; i++){
+            for (unsigned k = pointers[i]; k < pointers[i + 1]; k++)
+                position[indices[k]] = k;
+            if (position[i] == UINT_MAX)
+                throw std::runtime_error("Singular matrix");
+            diagonal[i] = position[i];
+            // Row i -= l(i, c) * row c of U for every c < i in the pattern.
+            for (unsigned k = pointers[i]; k < pointers[i + 1] && indices[k] < i; k++){
+                unsigned c = indices[k];
+                values[k] /= values[diagonal[c]];
+                for (unsigned q = diagonal[c] + 1; q < pointers[c + 1]; q++)
+                    if (position[indices[q]] != UINT_MAX)
+                        values[position[indices[q]]] -= values[k] * values[q];
+            }
+            if (values[diagonal[i]] == Scalar(0))
+                throw std::runtime_error("Singular matrix");
+            for (unsigned k = pointers[i]; k < pointers[i + 1]; k++)
+                position[indices[k]] = UINT_MAX;
+        }
+    }
+
+    // Forward substitution with L, then backward with U. The triangular
+    // solves are sequential.
+    void apply(const Scalar* r, Scalar* z, std::size_t n) const {
+        if (n != diagonal.size())
+            throw std::runtime_error("Wrong size");
+        for (unsigned i = 0; i < n; i++){
+            Scalar sum = r[i];
+            for (unsigned k = pointers[i]; k < diagonal[i]; k++)
+                sum -= values[k] * z[indices[k]];
+            z[i] = sum;
+        }
+        for (unsigned i = n; i-- > 0; ){
+            Scalar sum = z[i];
+            for (unsigned k = diagonal[i] + 1; k < pointers[i + 1]; k++)
+                sum -= values[k] * z[indices[k]];
+            z[i] = sum / values[diagonal[i]];
+        }
+    }
+
+private:
+    std::vector<unsigned> pointers, indices;
+    std::vector<Scalar> values;
+    std::vector<unsigned> diagonal;
+};
+
+template <class Scalar>
+struct SolverOptions {
+    unsigned maxIterations = 1000;
+    Scalar tolerance = 1e-8;        // on ||b - A x|| / ||b||
+    unsigned restart = 30;          // GMRES only
+    // Called after every iteration with its number and the relative
+    // residual; returning false stops the solver.
+    std::function<bool(unsigned, Scalar)> callback;
+};
+
+template <class Scalar>
+struct SolverResult {
+    bool converged;
+    unsigned iterations;
+    Scalar residual;                // relative, as in SolverOptions::tolerance
+};
+
+// Shared set-up: checks sizes, zero-fills an empty x and computes ||b||.
+template <class A, class Scalar>
+unsigned prepareSolve(const A& a, const Vector<Scalar>& b, Vector<Scalar>& x, Scalar& normB) {
+    unsigned n = operatorSize(a);
+    if (b.getRows() * b.getColumns() != n)
+        throw std::runtime_error("Wrong size");
+    if (x.getRows() * x.getColumns() == 0)
+        x = Vector<Scalar>(n, true, Scalar(0));
+    else if (x.getRows() * x.getColumns() != n)
+        throw std::runtime_error("Wrong size");
+    normB = parallelNorm(b.data(), n);
+    if (normB == Scalar(0))
+        normB = 1;
+    return n;
+}
+
+template <class Scalar>
+bool solverContinue(const SolverOptions<Scalar>& options, unsigned iteration, Scalar residual) {
+    return !options.callback || options.callback(iteration, residual);
+}
+
+// r = b - A x
+template <class A, class Scalar>
+void residualVector(const A& a, const Scalar* b, const Scalar* x, Scalar* r, std::size_t n) {
+    applyOperator(a, x, r);
+    forChunks(n, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t i = lo; i < hi; i++)
+            r[i] = b[i] - r[i];
+    });
+}
+
+// Preconditioned conjugate gradients, for symmetric positive definite A
+// and M.
+template <class A, class Scalar, class P = IdentityPreconditioner<Scalar>>
+SolverResult<Scalar> conjugateGradient(const A& a, const Vector<Scalar>& b, Vector<Scalar>& x,
+                                       const SolverOptions<Scalar>& options = SolverOptions<Scalar>(),
+                                       const P& preconditioner = P()) {
+    Scalar normB;
+    unsigned n = prepareSolve(a, b, x, normB);
+    MatrixBuffer<Scalar> r(n), z(n), p(n), q(n);
+    Scalar* xs = x.data();
+    residualVector(a, b.data(), xs, r.data(), n);
+    SolverResult<Scalar> result{false, 0, parallelNorm(r.data(), n) / normB};
+    if (result.residual <= options.tolerance){
+        result.converged = true;
+        return result;
+    }
+    preconditioner.apply(r.data(), z.data(), n);
+    std::copy(z.begin(), z.end(), p.begin());
+    Scalar rz = parallelDot(r.data(), z.data(), n);
+    while (result.iterations < options.maxIterations){
+        applyOperator(a, p.data(), q.data());
+        Scalar pq = parallelDot(p.data(), q.data(), n);
+        if (pq == Scalar(0))
+            break;
+        Scalar alpha = rz / pq;
+        parallelAxpy(alpha, p.data(), xs, n);
+        parallelAxpy(-alpha, q.data(), r.data(), n);
+        result.residual = parallelNorm(r.data(), n) / normB;
+        result.iterations++;
+        if (result.residual <= options.tolerance){
+            result.converged = true;
+            break;
+        }
+        if (!solverContinue(options, result.iterations, result.residual))
+            break;
+        preconditioner.apply(r.data(), z.data(), n);
+        Scalar rzNext = parallelDot(r.data(), z.data(), n);
+        parallelXpby(z.data(), rzNext / rz, p.data(), n);
+        rz = rzNext;
+    }
+    return result;
+}
+
+// Right-preconditioned BiCGSTAB, for general (nonsymmetric) A.
+template <class A, class Scalar, class P = IdentityPreconditioner<Scalar>>
+SolverResult<Scalar> biCGStab(const A& a, const Vector<Scalar>& b, Vector<Scalar>& x,
+                              const SolverOptions<Scalar>& options = SolverOptions<Scalar>(),
+                              const P& preconditioner = P()) {
+    Scalar normB;
+    unsigned n = prepareSolve(a, b, x, normB);
+    MatrixBuffer<Scalar> r(n), shadow(n), p(n, 0), v(n, 0), pHat(n), sHat(n), t(n);
+    Scalar* xs = x.data();
+    residualVector(a, b.data(), xs, r.data(), n);
+    std::copy(r.begin(), r.end(), shadow.begin());
+    SolverResult<Scalar> result{false, 0, parallelNorm(r.data(), n) / normB};
+    Scalar rho = 1, alpha = 1, omega = 1;
+    while (result.residual > options.tolerance && result.iterations < options.maxIterations){
+        Scalar rhoNext = parallelDot(shadow.data(), r.data(), n);
+        if (rhoNext == Scalar(0) || omega == Scalar(0))
+            break;
+        // p = r + beta * (p - omega * v)
+        Scalar beta = rhoNext / rho * (alpha / omega);
+        forChunks(n, [&](std::size_t lo, std::size_t hi) {
+            for (std::size_t i = lo; i < hi; i++)
+                p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        });
+        preconditioner.apply(p.data(), pHat.data(), n);
+        applyOperator(a, pHat.data(), v.data());
+        Scalar shadowV = parallelDot(shadow.data(), v.data(), n);
+        if (shadowV == Scalar(0))
+            break;
+        alpha = rhoNext / shadowV;
+        // s = r - alpha * v, kept in r
+        parallelAxpy(-alpha, v.data(), r.data(), n);
+        parallelAxpy(alpha, pHat.data(), xs, n);
+        result.iterations++;
+        result.residual = parallelNorm(r.data(), n) / normB;
+        if (result.residual <= options.tolerance)
+            break;
+        preconditioner.apply(r.data(), sHat.data(), n);
+        applyOperator(a, sHat.data(), t.data());
+        Scalar tt = parallelDot(t.data(), t.data(), n);
+        omega = tt == Scalar(0) ? Scalar(0) : parallelDot(t.data(), r.data(), n) / tt;
+        parallelAxpy(omega, sHat.data(), xs, n);
+        parallelAxpy(-omega, t.data(), r.data(), n);
+        rho = rhoNext;
+        result.residual = parallelNorm(r.data(), n) / normB;
+        if (!solverContinue(options, result.iterations, result.residual))
+            break;
+    }
+    result.converged = result.residual <= options.tolerance;
+    return result;
+}
+
+// Right-preconditioned GMRES restarted every options.restart iterations,
+// with modified Gram-Schmidt and Givens rotations, for general A. The
+// residual is tracked by the rotations and recomputed at every restart.
+template <class A, class Scalar, class P = IdentityPreconditioner<Scalar>>
+SolverResult<Scalar> gmres(const A& a, const Vector<Scalar>& b, Vector<Scalar>& x,
+                           const SolverOptions<Scalar>& options = SolverOptions<Scalar>(),
+                           const P& preconditioner = P()) {
+    Scalar normB;
+    unsigned n = prepareSolve(a, b, x, normB);
+    unsigned m = std::max(1u, std::min(options.restart, n));
+    std::vector<MatrixBuffer<Scalar>> basis(m + 1, MatrixBuffer<Scalar>(n));
+    std::vector<Scalar> h((m + 1) * m), cs(m), sn(m), g(m + 1), y(m);
+    MatrixBuffer<Scalar> w(n), u(n);
+    Scalar* xs = x.data();
+    SolverResult<Scalar> result{false, 0, 0};
+    for (;;){
+        residualVector(a, b.data(), xs, basis[0].data(), n);
+        Scalar beta = parallelNorm(basis[0].data(), n);
+        result.residual = beta / normB;
+        if (result.residual <= options.tolerance){
+            result.converged = true;
+            break;
+        }
+        if (result.iterations >= options.maxIterations)
+            break;
+        simdScale(basis[0].data(), 1 / beta, n);
+        std::fill(g.begin(), g.end(), Scalar(0));
+        g[0] = beta;
+        unsigned j = 0;
+        bool stop = false;
+        while (j < m && result.iterations < options.maxIterations){
+            preconditioner.apply(basis[j].data(), w.data(), n);
+            applyOperator(a, w.data(), basis[j + 1].data());
+            Scalar* next = basis[j + 1].data();
+            for (unsigned i = 0; i <= j; i++){
+                h[i * m + j] = parallelDot(next, basis[i].data(), n);
+                parallelAxpy(-h[i * m + j], basis[i].data(), next, n);
+            }
+            Scalar norm = parallelNorm(next, n);
+            h[(j + 1) * m + j] = norm;
+            if (norm != Scalar(0))
+                simdScale(next, 1 / norm, n);
+            for (unsigned i = 0; i < j; i++){
+                Scalar hi = h[i * m + j], hi1 = h[(i + 1) * m + j];
+                h[i * m + j] = cs[i] * hi + sn[i] * hi1;
+                h[(i + 1) * m + j] = -sn[i] * hi + cs[i] * hi1;
+            }
+            Scalar hj = h[j * m + j], hj1 = h[(j + 1) * m + j];
+            Scalar radius = std::sqrt(hj * hj + hj1 * hj1);
+            cs[j] = radius == Scalar(0) ? Scalar(1) : hj / radius;
+            sn[j] = radius == Scalar(0) ? Scalar(0) : hj1 / radius;
+            h[j * m + j] = radius;
+            h[(j + 1) * m + j] = 0;
+            g[j + 1] = -sn[j] * g[j];
+            g[j] = cs[j] * g[j];
+            j++;
+            result.iterations++;
+            result.residual = std::abs(g[j]) / normB;
+            if (result.residual <= options.tolerance || norm == Scalar(0))
+                break;
+            if (!solverContinue(options, result.iterations, result.residual)){
+                stop = true;
+                break;
+            }
+        }
+        // x += M^-1 (V y) with H y = g.
+        for (unsigned i = j; i-- > 0; ){
+            Scalar sum = g[i];
+            for (unsigned k = i + 1; k < j; k++)
+                sum -= h[i * m + k] * y[k];
+            y[i] = h[i * m + i] == Scalar(0) ? Scalar(0) : sum / h[i * m + i];
+        }
+        std::fill(u.begin(), u.end(), Scalar(0));
+        for (unsigned i = 0; i < j; i++)
+            parallelAxpy(y[i], basis[i].data(), u.data(), n);
+        preconditioner.apply(u.data(), w.data(), n);
+        parallelAxpy(Scalar(1), w.data(), xs, n);
+        if (stop){
+            result.converged = result.residual <= options.tolerance;
+            break;
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef LU_H
+#define LU_H
+
+#include "AbstractMatrix.h"
+#include "Gemm.h"
+#include <cmath>
+
+template <class Scalar> class Matrix;
+template <class Scalar> class Vector;
+
+// Row-pivoted LU decomposition PA = LU, stored in place: the strict lower
+// triangle holds L (unit diagonal implied), the upper triangle holds U.
+// Factor once, then query det(), invert() and solve() as often as needed.
+template <class Scalar>
+class LU {
+public:
+    static constexpr unsigned blockSize = 64;
+
+    template <class Other>
+    explicit LU(const AbstractMatrix<Other>& m) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        size = m.getRows();
+        lu.assign(m.begin(), m.end());
+        factor();
+    }
+
+    LU(unsigned size, MatrixBuffer<Scalar> values) : lu(std::move(values)), size(size) {
+        if (size * size != lu.size())
+            throw std::runtime_error("Wrong number of elements");
+        factor();
+    }
+
+    unsigned getSize() const { return size; }
+    bool isSingular() const { return singular; }
+
+    const MatrixBuffer<Scalar>& getFactors() const { return lu; }
+    const std::vector<unsigned>& getPivots() const { return pivots; }
+
+    Scalar det() const {
+        if (singular)
+            return 0;
+        Scalar det = 1;
+        for (unsigned i = 0; i < size; i++)
+            det *= lu[i * size + i];
+        return swaps % 2 ? -det : det;
+    }
+
+    Matrix<Scalar> invert() const {
+        MatrixBuffer<Scalar> r(size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            r[i * size + i] = 1;
+        solveInPlace(r.data(), size);
+        return Matrix<Scalar>(size, size, std::move(r));
+    }
+
+    Vector<Scalar> solve(const Vector<Scalar>& b) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), 1);
+        return Vector<Scalar>(size, b.getRows() != 1, std::move(x));
+    }
+
+    Matrix<Scalar> solve(const AbstractMatrix<Scalar>& b) const {
+        if (b.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        solveInPlace(x.data(), b.getColumns());
+        return Matrix<Scalar>(size, b.getColumns(), std::move(x));
+    }
+
+    // Overwrites the row-major size x columns block b with A^-1 * b. Large
+    // solves split the columns of b into strips that the pool solves side
+    // by side, each with blocked forward and back substitution.
+    void solveInPlace(Scalar* b, unsigned columns) const {
+        if (singular)
+            throw std::runtime_error("Singular matrix");
+        for (unsigned k = 0; k < size; k++)
+            if (pivots[k] != k)
+                for (unsigned j = 0; j < columns; j++)
+                    std::swap(b[k * columns + j], b[pivots[k] * columns + j]);
+
+        ThreadPool& pool = ThreadPool::global();
+        unsigned strip = columns;
+        if (pool.useParallel(2ull * size * size * columns)){
+            unsigned threads = pool.getThreadCount();
+            strip = std::max(blockSize, (columns + threads - 1) / threads);
+        }
+        pool.parallelFor(0, columns, strip, [&](unsigned lo, unsigned hi) {
+            forwardSolve(b + lo, columns, hi - lo);
+            backSolve(b + lo, columns, hi - lo);
+        });
+    }
+
+private:
+    // b = L^-1 b for the size x columns block b (ldb). Blocks of blockSize
+    // rows are solved directly and then subtracted from the rows below
+    // with gemm.
+    void forwardSolve(Scalar* b, unsigned ldb, unsigned columns) const {
+        MatrixBuffer<Scalar> panel;
+        for (unsigned k0 = 0; k0 < size; k0 += blockSize){
+            unsigned k1 = std::min(size, k0 + blockSize), kb = k1 - k0;
+            for (unsigned i = k0 + 1; i < k1; i++){
+                Scalar* bi = b + i * ldb;
+                for (unsigned k = k0; k < i; k++){
+                    Scalar l = lu[i * size + k];
+                    const Scalar* bk = b + k * ldb;
+                    for (unsigned j = 0; j < columns; j++)
+                        bi[j] -= l * bk[j];
+                }
+            }
+            if (k1 == size)
+                break;
+
+            // b[k1:] -= L[k1:, k0:k1] * b[k0:k1]
+            unsigned rest = size - k1;
+            panel.resize(rest * kb);
+            for (unsigned i = 0; i < rest; i++)
+                for (unsigned k = 0; k < kb; k++)
+                    panel[i * kb + k] = -lu[(k1 + i) * size + k0 + k];
+            gemm(rest, columns, kb, panel.data(), kb, b + k0 * ldb, ldb, b + k1 * ldb, ldb);
+        }
+    }
+
+    // b = U^-1 b, as forwardSolve, from the last block up.
+    void backSolve(Scalar* b, unsigned ldb, unsigned columns) const {
+        MatrixBuffer<Scalar> panel;
+        for (unsigned k1 = size; k1 > 0; ){
+            unsigned k0 = k1 > blockSize ? k1 - blockSize : 0, kb = k1 - k0;
+            for (unsigned i = k1; i-- > k0; ){
+                Scalar* bi = b + i * ldb;
+                for (unsigned k = i + 1; k < k1; k++){
+                    Scalar u = lu[i * size + k];
+                    const Scalar* bk = b + k * ldb;
+                    for (unsigned j = 0; j < columns; j++)
+                        bi[j] -= u * bk[j];
+                }
+                Scalar diagonal = lu[i * size + i];
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] /= diagonal;
+            }
+
+            // b[:k0] -= U[:k0, k0:k1] * b[k0:k1]
+            if (k0 > 0){
+                panel.resize(k0 * kb);
+                for (unsigned i = 0; i < k0; i++)
+                    for (unsigned k = 0; k < kb; k++)
+                        panel[i * kb + k] = -lu[i * size + k0 + k];
+                gemm(k0, columns, kb, panel.data(), kb, b + k0 * ldb, ldb, b, ldb);
+            }
+            k1 = k0;
+        }
+    }
+
+    void swapRows(unsigned first, unsigned second) {
+        Scalar* a = lu.data() + first * size;
+        Scalar* b = lu.data() + second * size;
+        for (unsigned j = 0; j < size; j++)
+            std::swap(a[j], b[j]);
+    }
+
+    // Unblocked factorization of columns [k0, k1) over rows [k0, size).
+    void factorPanel(unsigned k0, unsigned k1) {
+        Scalar* a = lu.data();
+        for (unsigned k = k0; k < k1; k++){
+            unsigned pivot = k;
+            for (unsigned i = k + 1; i < size; i++)
+                if (std::abs(a[i * size + k]) > std::abs(a[pivot * size + k]))
+                    pivot = i;
+            pivots[k] = pivot;
+            if (pivot != k){
+                swapRows(pivot, k);
+                swaps++;
+            }
+            Scalar diagonal = a[k * size + k];
+            if (diagonal == Scalar(0)){
+                singular = true;
+                continue;
+            }
+            for (unsigned i = k + 1; i < size; i++){
+                Scalar* row = a + i * size;
+                Scalar factor = row[k] /= diagonal;
+                const Scalar* pivotRow = a + k * size;
+                for (unsigned j = k + 1; j < k1; j++)
+                    row[j] -= factor * pivotRow[j];
+            }
+        }
+    }
+
+    void factor() {
+        pivots.resize(size);
+        Scalar* a = lu.data();
+        MatrixBuffer<Scalar> l21;
+        for (unsigned k0 = 0; k0 < size; k0 += blockSize){
+            unsigned k1 = std::min(size, k0 + blockSize);
+            unsigned kb = k1 - k0;
+            factorPanel(k0, k1);
+            if (k1 == size)
+                break;
+
+            // U12 = L11^-1 * A12
+            for (unsigned k = k0; k < k1; k++)
+                for (unsigned i = k + 1; i < k1; i++){
+                    Scalar factor = a[i * size + k];
+                    for (unsigned j = k1; j < size; j++)
+                        a[i * size + j] -= factor * a[k * size + j];
+                }
+
+            // A22 -= L21 * U12
+            unsigned rest = size - k1;
+            l21.resize(rest * kb);
+            for (unsigned i = 0; i < rest; i++)
+                for (unsigned k = 0; k < kb; k++)
+                    l21[i * kb + k] = -a[(k1 + i) * size + k0 + k];
+            gemm(rest, rest, kb, l21.data(), kb, a + k0 * size + k1, size,
+                 a + k1 * size + k1, size);
+        }
+    }
+
+    MatrixBuffer<Scalar> lu;
+    std::vector<unsigned> pivots;
+    unsigned size = 0;
+    unsigned swaps = 0;
+    bool singular = false;
+};
+
+#include "Matrix.h"
+#include "Vector.h"
+
+#endif
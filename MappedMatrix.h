@@ -0,0 +1,189 @@
+#ifndef MAPPED_MATRIX_H
+#define MAPPED_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "LU.h"
+#include "Serialization.h"
+#include "Simd.h"
+#include "Transpose.h"
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Matrix backed by a memory-mapped binary matrix file (see Serialization.h).
+// Opening only maps the file; pages are read lazily as elements are
+// touched, so huge files open instantly and never need to fit in memory at
+// once. The file itself is never modified: the mapping is private, so a
+// write only copies the touched page into process memory. The file must
+// store Scalar in native byte order.
+template <class Scalar>
+class MappedMatrix final : public AbstractMatrix<Scalar> {
+public:
+    typedef typename AbstractMatrix<Scalar>::iterator iterator;
+    typedef typename AbstractMatrix<Scalar>::const_iterator const_iterator;
+
+    explicit MappedMatrix(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || (std::size_t)info.st_size < sizeof(MatrixFileHeader)){
+            ::close(fd);
+            throw std::runtime_error("Not a matrix file");
+        }
+        length = info.st_size;
+        int flags = MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+#endif
+        void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("Cannot map " + path);
+        mapping = static_cast<char*>(p);
+        try{
+            MatrixFileHeader raw;
+            std::memcpy(&raw, mapping, sizeof(raw));
+            header = decodeFileHeader(raw);
+            if (header.swapped())
+                throw std::runtime_error("Matrix file has foreign byte order");
+            if (header.scalarKind != BinaryScalar<Scalar>::kind || header.scalarSize != sizeof(Scalar))
+                throw std::runtime_error("Wrong scalar type");
+            if (header.dataOffset % alignof(Scalar) != 0)
+                throw std::runtime_error("Misaligned matrix file");
+            if (header.dataOffset > length || header.elements() > (length - header.dataOffset) / sizeof(Scalar))
+                throw std::runtime_error("Truncated matrix file");
+        }
+        catch (...){
+            ::munmap(mapping, length);
+            throw;
+        }
+        elements = reinterpret_cast<Scalar*>(mapping + header.dataOffset);
+        rows = header.rows;
+        columns = header.columns;
+    }
+
+    ~MappedMatrix() {
+        if (mapping)
+            ::munmap(mapping, length);
+    }
+
+    MappedMatrix(const MappedMatrix&) = delete;
+    MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+    MappedMatrix(MappedMatrix&& m) :
+        mapping(m.mapping), length(m.length), header(m.header),
+        elements(m.elements), rows(m.rows), columns(m.columns) {
+        m.mapping = nullptr;
+        m.elements = nullptr;
+        m.rows = m.columns = 0;
+    }
+
+    const MatrixFileHeader& getHeader() const { return header; }
+
+    // Asks the kernel to start reading the whole file in the background.
+    void prefetch() const {
+        ::madvise(mapping, length, MADV_WILLNEED);
+    }
+
+    virtual bool isSquare() const override { return rows == columns; }
+    virtual bool isVector() const override { return rows == 1 || columns == 1; }
+
+    virtual bool isDiagonal() const override {
+        return isSquare() && parallelIsDiagonal(ref(), false);
+    }
+
+    virtual bool isZero() const override {
+        return parallelIsZero(elements, size());
+    }
+
+    virtual bool isIdentity() const override {
+        return isSquare() && parallelIsDiagonal(ref(), true);
+    }
+
+    virtual Scalar max() const override { return parallelMax(elements, size()); }
+    virtual Scalar min() const override { return parallelMin(elements, size()); }
+
+    virtual unsigned getRows() const override { return rows; }
+    virtual unsigned getColumns() const override { return columns; }
+
+    virtual iterator begin() override { return elements; }
+    virtual iterator end() override { return elements + size(); }
+    virtual const_iterator begin() const override { return elements; }
+    virtual const_iterator end() const override { return elements + size(); }
+
+    Scalar* data() { return elements; }
+    const Scalar* data() const { return elements; }
+    MatrixRef<Scalar> ref() { return MatrixRef<Scalar>(elements, rows, columns); }
+    MatrixRef<const Scalar> ref() const { return MatrixRef<const Scalar>(elements, rows, columns); }
+
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < rows && c < columns);
+        return elements[(std::size_t)r * columns + c];
+    }
+
+    virtual Scalar operator()(unsigned r, unsigned c) const override {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("MappedMatrix::operator()");
+        return unchecked(r, c);
+    }
+
+    virtual Scalar& operator()(unsigned r, unsigned c) override {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("MappedMatrix::operator()");
+        return elements[(std::size_t)r * columns + c];
+    }
+
+    virtual bool operator==(const AbstractMatrix<Scalar>& m) const override {
+        if (rows != m.getRows() || columns != m.getColumns())
+            return false;
+        return parallelEqual(elements, m.data(), size());
+    }
+
+    virtual Scalar trace() const override {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        Scalar trace = 0;
+        for (unsigned i = 0; i < rows; i++)
+            trace += unchecked(i, i);
+        return trace;
+    }
+
+    template<typename T = double>
+    T det() const {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        return LU<T>(*this).det();
+    }
+
+    template<typename T = double>
+    LU<T> lu() const {
+        return LU<T>(*this);
+    }
+
+    virtual void transponeThis() override {
+        transposeInPlace(rows, columns, elements);
+        std::swap(rows, columns);
+    }
+
+    virtual void makeIdentity() override {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned j = 0; j < columns; j++)
+                elements[(std::size_t)i * columns + j] = i == j ? 1 : 0;
+    }
+
+private:
+    std::size_t size() const { return (std::size_t)rows * columns; }
+
+    char* mapping = nullptr;
+    std::size_t length = 0;
+    MatrixFileHeader header;
+    Scalar* elements = nullptr;
+    unsigned rows = 0, columns = 0;
+};
+
+#endif
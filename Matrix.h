@@ -2,6 +2,14 @@
 #define MATRIX_H
 
 #include "AbstractMatrix.h"
+#include "Expression.h"
+#include "Gemm.h"
+#include "MatrixView.h"
+#include "Simd.h"
+#include "Strassen.h"
+#include "Transpose.h"
+#include "LU.h"
+#include "MixedPrecision.h"
 
 template <class Scalar>
 class Matrix final : public AbstractMatrix<Scalar> {
@@ -12,13 +20,21 @@ public:
     Matrix() {}
     
     Matrix(unsigned rows, unsigned columns, Scalar value = Scalar()) :
-        data(rows * columns, value), rows(rows), columns(columns) {}
+        storage(rows * columns, value), rows(rows), columns(columns) {}
         
-    Matrix(unsigned rows, unsigned columns, std::vector<Scalar> values) :
+    Matrix(unsigned rows, unsigned columns, MatrixBuffer<Scalar> values) :
         rows(rows), columns(columns) {
             if (rows * columns != values.size())
                 throw std::runtime_error("Wrong number of elements");
-            data = std::move(values);
+            storage = std::move(values);
+    }
+    
+    template <class Allocator>
+    Matrix(unsigned rows, unsigned columns, const std::vector<Scalar, Allocator>& values) :
+        rows(rows), columns(columns) {
+            if (rows * columns != values.size())
+                throw std::runtime_error("Wrong number of elements");
+            storage.assign(values.begin(), values.end());
     }
 
     Matrix(const Matrix& m) = default;
@@ -27,20 +43,34 @@ public:
     Matrix& operator=(const Matrix& m) = default;
     Matrix& operator=(Matrix&& m) = default;
     
-    Matrix(const AbstractMatrix<Scalar>& m) {
-        rows = m.getRows();
-        columns = m.getColumns();
-        data.assign(m.begin(), m.end());
-    }
+    Matrix(const AbstractMatrix<Scalar>& m) :
+        storage(m.copyElements()), rows(m.getRows()), columns(m.getColumns()) {}
     
     Matrix& operator=(const AbstractMatrix<Scalar>& m) {
         if (this != &m){
             rows = m.getRows();
-            columns = m.getColumns;
-            data.assign(m.begin(), m.end());
+            columns = m.getColumns();
+            storage = m.copyElements();
         }
         return *this;
     }
+    
+    template <class E>
+    Matrix(const MatrixExpression<E>& e) :
+        rows(e.self().getRows()), columns(e.self().getColumns()) {
+        MATRIX_PROFILE("Matrix::expression", rows, columns, (unsigned long long)rows * columns);
+        assignExpression(storage.buffer(), e);
+    }
+    
+    template <class E>
+    Matrix& operator=(const MatrixExpression<E>& e) {
+        unsigned r = e.self().getRows(), c = e.self().getColumns();
+        MATRIX_PROFILE("Matrix::expression", r, c, (unsigned long long)r * c);
+        assignExpression(storage.buffer(), e);
+        rows = r;
+        columns = c;
+        return *this;
+    }
 
     virtual bool isSquare() const override {
         return rows == columns;
@@ -51,111 +81,126 @@ public:
     }
     
     virtual bool isDiagonal() const override {
-        if (!isSquare())
-            return false;
-        for (unsigned i = 0; i < rows; i++)
-            for (unsigned j = 0; j < columns; j++)
-                if (i != j && data[i * columns + j] != 0)
-                    return false;
-        return true;
+        return isSquare() && parallelIsDiagonal(ref(), false);
     }
     
     virtual bool isZero() const override {
-        for (auto i = begin(); i != end(); i++)
-            if (*i != 0)
-                return false;
-        return true;
+        return parallelIsZero(storage.data(), storage.size());
+    }
+    
+    virtual Scalar max() const override {
+        return parallelMax(storage.data(), storage.size());
+    }
+    
+    virtual Scalar min() const override {
+        return parallelMin(storage.data(), storage.size());
     }
     
     virtual bool isIdentity() const override {
-        if (!isDiagonal())
-            return false;
-        for (unsigned i = 0; i < rows * columns; i += columns + 1 )
-            if (data[i] != 1)
-                return false;
-        return true;
-    } 
+        return isSquare() && parallelIsDiagonal(ref(), true);
+    }
     
     virtual unsigned getRows() const override { return rows; }
     virtual unsigned getColumns() const override { return columns; }
 
-    virtual iterator begin() override { return data.begin(); }
-    virtual iterator end() override { return data.end(); }
-    virtual const_iterator begin() const override { return data.begin(); }
-    virtual const_iterator end() const override { return data.end(); }
+    virtual iterator begin() override { return storage.data(); }
+    virtual iterator end() override { return storage.data() + storage.size(); }
+    virtual const_iterator begin() const override { return storage.data(); }
+    virtual const_iterator end() const override { return storage.data() + storage.size(); }
+    
+    Scalar* data() { return storage.data(); }
+    const Scalar* data() const { return storage.data(); }
+    MatrixRef<Scalar> ref() { return MatrixRef<Scalar>(storage.data(), rows, columns); }
+    MatrixRef<const Scalar> ref() const { return MatrixRef<const Scalar>(storage.data(), rows, columns); }
+
+    // Copy-on-write sharing of the elements with copies; see MatrixStorage.h.
+    void share() { storage.share(); }
+    bool isShared() const { return storage.isShared(); }
+    virtual const MatrixStorage<Scalar>* getStorage() const override { return &storage; }
+    
+    Scalar* row(unsigned r) {
+        assert(r < rows);
+        return storage.data() + r * columns;
+    }
+    
+    const Scalar* row(unsigned r) const {
+        assert(r < rows);
+        return storage.data() + r * columns;
+    }
+    
+    Scalar& unchecked(unsigned r, unsigned c) {
+        assert(r < rows && c < columns);
+        return storage[r * columns + c];
+    }
+    
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < rows && c < columns);
+        return storage[r * columns + c];
+    }
 
     virtual Scalar operator()(unsigned r, unsigned c) const override{
         if (r >= rows || c >= columns)
             throw std::out_of_range("Matrix::operator()");
-        return data[r * columns + c];
+        return storage[r * columns + c];
     }
 
     virtual Scalar& operator()(unsigned r, unsigned c) override {
         if (r >= rows || c >= columns)
             throw std::out_of_range("Matrix::operator()");
-        return data[r * columns + c];
+        return storage[r * columns + c];
     }
     
     bool operator==(const AbstractMatrix<Scalar>& m) const override {
         if (rows != m.getRows() || columns != m.getColumns())
             return false;
-        for (const_iterator i = begin(), j = m.begin(); j != m.end(); ++i, ++j)
-            if (*i != *j)
-                return false;
-        return true;
-    }
-    
-    Matrix operator-() const {
-        std::vector<Scalar> temp;
-        temp.reserve(data.size());
-        for (auto element : *this)
-            temp.push_back(-element);
-        return Matrix(rows, columns, std::move(temp));
+        return parallelEqual(storage.data(), m.data(), storage.size());
     }
     
     Matrix& operator+=(const AbstractMatrix<Scalar>& m){
         if (rows != m.getRows() || columns != m.getColumns())
             throw std::runtime_error("Wrong size");
-        unsigned size = rows * columns;
-        auto m_data = m.begin();
-        for (unsigned i = 0; i < size; i++)
-            data[i] += m_data[i];
+        MATRIX_PROFILE("Matrix::operator+=", rows, columns, storage.size());
+        simdAdd(storage.data(), m.data(), storage.size());
         return *this;
     }
     
-    Matrix operator+(const AbstractMatrix<Scalar>& m) {
-        Matrix copy(*this);
-        copy += m;
-        return copy;
-    }
-    
     Matrix& operator-=(const AbstractMatrix<Scalar>& m){
         if (rows != m.getRows() || columns != m.getColumns())
             throw std::runtime_error("Wrong size");
-        unsigned size = rows * columns;
-        auto m_data = m.begin();
-        for (unsigned i = 0; i < size; i++)
-            data[i] -= m_data[i];
+        MATRIX_PROFILE("Matrix::operator-=", rows, columns, storage.size());
+        simdSub(storage.data(), m.data(), storage.size());
         return *this;
     }
     
-    Matrix operator-(const AbstractMatrix<Scalar>& m) {
-        Matrix copy(*this);
-        copy -= m;
-        return copy;
+    template <class E>
+    Matrix& operator+=(const MatrixExpression<E>& e) {
+        const E& x = e.self();
+        if (rows != x.getRows() || columns != x.getColumns())
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("Matrix::operator+=", rows, columns, storage.size());
+        updateExpression<ExpressionPlus>(storage.data(), x.getColumns(), x);
+        return *this;
     }
     
-    Matrix operator*(const AbstractMatrix<Scalar>& m) {
+    template <class E>
+    Matrix& operator-=(const MatrixExpression<E>& e) {
+        const E& x = e.self();
+        if (rows != x.getRows() || columns != x.getColumns())
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("Matrix::operator-=", rows, columns, storage.size());
+        updateExpression<ExpressionMinus>(storage.data(), x.getColumns(), x);
+        return *this;
+    }
+    
+    Matrix operator*(const AbstractMatrix<Scalar>& m) const {
         if (columns != m.getRows())
             throw std::runtime_error("Wrong size");
         unsigned resColumns = m.getColumns();
-        std::vector<Scalar> elements(rows * resColumns, 0);
-        for (unsigned i = 0; i < rows; i++){
-            Scalar* row = elements.data() + i * resColumns;
-            for (unsigned j = 0; j < columns; j++)
-                for (unsigned k = 0; k < resColumns; k++)
-                    row[k] += this->operator()(i,j) * m(j,k);
-        }
+        MATRIX_PROFILE("Matrix::operator*", rows, resColumns, 2ull * rows * resColumns * columns);
+        MatrixBuffer<Scalar> elements(rows * resColumns, 0);
+        if (!elements.empty() && columns != 0)
+            multiplyInto(rows, resColumns, columns, storage.data(), columns,
+                         m.data(), resColumns, elements.data(), resColumns);
         return Matrix<Scalar>(rows, resColumns, std::move(elements));
     }
     
@@ -165,23 +210,17 @@ public:
     }
     
     Matrix& operator*=(const Scalar& c) {
-        for (auto& e : data)
-            e *= c;
+        MATRIX_PROFILE("Matrix::operator*=", rows, columns, storage.size());
+        simdScale(storage.data(), c, storage.size());
         return *this;
     }
     
-    Matrix operator*(const Scalar& c) {
-        Matrix copy(*this);
-        copy *= c;
-        return copy;
-    }
-    
     virtual Scalar trace() const override {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
         Scalar trace = 0;
         for (unsigned i = 0; i < rows*columns; i += columns +1 )
-            trace += data[i];
+            trace += storage[i];
         return trace;
     }
     
@@ -189,125 +228,61 @@ public:
     T det() const {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
+        MATRIX_PROFILE("Matrix::det", rows, columns, 2ull * rows * rows * rows / 3);
         if (rows == 1)
-            return data[0];
+            return storage[0];
         if (rows == 2)
-            return (data[0]*data[3] - data[1]*data[2]);
-        
-        std::vector<T> v(data.begin(), data.end());
-        Matrix<T> m(rows, columns, v);
-        
-        bool swap = false;
-        for (unsigned k = 0; k < columns-1; k++){
-            if (m(k,k) == 0){
-                bool detZero = true;
-                for (unsigned i = k+1; i < rows; i++)
-                    if (m(i,k) != 0){
-                        m.swapRows(i,k);
-                        swap = !swap;
-                        detZero = false;
-                        break;
-                    }
-                if (detZero)
-                    return 0;
-            }
-            for (unsigned i = k+1; i < rows; i++){
-                T factor = m(i,k) / m(k,k);
-                for ( unsigned j = k; j < columns; j++){
-                    T element = m(i,j) - factor * m(k,j);
-                    m(i, j) = element;
-                }
-            }
-        }
-                
-        T det = m(0,0);
-        for (unsigned i = 1; i < rows; i++)
-            det *= m(i,i);
+            return (storage[0]*storage[3] - storage[1]*storage[2]);
         
-        if (swap)
-            return -det;
-        
-        return det;
+        return LU<T>(*this).det();
     }
     
     template<typename T = double>
     Matrix<T> invert() const {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
-        if (rows == 1)
-            return Matrix<T>(1,1,1/(T)data[0]);
-        
-        std::vector<T> v(data.begin(), data.end());
-        Matrix<T> m(rows, columns, v);
-        Matrix<T> r(rows, columns, 1);
-        r.makeIdentity();
-        
-        for (unsigned k = 0; k < columns-1; k++){
-            if (m(k,k) == 0){
-                bool detZero = true;
-                for (unsigned i = k+1; i < rows; i++)
-                    if (m(i,k) != 0){
-                        m.swapRows(i,k);
-                        r.swapRows(i,k);
-                        detZero = false;
-                        break;
-                    }
-                if (detZero)
-                    throw std::runtime_error("Singular matrix");
-            }
-            for (unsigned i = k+1; i < rows; i++){
-                T factor = m(i,k) / m(k,k);
-                for ( unsigned j = 0; j < columns; j++){
-                    m(i,j) -= factor * m(k,j);
-                    r(i,j) -= factor * r(k,j);
-                }
-            }
-        }
-        
-        if (m(rows-1, columns-1) == 0)
-            throw std::runtime_error("Singular matrix");
-        
-        for (unsigned k = columns - 1; k > 0; k--){
-            for (unsigned i = 0; i < k; i++){
-                T factor = m(i,k) / m(k,k);
-                for ( unsigned j = 0; j < columns; j++){
-                    m(i,j) -= factor * m(k,j);
-                    r(i,j) -= factor * r(k,j);
-                }
-            }
-        }
-        
-        for (unsigned i = 0; i < rows; i++)
-            for (unsigned j = 0; j < columns; j++)
-                r(i,j) /= m(i,i);
-        
-        return r;
+        MATRIX_PROFILE("Matrix::invert", rows, columns, 2ull * rows * rows * rows);
+        return LU<T>(*this).invert();
+    }
+    
+    template<typename T = double>
+    LU<T> lu() const {
+        MATRIX_PROFILE("Matrix::lu", rows, columns, 2ull * rows * rows * rows / 3);
+        return LU<T>(*this);
+    }
+    
+    // Factors in float and refines solutions in T; see MixedPrecision.h.
+    template<typename T = double>
+    MixedPrecisionLU<T> mixedPrecisionLU(RefinementOptions options = RefinementOptions()) const {
+        MATRIX_PROFILE("Matrix::mixedPrecisionLU", rows, columns, 2ull * rows * rows * rows / 3);
+        return MixedPrecisionLU<T>(*this, options);
     }
     
     void swapRows(unsigned first, unsigned second) {
         if (first >= rows || second >= rows)
             throw std::out_of_range("Matrix::swapRows");
         for (unsigned i = 0; i < columns; i++)
-            std::swap(data[first * columns + i], data[second * columns + i]);
+            std::swap(storage[first * columns + i], storage[second * columns + i]);
     }
     
     void swapColumns(unsigned first, unsigned second) {
         if (first >= rows || second >= rows)
             throw std::out_of_range("Matrix::swapColumns");
         for (unsigned i = 0; i < rows; i++)
-            std::swap(data[i * columns + first], data[i * columns + second]);
+            std::swap(storage[i * columns + first], storage[i * columns + second]);
     }
     
     Matrix transpone() const {
-        std::vector<Scalar> elements(rows * columns);
-        for (unsigned i = 0; i < rows; i++)
-            for (unsigned j = 0; j < columns; j++)
-                elements[j * rows + i] = data[i * columns + j];
+        MATRIX_PROFILE("Matrix::transpone", rows, columns, 0);
+        MatrixBuffer<Scalar> elements(rows * columns);
+        transpose(rows, columns, storage.data(), columns, elements.data(), rows);
         return Matrix(columns, rows, std::move(elements));
     }
     
     virtual void transponeThis() override {
-        *this = transpone();
+        MATRIX_PROFILE("Matrix::transponeThis", rows, columns, 0);
+        transposeInPlace(rows, columns, storage.data());
+        std::swap(rows, columns);
     }
     
     virtual void makeIdentity() override {
@@ -316,19 +291,14 @@ public:
         for (unsigned i = 0; i < rows; i++)
             for (unsigned j = 0; j < columns; j++)
                 if (i != j)
-                    data[i * columns + j] = 0;
+                    storage[i * columns + j] = 0;
                 else
-                    data[i * columns + j] = 1;
+                    storage[i * columns + j] = 1;
     }
 
 private:
-    std::vector<Scalar> data;
+    MatrixStorage<Scalar> storage;
     unsigned rows = 0, columns = 0;
 };
 
-template<typename Scalar>
-Matrix<Scalar> operator*(const Scalar& c, Matrix<Scalar>& m) {
-   return m * c;
-}
-
 #endif
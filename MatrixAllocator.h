@@ -0,0 +1,316 @@
+#ifndef MATRIX_ALLOCATOR_H
+#define MATRIX_ALLOCATOR_H
+
+#include "Instrumentation.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Element buffers of Matrix, SquareMatrix and Vector (and the temporaries
+// the library creates on their behalf) are allocated from the calling
+// thread's current std::pmr::memory_resource. By default that is
+// std::pmr::get_default_resource(); install another one for a block of code
+// with MatrixResourceScope:
+//
+//     MatrixArena arena;
+//     {
+//         MatrixResourceScope scope(&arena);
+//         Matrix<double> c = a * b + d;    // intermediates come from arena
+//     }
+//     arena.reset();                       // all of them gone at once
+//
+// A matrix keeps the resource it was allocated from for its whole life, so
+// it must not outlive that resource (or its reset()/release()). Copies are
+// allocated from the resource current at the time of the copy. The arena and
+// pool below are not synchronized; use them from one thread at a time.
+inline std::pmr::memory_resource*& matrixResourceSetting() {
+    static thread_local std::pmr::memory_resource* resource = nullptr;
+    return resource;
+}
+
+inline std::pmr::memory_resource* getMatrixResource() {
+    std::pmr::memory_resource* resource = matrixResourceSetting();
+    return resource ? resource : std::pmr::get_default_resource();
+}
+
+// Passing nullptr restores the default resource. Returns the previous one.
+inline std::pmr::memory_resource* setMatrixResource(std::pmr::memory_resource* resource) {
+    std::pmr::memory_resource* previous = matrixResourceSetting();
+    matrixResourceSetting() = resource;
+    return previous;
+}
+
+class MatrixResourceScope {
+public:
+    explicit MatrixResourceScope(std::pmr::memory_resource* resource) :
+        previous(setMatrixResource(resource)) {}
+    ~MatrixResourceScope() { setMatrixResource(previous); }
+
+    MatrixResourceScope(const MatrixResourceScope&) = delete;
+    MatrixResourceScope& operator=(const MatrixResourceScope&) = delete;
+
+private:
+    std::pmr::memory_resource* previous;
+};
+
+// Like std::pmr::polymorphic_allocator, but a default-constructed or copied
+// container picks up the current matrix resource instead of the global default.
+template <class T>
+class MatrixAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    MatrixAllocator() : resource(getMatrixResource()) {}
+    MatrixAllocator(std::pmr::memory_resource* resource) : resource(resource) {}
+
+    template <class U>
+    MatrixAllocator(const MatrixAllocator<U>& a) : resource(a.getResource()) {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::size_t(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        MATRIX_COUNT_ALLOCATION(n * sizeof(T));
+        return static_cast<T*>(resource->allocate(n * sizeof(T), alignment));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        resource->deallocate(p, n * sizeof(T), alignment);
+    }
+
+    MatrixAllocator select_on_container_copy_construction() const {
+        return MatrixAllocator();
+    }
+
+    std::pmr::memory_resource* getResource() const { return resource; }
+
+private:
+    // Buffers start on a cache line, so rows of a padded stride (see
+    // AlignedMatrix.h) are aligned for every SIMD width.
+    static constexpr std::size_t alignment = std::max<std::size_t>(alignof(T), 64);
+
+    std::pmr::memory_resource* resource;
+};
+
+template <class T, class U>
+bool operator==(const MatrixAllocator<T>& a, const MatrixAllocator<U>& b) {
+    return a.getResource() == b.getResource() || a.getResource()->is_equal(*b.getResource());
+}
+
+template <class T, class U>
+bool operator!=(const MatrixAllocator<T>& a, const MatrixAllocator<U>& b) {
+    return !(a == b);
+}
+
+template <class Scalar>
+using MatrixBuffer = std::vector<Scalar, MatrixAllocator<Scalar>>;
+
+// Monotonic arena: allocation bumps a pointer, deallocation is free (the
+// most recent block is handed back, so stack-like temporaries reuse their
+// space). reset() rewinds the arena for the next computation and keeps the
+// memory, merged into one chunk, so a loop that does the same work every
+// iteration stops touching the upstream allocator after the first pass.
+// release() returns everything upstream. Blocks are 64-byte aligned.
+class MatrixArena : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t alignment = 64;
+
+    explicit MatrixArena(std::size_t chunkSize = 1 << 20,
+                         std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) :
+        chunkSize(std::max<std::size_t>(chunkSize, alignment)), upstream(upstream) {}
+
+    ~MatrixArena() { release(); }
+
+    MatrixArena(const MatrixArena&) = delete;
+    MatrixArena& operator=(const MatrixArena&) = delete;
+
+    void reset() {
+        if (chunks.size() > 1){
+            std::size_t total = capacity();
+            release();
+            addChunk(total);
+        }
+        if (!chunks.empty()){
+            cursor = chunks[0].data;
+            limit = cursor + chunks[0].size;
+        }
+        used = 0;
+    }
+
+    void release() {
+        for (const Chunk& chunk : chunks)
+            upstream->deallocate(chunk.data, chunk.size, alignment);
+        chunks.clear();
+        cursor = limit = nullptr;
+        used = 0;
+    }
+
+    // Bytes handed out since the last reset() and bytes held from upstream.
+    std::size_t getUsed() const { return used; }
+    std::size_t capacity() const {
+        std::size_t total = 0;
+        for (const Chunk& chunk : chunks)
+            total += chunk.size;
+        return total;
+    }
+
+private:
+    struct Chunk {
+        char* data;
+        std::size_t size;
+    };
+
+    static std::size_t roundUp(std::size_t n, std::size_t a) {
+        return (n + a - 1) / a * a;
+    }
+
+    void addChunk(std::size_t size) {
+        size = roundUp(size, alignment);
+        char* data = static_cast<char*>(upstream->allocate(size, alignment));
+        chunks.push_back(Chunk{data, size});
+        cursor = data;
+        limit = data + size;
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        align = std::max(align, alignment);
+        bytes = std::max<std::size_t>(bytes, 1);
+        std::size_t offset = roundUp((std::size_t)cursor, align) - (std::size_t)cursor;
+        if (!cursor || offset + bytes > (std::size_t)(limit - cursor)){
+            // Chunks grow geometrically so large computations need few of them.
+            std::size_t next = std::max(chunkSize, chunks.empty() ? 0 : chunks.back().size * 2);
+            addChunk(std::max(next, bytes + align));
+            offset = roundUp((std::size_t)cursor, align) - (std::size_t)cursor;
+        }
+        char* p = cursor + offset;
+        cursor = p + bytes;
+        used += bytes;
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t) override {
+        bytes = std::max<std::size_t>(bytes, 1);
+        if (static_cast<char*>(p) + bytes == cursor){
+            cursor = static_cast<char*>(p);
+            used -= bytes;
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::vector<Chunk> chunks;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    std::size_t used = 0;
+    std::size_t chunkSize;
+    std::pmr::memory_resource* upstream;
+};
+
+// Size-class pool: freed buffers are kept on per-class free lists and
+// reused by later requests of a similar size. Classes run from 64 bytes up
+// to maxPooled in quarter-octave steps (64, 80, 96, 112, 128, 160, ...), so
+// at most a quarter of a block is wasted while matrices of slightly
+// different shapes still share blocks. Larger requests go straight
+// upstream. release() returns all pooled memory. Blocks are 64-byte aligned.
+class MatrixPool : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t alignment = 64;
+
+    explicit MatrixPool(std::size_t maxPooled = 1 << 24,
+                        std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) :
+        maxPooled(std::max<std::size_t>(maxPooled, alignment)), upstream(upstream),
+        freeLists(sizeClass(this->maxPooled) + 1, nullptr) {}
+
+    ~MatrixPool() { release(); }
+
+    MatrixPool(const MatrixPool&) = delete;
+    MatrixPool& operator=(const MatrixPool&) = delete;
+
+    // Frees every pooled block. Blocks still in use must not be returned
+    // to the pool afterwards.
+    void release() {
+        for (const Block& block : blocks)
+            upstream->deallocate(block.data, block.size, alignment);
+        blocks.clear();
+        std::fill(freeLists.begin(), freeLists.end(), nullptr);
+    }
+
+    // Bytes held from upstream by pooled blocks, in use or free.
+    std::size_t capacity() const {
+        std::size_t total = 0;
+        for (const Block& block : blocks)
+            total += block.size;
+        return total;
+    }
+
+    static unsigned sizeClass(std::size_t bytes) {
+        if (bytes <= 64)
+            return 0;
+        std::size_t n = bytes - 1;
+        unsigned octave = 0;
+        while (n >> (octave + 1))
+            octave++;
+        std::size_t step = std::size_t(1) << (octave - 2);
+        unsigned sub = (unsigned)((n - (std::size_t(1) << octave)) / step);
+        return (octave - 6) * 4 + sub + 1;
+    }
+
+    static std::size_t classSize(unsigned c) {
+        if (c == 0)
+            return 64;
+        unsigned octave = 6 + (c - 1) / 4;
+        return (std::size_t(1) << octave) + ((c - 1) % 4 + 1) * (std::size_t(1) << (octave - 2));
+    }
+
+private:
+    struct Block {
+        void* data;
+        std::size_t size;
+    };
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        if (bytes > maxPooled || align > alignment)
+            return upstream->allocate(bytes, std::max(align, alignment));
+        unsigned c = sizeClass(bytes);
+        if (FreeBlock* block = freeLists[c]){
+            freeLists[c] = block->next;
+            return block;
+        }
+        std::size_t size = classSize(c);
+        void* data = upstream->allocate(size, alignment);
+        blocks.push_back(Block{data, size});
+        return data;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override {
+        if (bytes > maxPooled || align > alignment){
+            upstream->deallocate(p, bytes, std::max(align, alignment));
+            return;
+        }
+        unsigned c = sizeClass(bytes);
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = freeLists[c];
+        freeLists[c] = block;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::size_t maxPooled;
+    std::pmr::memory_resource* upstream;
+    std::vector<FreeBlock*> freeLists;
+    std::vector<Block> blocks;
+};
+
+#endif
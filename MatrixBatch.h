@@ -0,0 +1,414 @@
+#ifndef MATRIX_BATCH_H
+#define MATRIX_BATCH_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "MatrixAllocator.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+template <class T, unsigned W>
+struct BatchVector {
+    typedef T type __attribute__((vector_size(W * sizeof(T))));
+};
+
+template <class T>
+struct BatchVector<T, 1> {
+    typedef T type;
+};
+
+// Kernel bodies over V, which holds one element from each of W matrices
+// (W = 1: plain T, one matrix at a time). Element e of the matrix in lane
+// l of a group is at group[e * lanes + l], so a V load at
+// group + e * lanes + l reads element e of W neighbouring matrices.
+// Pivoting is done per lane with blends, so every lane follows its own row
+// exchanges without branches; the exchanges are skipped when no lane needs
+// one.
+template <class T, unsigned W>
+struct BatchLoops {
+    static constexpr unsigned lanes = 64 / sizeof(T);
+    typedef typename BatchVector<T, W>::type V;
+    typedef decltype(V() < V()) Mask;
+
+    static SIMD_INLINE void load(V& v, const T* p) { std::memcpy(&v, p, sizeof(V)); }
+    static SIMD_INLINE void store(T* p, const V& v) { std::memcpy(p, &v, sizeof(V)); }
+
+    static SIMD_INLINE void loadAbs(V& v, const T* p) {
+        load(v, p);
+        v = v < 0 ? -v : v;
+    }
+
+    static SIMD_INLINE bool any(const Mask& mask) {
+        Mask none = {};
+        return std::memcmp(&mask, &none, sizeof(Mask)) != 0;
+    }
+
+    static SIMD_INLINE void swapIf(const Mask& swap, T* p, T* q) {
+        V x, y;
+        load(x, p);
+        load(y, q);
+        store(p, swap ? y : x);
+        store(q, swap ? x : y);
+    }
+
+    // C (n x m) = A (n x k) * B (k x m), one group.
+    static SIMD_INLINE void multiply(const T* a, const T* b, T* c, unsigned n, unsigned k, unsigned m) {
+        for (unsigned l = 0; l < lanes; l += W)
+            for (unsigned i = 0; i < n; i++)
+                for (unsigned j = 0; j < m; j++){
+                    V sum = {};
+                    for (unsigned p = 0; p < k; p++){
+                        V x, y;
+                        load(x, a + (i * k + p) * lanes + l);
+                        load(y, b + (p * m + j) * lanes + l);
+                        sum += x * y;
+                    }
+                    store(c + (i * m + j) * lanes + l, sum);
+                }
+    }
+
+    // Moves the row with the largest |a(i, k)|, i >= k, to row k by
+    // conditional swaps of columns from..n-1 (and of r); returns the lanes
+    // that swapped an odd number of times in odd.
+    static SIMD_INLINE void pivot(T* a, T* r, unsigned n, unsigned m, unsigned k, unsigned from, Mask& odd) {
+        V best, x;
+        loadAbs(best, a + (k * n + k) * lanes);
+        for (unsigned i = k + 1; i < n; i++){
+            loadAbs(x, a + (i * n + k) * lanes);
+            Mask swap = x > best;
+            best = swap ? x : best;
+            odd ^= swap;
+            if (!any(swap))
+                continue;
+            for (unsigned j = from; j < n; j++)
+                swapIf(swap, a + (k * n + j) * lanes, a + (i * n + j) * lanes);
+            for (unsigned j = 0; j < m; j++)
+                swapIf(swap, r + (k * m + j) * lanes, r + (i * m + j) * lanes);
+        }
+    }
+
+    // Gaussian elimination of one group of n x n matrices (destroyed);
+    // out receives one determinant per lane.
+    static SIMD_INLINE void det(T* group, T* out, unsigned n) {
+        for (unsigned l = 0; l < lanes; l += W){
+            T* a = group + l;
+            V zero = {}, one = zero + 1, det = one;
+            Mask odd = zero != zero, singular = odd;
+            for (unsigned k = 0; k < n; k++){
+                pivot(a, nullptr, n, 0, k, k, odd);
+                V p;
+                load(p, a + (k * n + k) * lanes);
+                singular |= p == 0;
+                det *= p;
+                V inverse = p == 0 ? zero : one / p;
+                for (unsigned i = k + 1; i < n; i++){
+                    V f, x, y;
+                    load(f, a + (i * n + k) * lanes);
+                    f *= inverse;
+                    for (unsigned j = k + 1; j < n; j++){
+                        load(x, a + (i * n + j) * lanes);
+                        load(y, a + (k * n + j) * lanes);
+                        store(a + (i * n + j) * lanes, x - f * y);
+                    }
+                }
+            }
+            det = odd ? -det : det;
+            store(out + l, singular ? zero : det);
+        }
+    }
+
+    // Gauss-Jordan elimination solving A X = R for one group: A (n x n) is
+    // destroyed, R (n x m) is replaced by X. Lanes with a singular A get a
+    // nonzero flag in singular.
+    static SIMD_INLINE void solve(T* group, T* rhs, T* singular, unsigned n, unsigned m) {
+        for (unsigned l = 0; l < lanes; l += W){
+            T* a = group + l;
+            T* r = rhs + l;
+            V zero = {}, one = zero + 1, flag = zero;
+            Mask odd = zero != zero;
+            for (unsigned k = 0; k < n; k++){
+                pivot(a, r, n, m, k, k, odd);
+                V p, x, y;
+                load(p, a + (k * n + k) * lanes);
+                flag = p == 0 ? one : flag;
+                V inverse = p == 0 ? zero : one / p;
+                for (unsigned j = k + 1; j < n; j++){
+                    load(x, a + (k * n + j) * lanes);
+                    store(a + (k * n + j) * lanes, x * inverse);
+                }
+                for (unsigned j = 0; j < m; j++){
+                    load(x, r + (k * m + j) * lanes);
+                    store(r + (k * m + j) * lanes, x * inverse);
+                }
+                for (unsigned i = 0; i < n; i++){
+                    if (i == k)
+                        continue;
+                    V f;
+                    load(f, a + (i * n + k) * lanes);
+                    for (unsigned j = k + 1; j < n; j++){
+                        load(x, a + (i * n + j) * lanes);
+                        load(y, a + (k * n + j) * lanes);
+                        store(a + (i * n + j) * lanes, x - f * y);
+                    }
+                    for (unsigned j = 0; j < m; j++){
+                        load(x, r + (i * m + j) * lanes);
+                        load(y, r + (k * m + j) * lanes);
+                        store(r + (i * m + j) * lanes, x - f * y);
+                    }
+                }
+            }
+            store(singular + l, flag);
+        }
+    }
+
+    static SIMD_INLINE void multiplyGroups(const T* a, const T* b, T* c, std::size_t groups,
+                                           unsigned n, unsigned k, unsigned m) {
+        for (std::size_t g = 0; g < groups; g++)
+            multiply(a + g * n * k * lanes, b + g * k * m * lanes, c + g * n * m * lanes, n, k, m);
+    }
+
+    static SIMD_INLINE void detGroups(const T* a, T* out, T* scratch, std::size_t groups, unsigned n) {
+        for (std::size_t g = 0; g < groups; g++){
+            std::memcpy(scratch, a + g * n * n * lanes, n * n * lanes * sizeof(T));
+            det(scratch, out + g * lanes, n);
+        }
+    }
+
+    // With identity set, r is overwritten with n x n identity matrices
+    // first, so the solution is the inverse.
+    static SIMD_INLINE void solveGroups(const T* a, T* r, T* singular, T* scratch, std::size_t groups,
+                                        unsigned n, unsigned m, bool identity) {
+        for (std::size_t g = 0; g < groups; g++){
+            T* rg = r + g * n * m * lanes;
+            std::memcpy(scratch, a + g * n * n * lanes, n * n * lanes * sizeof(T));
+            if (identity)
+                for (unsigned i = 0; i < n; i++)
+                    for (unsigned j = 0; j < n; j++)
+                        for (unsigned l = 0; l < lanes; l++)
+                            rg[(i * n + j) * lanes + l] = i == j ? 1 : 0;
+            solve(scratch, rg, singular + g * lanes, n, m);
+        }
+    }
+};
+
+template <class T>
+struct BatchKernels {
+    void (*multiply)(const T*, const T*, T*, std::size_t, unsigned, unsigned, unsigned);
+    void (*det)(const T*, T*, T*, std::size_t, unsigned);
+    void (*solve)(const T*, T*, T*, T*, std::size_t, unsigned, unsigned, bool);
+};
+
+template <class T>
+struct BatchScalar {
+    static BatchKernels<T> kernels() {
+        typedef BatchLoops<T, 1> L;
+        return BatchKernels<T>{L::multiplyGroups, L::detGroups, L::solveGroups};
+    }
+};
+
+#if SIMD_X86
+// Each ISA handles a whole 64-byte group per vector operation (split into
+// two or four registers below AVX-512), so the layout does not depend on
+// the ISA picked at runtime.
+#define BATCH_DEFINE_TARGET(Name, isa)                                                             \
+    template <class T>                                                                             \
+    struct Name {                                                                                  \
+        typedef BatchLoops<T, 64 / sizeof(T)> L;                                                   \
+        SIMD_TARGET(isa) static void multiply(const T* a, const T* b, T* c, std::size_t groups,    \
+                                              unsigned n, unsigned k, unsigned m) {                \
+            L::multiplyGroups(a, b, c, groups, n, k, m);                                           \
+        }                                                                                          \
+        SIMD_TARGET(isa) static void det(const T* a, T* out, T* scratch, std::size_t groups,       \
+                                         unsigned n) {                                             \
+            L::detGroups(a, out, scratch, groups, n);                                              \
+        }                                                                                          \
+        SIMD_TARGET(isa) static void solve(const T* a, T* r, T* singular, T* scratch,              \
+                                           std::size_t groups, unsigned n, unsigned m, bool id) {  \
+            L::solveGroups(a, r, singular, scratch, groups, n, m, id);                             \
+        }                                                                                          \
+        static BatchKernels<T> kernels() { return BatchKernels<T>{multiply, det, solve}; }         \
+    };
+
+BATCH_DEFINE_TARGET(BatchSse2, "sse2")
+BATCH_DEFINE_TARGET(BatchAvx2, "avx2")
+BATCH_DEFINE_TARGET(BatchAvx512, "avx512f")
+
+#undef BATCH_DEFINE_TARGET
+#endif
+
+template <class T>
+struct BatchDispatch {
+    static const BatchKernels<T>& kernels() {
+#if SIMD_X86
+        static const BatchKernels<T> table[] = {
+            BatchScalar<T>::kernels(),
+            BatchSse2<T>::kernels(),
+            BatchAvx2<T>::kernels(),
+            BatchAvx512<T>::kernels()
+        };
+        return table[(int)getSimdIsa()];
+#else
+        static const BatchKernels<T> scalar = BatchScalar<T>::kernels();
+        return scalar;
+#endif
+    }
+};
+
+// count matrices of rows x columns stored in one buffer, interleaved in
+// groups of lanes (one 64-byte vector of Scalar): group g holds matrices
+// g * lanes .. g * lanes + lanes - 1, element by element. multiply, det,
+// invert and solve run one SIMD lane per matrix over a whole group and
+// split large batches into chunks of groups for the thread pool. Unused
+// lanes of the last group are zero and are never reported.
+template <class Scalar_>
+class MatrixBatch {
+    static_assert(std::is_floating_point<Scalar_>::value, "MatrixBatch needs a floating point scalar");
+
+public:
+    typedef Scalar_ Scalar;
+
+    static constexpr unsigned lanes = BatchLoops<Scalar, 1>::lanes;
+
+    MatrixBatch() {}
+
+    MatrixBatch(unsigned count, unsigned rows, unsigned columns) :
+        storage(groupCount(count) * rows * columns * lanes, 0),
+        count(count), rows(rows), columns(columns) {}
+
+    MatrixBatch(unsigned count, unsigned size) : MatrixBatch(count, size, size) {}
+
+    unsigned getCount() const { return count; }
+    unsigned getRows() const { return rows; }
+    unsigned getColumns() const { return columns; }
+    bool isSquare() const { return rows == columns; }
+
+    Scalar* data() { return storage.data(); }
+    const Scalar* data() const { return storage.data(); }
+
+    Scalar unchecked(unsigned b, unsigned r, unsigned c) const {
+        assert(b < count && r < rows && c < columns);
+        return storage[index(b, r, c)];
+    }
+
+    Scalar operator()(unsigned b, unsigned r, unsigned c) const {
+        if (b >= count || r >= rows || c >= columns)
+            throw std::out_of_range("MatrixBatch::operator()");
+        return storage[index(b, r, c)];
+    }
+
+    Scalar& operator()(unsigned b, unsigned r, unsigned c) {
+        if (b >= count || r >= rows || c >= columns)
+            throw std::out_of_range("MatrixBatch::operator()");
+        return storage[index(b, r, c)];
+    }
+
+    void set(unsigned b, const AbstractMatrix<Scalar>& m) {
+        if (b >= count)
+            throw std::out_of_range("MatrixBatch::set");
+        if (m.getRows() != rows || m.getColumns() != columns)
+            throw std::runtime_error("Wrong size");
+        const Scalar* p = m.data();
+        for (unsigned e = 0; e < rows * columns; e++)
+            storage[index(b, e)] = p[e];
+    }
+
+    Matrix<Scalar> get(unsigned b) const {
+        if (b >= count)
+            throw std::out_of_range("MatrixBatch::get");
+        MatrixBuffer<Scalar> elements(rows * columns);
+        for (unsigned e = 0; e < rows * columns; e++)
+            elements[e] = storage[index(b, e)];
+        return Matrix<Scalar>(rows, columns, std::move(elements));
+    }
+
+    // Matrix b of the result is this(b) * m(b).
+    MatrixBatch operator*(const MatrixBatch& m) const {
+        if (count != m.count || columns != m.rows)
+            throw std::runtime_error("Wrong size");
+        MatrixBatch result(count, rows, m.columns);
+        const BatchKernels<Scalar>& kernels = BatchDispatch<Scalar>::kernels();
+        std::size_t inSize = (std::size_t)rows * columns * lanes, otherSize = (std::size_t)m.rows * m.columns * lanes;
+        std::size_t outSize = (std::size_t)rows * m.columns * lanes;
+        forGroups((unsigned long long)rows * columns * m.columns, [&](unsigned lo, unsigned hi) {
+            kernels.multiply(data() + lo * inSize, m.data() + lo * otherSize, result.data() + lo * outSize,
+                             hi - lo, rows, columns, m.columns);
+        });
+        return result;
+    }
+
+    // Determinant of every matrix; 0 for singular ones.
+    MatrixBuffer<Scalar> det() const {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        MatrixBuffer<Scalar> out(groupCount(count) * lanes);
+        const BatchKernels<Scalar>& kernels = BatchDispatch<Scalar>::kernels();
+        std::size_t size = (std::size_t)rows * rows * lanes;
+        forGroups((unsigned long long)rows * rows * rows / 3, [&](unsigned lo, unsigned hi) {
+            MatrixBuffer<Scalar> scratch(size);
+            kernels.det(data() + lo * size, out.data() + lo * lanes, scratch.data(), hi - lo, rows);
+        });
+        out.resize(count);
+        return out;
+    }
+
+    // Solves this(b) * x(b) = rhs(b) for every b. Throws if any matrix is
+    // singular.
+    MatrixBatch solve(const MatrixBatch& rhs) const {
+        if (count != rhs.count || rows != rhs.rows)
+            throw std::runtime_error("Wrong size");
+        MatrixBatch result(rhs);
+        solveInto(result, false);
+        return result;
+    }
+
+    MatrixBatch invert() const {
+        MatrixBatch result(count, rows, columns);
+        solveInto(result, true);
+        return result;
+    }
+
+private:
+    static std::size_t groupCount(unsigned count) { return (count + lanes - 1) / lanes; }
+
+    void solveInto(MatrixBatch& result, bool identity) const {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        MatrixBuffer<Scalar> singular(groupCount(count) * lanes);
+        const BatchKernels<Scalar>& kernels = BatchDispatch<Scalar>::kernels();
+        std::size_t size = (std::size_t)rows * rows * lanes, resultSize = (std::size_t)rows * result.columns * lanes;
+        forGroups((unsigned long long)rows * rows * (rows + result.columns), [&](unsigned lo, unsigned hi) {
+            MatrixBuffer<Scalar> scratch(size);
+            kernels.solve(data() + lo * size, result.data() + lo * resultSize, singular.data() + lo * lanes,
+                          scratch.data(), hi - lo, rows, result.columns, identity);
+        });
+        for (unsigned b = 0; b < count; b++)
+            if (singular[b] != 0)
+                throw std::runtime_error("Singular matrix");
+    }
+
+    std::size_t index(unsigned b, unsigned e) const {
+        return ((std::size_t)(b / lanes) * rows * columns + e) * lanes + b % lanes;
+    }
+
+    std::size_t index(unsigned b, unsigned r, unsigned c) const { return index(b, r * columns + c); }
+
+    // Calls f(lo, hi) over ranges of groups, in parallel when the batch is
+    // large enough; flops is the work per matrix.
+    template <class F>
+    void forGroups(unsigned long long flops, F f) const {
+        unsigned groups = groupCount(count);
+        ThreadPool& pool = ThreadPool::global();
+        unsigned long long work = flops * groups * lanes;
+        unsigned grain = pool.useParallel(work) ? 1 + 16384ull * groups / (work + 1) : groups;
+        pool.parallelFor(0, groups, grain, f);
+    }
+
+    MatrixBuffer<Scalar> storage;
+    unsigned count = 0, rows = 0, columns = 0;
+};
+
+#endif
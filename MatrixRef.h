@@ -0,0 +1,50 @@
+#ifndef MATRIX_REF_H
+#define MATRIX_REF_H
+
+#include <cassert>
+
+// Non-owning, stride-aware reference to a row-major block of elements.
+// Element access is neither virtual nor range checked; indices are only
+// verified by assertions in debug builds. Use MatrixRef<const Scalar> for
+// read-only access.
+template <class Scalar>
+class MatrixRef {
+public:
+    MatrixRef() {}
+
+    MatrixRef(Scalar* data, unsigned rows, unsigned columns) :
+        pointer(data), rows(rows), columns(columns), stride(columns) {}
+
+    MatrixRef(Scalar* data, unsigned rows, unsigned columns, unsigned stride) :
+        pointer(data), rows(rows), columns(columns), stride(stride) {}
+
+    template <class Other>
+    MatrixRef(const MatrixRef<Other>& m) :
+        pointer(m.data()), rows(m.getRows()), columns(m.getColumns()), stride(m.getStride()) {}
+
+    Scalar* data() const { return pointer; }
+    unsigned getRows() const { return rows; }
+    unsigned getColumns() const { return columns; }
+    unsigned getStride() const { return stride; }
+
+    Scalar* row(unsigned r) const {
+        assert(r < rows);
+        return pointer + (unsigned long long)r * stride;
+    }
+
+    Scalar& operator()(unsigned r, unsigned c) const {
+        assert(r < rows && c < columns);
+        return pointer[(unsigned long long)r * stride + c];
+    }
+
+    MatrixRef block(unsigned r, unsigned c, unsigned blockRows, unsigned blockColumns) const {
+        assert(r + blockRows <= rows && c + blockColumns <= columns);
+        return MatrixRef(pointer + (unsigned long long)r * stride + c, blockRows, blockColumns, stride);
+    }
+
+private:
+    Scalar* pointer = nullptr;
+    unsigned rows = 0, columns = 0, stride = 0;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef MATRIX_STORAGE_H
+#define MATRIX_STORAGE_H
+
+#include "MatrixAllocator.h"
+#include <atomic>
+#include <memory>
+
+// Element storage of Matrix, SquareMatrix and Vector. By default it owns a
+// MatrixBuffer and copies are deep. After share() the buffer is reference
+// counted: copies of the matrix, of those copies, and conversions between
+// the three classes (including transpone() of a Vector) take O(1) and
+// reference the same elements. Any non-const access to the elements, such
+// as operator()(r, c), a non-const iterator, data() or an update operator,
+// first gives the matrix a private buffer again, copying it if it is still
+// referenced elsewhere, so written copies never affect each other; call
+// share() again to resume sharing.
+//
+// Copies may be made, read and written on different threads; the count is
+// atomic, and a buffer is only written once it has a single owner. Read
+// through const references (or std::as_const) to avoid detaching a shared
+// matrix just to read it. Pointers and references obtained from non-const
+// access before share() must not be used to write afterwards, since they
+// would write into every copy.
+template <class Scalar>
+class MatrixStorage {
+public:
+    MatrixStorage() {}
+    MatrixStorage(std::size_t size, const Scalar& value) : owned(size, value) {}
+    MatrixStorage(MatrixBuffer<Scalar> values) : owned(std::move(values)) {}
+
+    MatrixStorage(const MatrixStorage& s) : shared(s.shared) {
+        if (shared)
+            shared->count.fetch_add(1, std::memory_order_relaxed);
+        else
+            owned = s.owned;
+    }
+
+    MatrixStorage(MatrixStorage&& s) noexcept : owned(std::move(s.owned)), shared(s.shared) {
+        s.shared = nullptr;
+    }
+
+    ~MatrixStorage() { release(); }
+
+    MatrixStorage& operator=(const MatrixStorage& s) {
+        if (this != &s){
+            if (s.shared){
+                s.shared->count.fetch_add(1, std::memory_order_relaxed);
+                release();
+                owned.clear();
+                owned.shrink_to_fit();
+            }
+            else{
+                owned = s.owned;
+                release();
+            }
+            shared = s.shared;
+        }
+        return *this;
+    }
+
+    MatrixStorage& operator=(MatrixStorage&& s) noexcept {
+        if (this != &s){
+            release();
+            owned = std::move(s.owned);
+            shared = s.shared;
+            s.shared = nullptr;
+        }
+        return *this;
+    }
+
+    MatrixStorage& operator=(MatrixBuffer<Scalar> values) {
+        owned = std::move(values);
+        release();
+        shared = nullptr;
+        return *this;
+    }
+
+    // Switches to the shared buffer mode; O(1).
+    void share() {
+        if (shared)
+            return;
+        MatrixAllocator<Shared> allocator(owned.get_allocator());
+        Shared* s = allocator.allocate(1);
+        new (s) Shared(std::move(owned));
+        shared = s;
+    }
+
+    bool isShared() const { return shared != nullptr; }
+
+    // Number of matrices referencing the elements; 1 unless shared.
+    long useCount() const { return shared ? shared->count.load(std::memory_order_relaxed) : 1; }
+
+    std::size_t size() const { return shared ? shared->values.size() : owned.size(); }
+    bool empty() const { return size() == 0; }
+
+    const Scalar* data() const { return shared ? shared->values.data() : owned.data(); }
+    Scalar* data() { return buffer().data(); }
+
+    const Scalar& operator[](std::size_t i) const { return data()[i]; }
+    Scalar& operator[](std::size_t i) { return buffer()[i]; }
+
+    // The private buffer, for code that rebuilds the elements in place.
+    MatrixBuffer<Scalar>& buffer() {
+        if (shared)
+            detach();
+        return owned;
+    }
+
+    // Builds the new elements before releasing the old ones, which the
+    // range may point into.
+    template <class Iterator>
+    void assign(Iterator first, Iterator last) {
+        if (shared){
+            MatrixBuffer<Scalar> values(first, last);
+            owned = std::move(values);
+            release();
+            shared = nullptr;
+        }
+        else
+            owned.assign(first, last);
+    }
+
+private:
+    struct Shared {
+        explicit Shared(MatrixBuffer<Scalar>&& values) : values(std::move(values)) {}
+
+        std::atomic<long> count{1};
+        MatrixBuffer<Scalar> values;
+    };
+
+    // A sole owner takes the buffer back without copying: no other matrix
+    // can gain a reference while this one is being written, and the
+    // acquire load orders the reads of owners that have let go before the
+    // writes to come.
+    void detach() {
+        if (shared->count.load(std::memory_order_acquire) == 1){
+            owned = std::move(shared->values);
+            destroy(shared);
+        }
+        else{
+            owned.assign(shared->values.begin(), shared->values.end());
+            release();
+        }
+        shared = nullptr;
+    }
+
+    void release() {
+        if (shared && shared->count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            destroy(shared);
+    }
+
+    static void destroy(Shared* s) {
+        MatrixAllocator<Shared> allocator(s->values.get_allocator());
+        s->~Shared();
+        allocator.deallocate(s, 1);
+    }
+
+    MatrixBuffer<Scalar> owned;
+    Shared* shared = nullptr;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef MATRIX_VIEW_H
+#define MATRIX_VIEW_H
+
+#include "AbstractMatrix.h"
+#include "Expression.h"
+#include "Gemm.h"
+#include "Strassen.h"
+#include <type_traits>
+
+template <class Scalar_> class VectorView;
+
+// Non-owning, strided window onto row-major elements: a block of a matrix,
+// or any rows x columns slice of a larger buffer. Views are expressions, so
+// they take part in +, -, scalar * and operator<< without copying, and they
+// are passed to the multiply engine with their stride. Assigning to a view
+// writes through to the viewed elements; use MatrixView<const Scalar> for
+// read-only access. A view must not outlive the storage it refers to, and
+// must not partially overlap an operand of an expression assigned to it.
+template <class Scalar_>
+class MatrixView : public MatrixExpression<MatrixView<Scalar_>> {
+public:
+    typedef typename std::remove_const<Scalar_>::type Scalar;
+
+    MatrixView(Scalar_* data, unsigned rows, unsigned columns, unsigned stride) :
+        elements(data, rows, columns, stride) {}
+
+    MatrixView(Scalar_* data, unsigned rows, unsigned columns) :
+        elements(data, rows, columns) {}
+
+    MatrixView(const MatrixRef<Scalar_>& ref) : elements(ref) {}
+
+    template <class Other>
+    MatrixView(const MatrixView<Other>& v) : elements(v.ref()) {}
+
+    MatrixView(const MatrixView& v) = default;
+
+    unsigned getRows() const { return elements.getRows(); }
+    unsigned getColumns() const { return elements.getColumns(); }
+    unsigned getStride() const { return elements.getStride(); }
+    Scalar_* data() const { return elements.data(); }
+    MatrixRef<Scalar_> ref() const { return elements; }
+
+    Scalar at(unsigned r, unsigned c) const { return elements(r, c); }
+
+    Scalar_& operator()(unsigned r, unsigned c) const {
+        if (r >= getRows() || c >= getColumns())
+            throw std::out_of_range("MatrixView::operator()");
+        return elements(r, c);
+    }
+
+    MatrixView block(unsigned r, unsigned c, unsigned rows, unsigned columns) const {
+        if (r > getRows() || c > getColumns() || rows > getRows() - r || columns > getColumns() - c)
+            throw std::out_of_range("MatrixView::block");
+        return MatrixView(elements.block(r, c, rows, columns));
+    }
+
+    VectorView<Scalar_> rowView(unsigned r) const {
+        if (r >= getRows())
+            throw std::out_of_range("MatrixView::rowView");
+        return VectorView<Scalar_>(elements.row(r), getColumns(), 1, false);
+    }
+
+    VectorView<Scalar_> columnView(unsigned c) const {
+        if (c >= getColumns())
+            throw std::out_of_range("MatrixView::columnView");
+        return VectorView<Scalar_>(data() + c, getRows(), getStride(), true);
+    }
+
+    VectorView<Scalar_> diagonal() const {
+        return VectorView<Scalar_>(data(), std::min(getRows(), getColumns()), getStride() + 1, true);
+    }
+
+    const MatrixView& operator=(const MatrixView& v) const {
+        return *this = static_cast<const MatrixExpression<MatrixView>&>(v);
+    }
+
+    template <class E>
+    const MatrixView& operator=(const MatrixExpression<E>& e) const {
+        update<ExpressionAssign>(e);
+        return *this;
+    }
+
+    const MatrixView& operator=(const AbstractMatrix<Scalar>& m) const {
+        update<ExpressionAssign>(MatrixOperand<Scalar>(m));
+        return *this;
+    }
+
+    template <class E>
+    const MatrixView& operator+=(const MatrixExpression<E>& e) const {
+        update<ExpressionPlus>(e);
+        return *this;
+    }
+
+    const MatrixView& operator+=(const AbstractMatrix<Scalar>& m) const {
+        update<ExpressionPlus>(MatrixOperand<Scalar>(m));
+        return *this;
+    }
+
+    template <class E>
+    const MatrixView& operator-=(const MatrixExpression<E>& e) const {
+        update<ExpressionMinus>(e);
+        return *this;
+    }
+
+    const MatrixView& operator-=(const AbstractMatrix<Scalar>& m) const {
+        update<ExpressionMinus>(MatrixOperand<Scalar>(m));
+        return *this;
+    }
+
+    const MatrixView& operator*=(const Scalar& c) const {
+        static_assert(!std::is_const<Scalar_>::value, "Cannot write through a read-only view");
+        for (unsigned r = 0; r < getRows(); r++)
+            simdScale(elements.row(r), c, getColumns());
+        return *this;
+    }
+
+private:
+    template <class Op, class E>
+    void update(const MatrixExpression<E>& e) const {
+        static_assert(!std::is_const<Scalar_>::value, "Cannot write through a read-only view");
+        if (getRows() != e.self().getRows() || getColumns() != e.self().getColumns())
+            throw std::runtime_error("Wrong size");
+        updateExpression<Op>(data(), getStride(), e);
+    }
+
+    MatrixRef<Scalar_> elements;
+};
+
+// Non-owning view of size elements spaced increment apart: a row, column or
+// diagonal of a matrix. It acts as a 1 x size (horizontal) or size x 1
+// (vertical) matrix in expressions and products.
+template <class Scalar_>
+class VectorView : public MatrixExpression<VectorView<Scalar_>> {
+public:
+    typedef typename std::remove_const<Scalar_>::type Scalar;
+
+    VectorView(Scalar_* data, unsigned size, unsigned increment = 1, bool vertical = true) :
+        pointer(data), size(size), increment(increment), vertical(vertical) {}
+
+    template <class Other>
+    VectorView(const VectorView<Other>& v) :
+        pointer(v.data()), size(v.getSize()), increment(v.getIncrement()), vertical(v.isVertical()) {}
+
+    VectorView(const VectorView& v) = default;
+
+    unsigned getSize() const { return size; }
+    unsigned getIncrement() const { return increment; }
+    bool isVertical() const { return vertical; }
+    unsigned getRows() const { return vertical ? size : 1; }
+    unsigned getColumns() const { return vertical ? 1 : size; }
+    Scalar_* data() const { return pointer; }
+
+    // One of r and c is always 0.
+    Scalar at(unsigned r, unsigned c) const { return pointer[(std::size_t)(r + c) * increment]; }
+
+    Scalar_& operator[](unsigned i) const {
+        assert(i < size);
+        return pointer[(std::size_t)i * increment];
+    }
+
+    Scalar_& operator()(unsigned i) const {
+        if (i >= size)
+            throw std::out_of_range("VectorView::operator()");
+        return pointer[(std::size_t)i * increment];
+    }
+
+    VectorView transpone() const { return VectorView(pointer, size, increment, !vertical); }
+
+    // The view as a matrix block, when its layout allows one: vertical
+    // views use the increment as row stride, horizontal ones must be
+    // contiguous.
+    bool hasRef() const { return vertical || increment == 1 || size <= 1; }
+
+    MatrixRef<Scalar_> ref() const {
+        assert(hasRef());
+        if (vertical)
+            return MatrixRef<Scalar_>(pointer, size, 1, increment);
+        return MatrixRef<Scalar_>(pointer, 1, size, size);
+    }
+
+    const VectorView& operator=(const VectorView& v) const {
+        return *this = static_cast<const MatrixExpression<VectorView>&>(v);
+    }
+
+    template <class E>
+    const VectorView& operator=(const MatrixExpression<E>& e) const {
+        update<ExpressionAssign>(e);
+        return *this;
+    }
+
+    const VectorView& operator=(const AbstractMatrix<Scalar>& m) const {
+        update<ExpressionAssign>(MatrixOperand<Scalar>(m));
+        return *this;
+    }
+
+    template <class E>
+    const VectorView& operator+=(const MatrixExpression<E>& e) const {
+        update<ExpressionPlus>(e);
+        return *this;
+    }
+
+    const VectorView& operator+=(const AbstractMatrix<Scalar>& m) const {
+        update<ExpressionPlus>(MatrixOperand<Scalar>(m));
+        return *this;
+    }
+
+    template <class E>
+    const VectorView& operator-=(const MatrixExpression<E>& e) const {
+        update<ExpressionMinus>(e);
+        return *this;
+    }
+
+    const VectorView& operator-=(const AbstractMatrix<Scalar>& m) const {
+        update<ExpressionMinus>(MatrixOperand<Scalar>(m));
+        return *this;
+    }
+
+    const VectorView& operator*=(const Scalar& c) const {
+        static_assert(!std::is_const<Scalar_>::value, "Cannot write through a read-only view");
+        if (increment == 1)
+            simdScale(pointer, c, size);
+        else
+            for (unsigned i = 0; i < size; i++)
+                pointer[(std::size_t)i * increment] *= c;
+        return *this;
+    }
+
+private:
+    template <class Op, class E>
+    void update(const MatrixExpression<E>& e) const {
+        static_assert(!std::is_const<Scalar_>::value, "Cannot write through a read-only view");
+        if (getRows() != e.self().getRows() || getColumns() != e.self().getColumns())
+            throw std::runtime_error("Wrong size");
+        const E& x = e.self();
+        for (unsigned i = 0; i < size; i++){
+            Scalar& element = pointer[(std::size_t)i * increment];
+            element = Op::apply(element, vertical ? x.at(i, 0) : x.at(0, i));
+        }
+    }
+
+    Scalar_* pointer;
+    unsigned size, increment;
+    bool vertical;
+};
+
+// Operands of a product: matrices and views are used in place, with their
+// stride; a horizontal view with an increment is gathered into a buffer.
+template <class Scalar>
+struct ProductOperand {
+    ProductOperand(const AbstractMatrix<Scalar>& m) : elements(m.ref()) {}
+
+    template <class S>
+    ProductOperand(const MatrixView<S>& v) : elements(v.ref()) {}
+
+    template <class S>
+    ProductOperand(const VectorView<S>& v) {
+        if (v.hasRef())
+            elements = v.ref();
+        else{
+            copy.resize(v.getSize());
+            for (unsigned i = 0; i < v.getSize(); i++)
+                copy[i] = v[i];
+            elements = MatrixRef<const Scalar>(copy.data(), 1, v.getSize());
+        }
+    }
+
+    MatrixRef<const Scalar> elements;
+    MatrixBuffer<Scalar> copy;
+};
+
+template <class T, class Enable = void>
+struct ProductTraits {
+    static const bool isView = false;
+    static const bool isMatrix = false;
+    typedef void Scalar;
+};
+
+template <class S>
+struct ProductTraits<MatrixView<S>> {
+    static const bool isView = true;
+    static const bool isMatrix = false;
+    typedef typename MatrixView<S>::Scalar Scalar;
+};
+
+template <class S>
+struct ProductTraits<VectorView<S>> {
+    static const bool isView = true;
+    static const bool isMatrix = false;
+    typedef typename VectorView<S>::Scalar Scalar;
+};
+
+template <class T>
+struct ProductTraits<T, typename std::enable_if<
+        std::is_base_of<AbstractMatrix<typename T::Scalar>, T>::value>::type> {
+    static const bool isView = false;
+    static const bool isMatrix = true;
+    typedef typename T::Scalar Scalar;
+};
+
+template <class Scalar>
+Matrix<Scalar> viewProduct(const MatrixRef<const Scalar>& a, const MatrixRef<const Scalar>& b) {
+    if (a.getColumns() != b.getRows())
+        throw std::runtime_error("Wrong size");
+    MatrixBuffer<Scalar> elements(a.getRows() * b.getColumns(), 0);
+    if (!elements.empty() && a.getColumns() != 0)
+        multiplyInto(a.getRows(), b.getColumns(), a.getColumns(), a.data(), a.getStride(),
+                     b.data(), b.getStride(), elements.data(), b.getColumns());
+    return Matrix<Scalar>(a.getRows(), b.getColumns(), std::move(elements));
+}
+
+// view * view, view * matrix and matrix * view multiply in place; products
+// of two matrices keep their member operators.
+template <class A, class B>
+typename std::enable_if<(ProductTraits<A>::isView || ProductTraits<B>::isView) &&
+        (ProductTraits<A>::isView || ProductTraits<A>::isMatrix) &&
+        (ProductTraits<B>::isView || ProductTraits<B>::isMatrix) &&
+        std::is_same<typename ProductTraits<A>::Scalar, typename ProductTraits<B>::Scalar>::value,
+    Matrix<typename ProductTraits<A>::Scalar>>::type
+operator*(const A& a, const B& b) {
+    typedef typename ProductTraits<A>::Scalar Scalar;
+    return viewProduct(ProductOperand<Scalar>(a).elements, ProductOperand<Scalar>(b).elements);
+}
+
+#endif
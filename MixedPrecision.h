@@ -0,0 +1,203 @@
+#ifndef MIXED_PRECISION_H
+#define MIXED_PRECISION_H
+
+#include "AbstractMatrix.h"
+#include "Gemm.h"
+#include "LU.h"
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+template <class Scalar> class Matrix;
+template <class Scalar> class Vector;
+
+struct RefinementOptions {
+    unsigned maxIterations = 30;
+    // Refinement stops when ||r|| <= ||x|| ||A|| eps sqrt(n) (infinity
+    // norms, eps of the working precision), and gives up when an
+    // iteration does not at least halve ||r||.
+    double stagnation = 0.5;
+};
+
+struct RefinementResult {
+    unsigned iterations = 0;        // refinement steps after the first solve
+    bool fullPrecision = false;     // solved by the fallback LU in Scalar
+};
+
+// LU decomposition for solving in Scalar (double) at about the speed of
+// Low (float): A is factored in Low, and every solve starts from the Low
+// solution and refines it with residuals b - A x computed in Scalar, each
+// correction again solved with the Low factors. For well-conditioned A
+// this reaches Scalar accuracy in a few O(n^2) steps. If A does not fit in
+// Low, its Low factors are singular, or refinement stagnates, the solve
+// falls back to an LU in Scalar, factored on first use and kept.
+//
+// det() comes from the Low factors (or the Scalar ones once they exist),
+// so it has Low accuracy: refinement improves solutions, not
+// determinants. invert() refines all n columns at once, which costs a
+// product in Scalar per iteration and so saves less than solve().
+template <class Scalar, class Low = float>
+class MixedPrecisionLU {
+public:
+    template <class Other>
+    explicit MixedPrecisionLU(const AbstractMatrix<Other>& m, RefinementOptions options = RefinementOptions()) :
+        options(options) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        size = m.getRows();
+        a.assign(m.begin(), m.end());
+        MatrixBuffer<Low> low(a.size());
+        for (unsigned i = 0; i < size; i++){
+            Scalar sum = 0;
+            for (unsigned j = 0; j < size; j++){
+                Scalar v = a[(std::size_t)i * size + j];
+                sum += std::abs(v);
+                low[(std::size_t)i * size + j] = (Low)v;
+            }
+            norm = std::max(norm, sum);
+        }
+        if (!(norm <= (Scalar)std::numeric_limits<Low>::max()))
+            factorFull();
+        else{
+            lowFactors.reset(new LU<Low>(size, std::move(low)));
+            if (lowFactors->isSingular())
+                factorFull();
+        }
+    }
+
+    MixedPrecisionLU(const MixedPrecisionLU&) = delete;
+    MixedPrecisionLU& operator=(const MixedPrecisionLU&) = delete;
+
+    unsigned getSize() const { return size; }
+    bool isSingular() const { return full() ? full()->isSingular() : lowFactors->isSingular(); }
+
+    // Whether solves already go straight to the LU in Scalar.
+    bool usesFullPrecision() const { return full() != nullptr; }
+
+    Scalar det() const {
+        if (const LU<Scalar>* f = full())
+            return f->det();
+        const MatrixBuffer<Low>& factors = lowFactors->getFactors();
+        const std::vector<unsigned>& pivots = lowFactors->getPivots();
+        Scalar det = 1;
+        for (unsigned i = 0; i < size; i++){
+            det *= (Scalar)factors[(std::size_t)i * size + i];
+            if (pivots[i] != i)
+                det = -det;
+        }
+        return det;
+    }
+
+    Matrix<Scalar> invert(RefinementResult* result = nullptr) const {
+        MatrixBuffer<Scalar> r((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            r[(std::size_t)i * size + i] = 1;
+        RefinementResult stats = solveInPlace(r.data(), size);
+        if (result)
+            *result = stats;
+        return Matrix<Scalar>(size, size, std::move(r));
+    }
+
+    Vector<Scalar> solve(const Vector<Scalar>& b, RefinementResult* result = nullptr) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        RefinementResult stats = solveInPlace(x.data(), 1);
+        if (result)
+            *result = stats;
+        return Vector<Scalar>(size, b.getRows() != 1, std::move(x));
+    }
+
+    Matrix<Scalar> solve(const AbstractMatrix<Scalar>& b, RefinementResult* result = nullptr) const {
+        if (b.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> x(b.begin(), b.end());
+        RefinementResult stats = solveInPlace(x.data(), b.getColumns());
+        if (result)
+            *result = stats;
+        return Matrix<Scalar>(size, b.getColumns(), std::move(x));
+    }
+
+    // Overwrites the row-major size x columns block b with A^-1 * b.
+    RefinementResult solveInPlace(Scalar* b, unsigned columns) const {
+        RefinementResult result;
+        if (size == 0 || columns == 0)
+            return result;
+        if (const LU<Scalar>* f = full()){
+            f->solveInPlace(b, columns);
+            result.fullPrecision = true;
+            return result;
+        }
+        std::size_t count = (std::size_t)size * columns;
+        MatrixBuffer<Scalar> rhs(b, b + count), residual(count), product(count);
+        MatrixBuffer<Low> correction(count);
+        Scalar* x = b;
+        lowSolve(x, correction.data(), columns);
+        const Scalar threshold = norm * std::numeric_limits<Scalar>::epsilon() * std::sqrt((Scalar)size);
+        Scalar previous = std::numeric_limits<Scalar>::infinity();
+        for (;;){
+            // r = b - A x
+            std::fill(product.begin(), product.end(), Scalar(0));
+            gemm(size, columns, size, a.data(), size, x, columns, product.data(), columns);
+            Scalar residualNorm = 0;
+            for (std::size_t i = 0; i < count; i++){
+                residual[i] = rhs[i] - product[i];
+                residualNorm = std::max(residualNorm, std::abs(residual[i]));
+            }
+            Scalar solutionNorm = 0;
+            for (std::size_t i = 0; i < count; i++)
+                solutionNorm = std::max(solutionNorm, std::abs(x[i]));
+            if (residualNorm <= solutionNorm * threshold)
+                return result;
+            if (!(residualNorm <= (Scalar)options.stagnation * previous)
+                    || result.iterations == options.maxIterations)
+                break;
+            previous = residualNorm;
+            lowSolve(residual.data(), correction.data(), columns);
+            for (std::size_t i = 0; i < count; i++)
+                x[i] += residual[i];
+            result.iterations++;
+        }
+        std::copy(rhs.begin(), rhs.end(), x);
+        factorFull()->solveInPlace(x, columns);
+        result.fullPrecision = true;
+        return result;
+    }
+
+private:
+    // Overwrites v with (LU)^-1 v computed in Low; scratch holds the Low copy.
+    void lowSolve(Scalar* v, Low* scratch, unsigned columns) const {
+        std::size_t count = (std::size_t)size * columns;
+        for (std::size_t i = 0; i < count; i++)
+            scratch[i] = (Low)v[i];
+        lowFactors->solveInPlace(scratch, columns);
+        for (std::size_t i = 0; i < count; i++)
+            v[i] = (Scalar)scratch[i];
+    }
+
+    const LU<Scalar>* full() const {
+        std::lock_guard<std::mutex> guard(fullLock);
+        return fullFactors.get();
+    }
+
+    const LU<Scalar>* factorFull() const {
+        std::lock_guard<std::mutex> guard(fullLock);
+        if (!fullFactors)
+            fullFactors.reset(new LU<Scalar>(size, MatrixBuffer<Scalar>(a.begin(), a.end())));
+        return fullFactors.get();
+    }
+
+    MatrixBuffer<Scalar> a;
+    std::unique_ptr<LU<Low>> lowFactors;
+    mutable std::unique_ptr<LU<Scalar>> fullFactors;
+    mutable std::mutex fullLock;
+    RefinementOptions options;
+    Scalar norm = 0;                // ||A|| in the infinity norm
+    unsigned size = 0;
+};
+
+#include "Matrix.h"
+#include "Vector.h"
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include "MatrixRef.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+// Parallel scans of contiguous elements behind max(), min(), isZero(),
+// isDiagonal(), isIdentity(), operator== and summary() of Matrix,
+// SquareMatrix and Vector. Ranges are cut into blocks that the global pool
+// scans with the SIMD kernels; ranges below the pool's serial threshold
+// are scanned on the calling thread. Predicates share a flag that the
+// first failing block sets and every block checks before it starts, so a
+// mismatch stops the other threads within one block each.
+
+// Elements per block: large enough to amortize scheduling, small enough
+// for early exit to stop promptly.
+constexpr std::size_t reductionBlock = 1 << 16;
+
+// True if scan(lo, hi) holds for every block [lo, hi) of at most block
+// items covering [0, n). work is the number of elements behind the n
+// items, for the serial threshold.
+template <class F>
+bool parallelAll(std::size_t n, std::size_t block, unsigned long long work, F scan) {
+    ThreadPool& pool = ThreadPool::global();
+    std::size_t blocks = (n + block - 1) / block;
+    if (blocks <= 1 || !pool.useParallel(work))
+        return scan(0, n);
+    std::atomic<bool> failed{false};
+    pool.parallelFor(0, (unsigned)blocks, 1, [&](unsigned lo, unsigned hi) {
+        for (unsigned b = lo; b < hi && !failed.load(std::memory_order_relaxed); b++)
+            if (!scan(b * block, std::min(n, (b + 1) * block)))
+                failed.store(true, std::memory_order_relaxed);
+    });
+    return !failed;
+}
+
+// reduce(lo, hi) over the chunks of [0, n) (n > 0) run by the pool, folded
+// with combine in chunk order, so results only depend on the thread count.
+template <class T, class Reduce, class Combine>
+T parallelReduce(std::size_t n, Reduce reduce, Combine combine) {
+    ThreadPool& pool = ThreadPool::global();
+    std::size_t blocks = (n + reductionBlock - 1) / reductionBlock;
+    if (blocks <= 1 || !pool.useParallel(n))
+        return reduce(0, n);
+    std::vector<T> partials(blocks);
+    std::vector<char> used(blocks, 0);
+    pool.parallelFor(0, (unsigned)blocks, 1, [&](unsigned lo, unsigned hi) {
+        partials[lo] = reduce(lo * reductionBlock, std::min(n, hi * reductionBlock));
+        used[lo] = 1;
+    });
+    std::size_t first = std::find(used.begin(), used.end(), 1) - used.begin();
+    T result = partials[first];
+    for (std::size_t b = first + 1; b < blocks; b++)
+        if (used[b])
+            result = combine(result, partials[b]);
+    return result;
+}
+
+template <class Scalar>
+Scalar parallelMax(const Scalar* p, std::size_t n) {
+    return parallelReduce<Scalar>(n, [p](std::size_t lo, std::size_t hi) { return simdMax(p + lo, hi - lo); },
+                                  [](Scalar a, Scalar b) { return a < b ? b : a; });
+}
+
+template <class Scalar>
+Scalar parallelMin(const Scalar* p, std::size_t n) {
+    return parallelReduce<Scalar>(n, [p](std::size_t lo, std::size_t hi) { return simdMin(p + lo, hi - lo); },
+                                  [](Scalar a, Scalar b) { return b < a ? b : a; });
+}
+
+template <class Scalar>
+bool parallelIsZero(const Scalar* p, std::size_t n) {
+    return parallelAll(n, reductionBlock, n,
+                       [p](std::size_t lo, std::size_t hi) { return simdIsZero(p + lo, hi - lo); });
+}
+
+template <class Scalar>
+bool parallelEqual(const Scalar* a, const Scalar* b, std::size_t n) {
+    return parallelAll(n, reductionBlock, n,
+                       [a, b](std::size_t lo, std::size_t hi) { return simdEqual(a + lo, b + lo, hi - lo); });
+}
+
+// Zero off the diagonal and, if identity is set, one on it; the rows are
+// scanned in parallel blocks.
+template <class Scalar>
+bool parallelIsDiagonal(MatrixRef<const Scalar> m, bool identity) {
+    unsigned rows = m.getRows(), columns = m.getColumns();
+    std::size_t rowsPerBlock = std::max<std::size_t>(1, reductionBlock / std::max(1u, columns));
+    return parallelAll(rows, rowsPerBlock, (unsigned long long)rows * columns, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t i = lo; i < hi; i++){
+            const Scalar* row = m.row(i);
+            if (i < columns){
+                if ((identity && row[i] != Scalar(1)) || !simdIsZero(row, i)
+                        || !simdIsZero(row + i + 1, columns - i - 1))
+                    return false;
+            }
+            else if (!simdIsZero(row, columns))
+                return false;
+        }
+        return true;
+    });
+}
+
+// Statistics of all elements from one fused pass.
+template <class Scalar>
+struct MatrixSummary {
+    Scalar min, max, sum;
+    Scalar norm;                    // Frobenius norm: sqrt of the sum of squares
+};
+
+// Requires n > 0.
+template <class Scalar>
+MatrixSummary<Scalar> parallelSummary(const Scalar* p, std::size_t n) {
+    SimdSummary<Scalar> s = parallelReduce<SimdSummary<Scalar>>(n,
+        [p](std::size_t lo, std::size_t hi) { return simdSummary(p + lo, hi - lo); },
+        [](const SimdSummary<Scalar>& a, const SimdSummary<Scalar>& b) {
+            return SimdSummary<Scalar>{b.min < a.min ? b.min : a.min, a.max < b.max ? b.max : a.max,
+                                       a.sum + b.sum, a.squares + b.squares};
+        });
+    return MatrixSummary<Scalar>{s.min, s.max, s.sum, (Scalar)std::sqrt(s.squares)};
+}
+
+#endif
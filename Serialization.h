@@ -0,0 +1,278 @@
+#ifndef SERIALIZATION_H
+#define SERIALIZATION_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "MatrixAllocator.h"
+#include "MatrixView.h"
+#include "TextIO.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Binary matrix file: a 64-byte header followed by the elements in
+// row-major order, starting at dataOffset (a multiple of alignment)
+// bytes from the start of the header. Elements and header fields are
+// written in the writer's byte order; byteOrder tells a reader which
+// one that was. Readers convert between scalar types and byte orders;
+// MappedMatrix maps files in the native layout without reading them.
+struct MatrixFileHeader {
+    static constexpr std::uint32_t nativeOrder = 0x01020304;
+    static constexpr std::uint16_t currentVersion = 1;
+    static constexpr std::uint32_t defaultAlignment = 64;
+
+    char magic[8];
+    std::uint32_t byteOrder;
+    std::uint16_t version;
+    std::uint16_t headerSize;
+    char scalarKind;            // 'f' floating point, 'i' signed, 'u' unsigned
+    std::uint8_t scalarSize;
+    std::uint8_t reserved0[2];
+    std::uint32_t alignment;
+    std::uint64_t rows;
+    std::uint64_t columns;
+    std::uint64_t dataOffset;
+    std::uint8_t reserved[16];
+
+    bool swapped() const { return byteOrder != nativeOrder; }
+    std::uint64_t elements() const { return rows * columns; }
+};
+
+static_assert(sizeof(MatrixFileHeader) == 64, "MatrixFileHeader must be 64 bytes");
+
+template <class Scalar>
+struct BinaryScalar {
+    static_assert(std::is_arithmetic<Scalar>::value, "Only arithmetic scalars can be serialized");
+    static constexpr char kind = std::is_floating_point<Scalar>::value ? 'f' :
+                                 std::is_signed<Scalar>::value ? 'i' : 'u';
+    static constexpr std::uint8_t size = sizeof(Scalar);
+};
+
+template <class T>
+T byteSwapped(T value) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    std::reverse(bytes, bytes + sizeof(T));
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+template <class Scalar>
+MatrixFileHeader makeFileHeader(std::uint64_t rows, std::uint64_t columns) {
+    MatrixFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "PAMATRIX", 8);
+    h.byteOrder = MatrixFileHeader::nativeOrder;
+    h.version = MatrixFileHeader::currentVersion;
+    h.headerSize = sizeof(MatrixFileHeader);
+    h.scalarKind = BinaryScalar<Scalar>::kind;
+    h.scalarSize = BinaryScalar<Scalar>::size;
+    h.alignment = MatrixFileHeader::defaultAlignment;
+    h.rows = rows;
+    h.columns = columns;
+    h.dataOffset = sizeof(MatrixFileHeader);
+    return h;
+}
+
+// Checks the header and brings its fields into native byte order
+// (byteOrder is kept as written, so swapped() still reports the file's).
+inline MatrixFileHeader decodeFileHeader(const MatrixFileHeader& raw) {
+    MatrixFileHeader h = raw;
+    if (std::memcmp(h.magic, "PAMATRIX", 8) != 0)
+        throw std::runtime_error("Not a matrix file");
+    if (h.swapped()){
+        if (byteSwapped(h.byteOrder) != MatrixFileHeader::nativeOrder)
+            throw std::runtime_error("Not a matrix file");
+        h.version = byteSwapped(h.version);
+        h.headerSize = byteSwapped(h.headerSize);
+        h.alignment = byteSwapped(h.alignment);
+        h.rows = byteSwapped(h.rows);
+        h.columns = byteSwapped(h.columns);
+        h.dataOffset = byteSwapped(h.dataOffset);
+    }
+    if (h.version > MatrixFileHeader::currentVersion)
+        throw std::runtime_error("Unsupported matrix file version");
+    if (h.headerSize < sizeof(MatrixFileHeader) || h.dataOffset < h.headerSize)
+        throw std::runtime_error("Corrupt matrix file header");
+    if (h.rows > UINT_MAX || h.columns > UINT_MAX || (h.columns && h.rows > UINT64_MAX / h.columns))
+        throw std::runtime_error("Matrix file too large");
+    return h;
+}
+
+// Streams rows one at a time, so views and matrices larger than the
+// stream buffer are written without a copy.
+template <class Scalar>
+void writeBinary(std::ostream& out, const MatrixRef<const Scalar>& m) {
+    MatrixFileHeader h = makeFileHeader<Scalar>(m.getRows(), m.getColumns());
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    if (m.getStride() == m.getColumns())
+        out.write(reinterpret_cast<const char*>(m.data()),
+                  (std::streamsize)((std::size_t)m.getRows() * m.getColumns() * sizeof(Scalar)));
+    else
+        for (unsigned r = 0; r < m.getRows(); r++)
+            out.write(reinterpret_cast<const char*>(m.row(r)),
+                      (std::streamsize)(m.getColumns() * sizeof(Scalar)));
+    if (!out)
+        throw std::runtime_error("Write failed");
+}
+
+template <class Scalar>
+void writeBinary(std::ostream& out, const AbstractMatrix<Scalar>& m) {
+    writeBinary(out, m.ref());
+}
+
+template <class S>
+void writeBinary(std::ostream& out, const MatrixView<S>& v) {
+    typedef typename MatrixView<S>::Scalar Scalar;
+    writeBinary(out, MatrixRef<const Scalar>(v.ref()));
+}
+
+template <class M>
+void writeBinary(const std::string& path, const M& m) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot open " + path);
+    writeBinary(out, m);
+    out.close();
+    if (!out)
+        throw std::runtime_error("Write failed");
+}
+
+// Reads the header and skips to the first element.
+inline MatrixFileHeader readBinaryHeader(std::istream& in) {
+    MatrixFileHeader raw;
+    if (!in.read(reinterpret_cast<char*>(&raw), sizeof(raw)))
+        throw std::runtime_error("Not a matrix file");
+    MatrixFileHeader h = decodeFileHeader(raw);
+    if (h.dataOffset > sizeof(raw) && !in.ignore((std::streamsize)(h.dataOffset - sizeof(raw))))
+        throw std::runtime_error("Read failed");
+    return h;
+}
+
+template <class Stored, class Scalar>
+void readConverted(std::istream& in, Scalar* out, std::size_t count, bool swap) {
+    if (std::is_same<Stored, Scalar>::value && !swap){
+        if (!in.read(reinterpret_cast<char*>(out), (std::streamsize)(count * sizeof(Scalar))))
+            throw std::runtime_error("Read failed");
+        return;
+    }
+    const std::size_t chunk = 1 << 14;
+    std::vector<Stored> buffer(std::min(chunk, count));
+    for (std::size_t done = 0; done < count; done += chunk){
+        std::size_t n = std::min(chunk, count - done);
+        if (!in.read(reinterpret_cast<char*>(buffer.data()), (std::streamsize)(n * sizeof(Stored))))
+            throw std::runtime_error("Read failed");
+        for (std::size_t i = 0; i < n; i++)
+            out[done + i] = (Scalar)(swap ? byteSwapped(buffer[i]) : buffer[i]);
+    }
+}
+
+// Reads the next rows x columns elements into out, converting from the
+// stored scalar type and byte order. Call repeatedly to stream a file
+// through a buffer of a few rows.
+template <class Scalar>
+void readBinaryRows(std::istream& in, const MatrixFileHeader& h, Scalar* out, std::size_t rows) {
+    std::size_t count = rows * h.columns;
+    bool swap = h.swapped();
+    switch (h.scalarKind * 256 + h.scalarSize){
+        case 'f' * 256 + 4: readConverted<float>(in, out, count, swap); break;
+        case 'f' * 256 + 8: readConverted<double>(in, out, count, swap); break;
+        case 'i' * 256 + 1: readConverted<std::int8_t>(in, out, count, swap); break;
+        case 'i' * 256 + 2: readConverted<std::int16_t>(in, out, count, swap); break;
+        case 'i' * 256 + 4: readConverted<std::int32_t>(in, out, count, swap); break;
+        case 'i' * 256 + 8: readConverted<std::int64_t>(in, out, count, swap); break;
+        case 'u' * 256 + 1: readConverted<std::uint8_t>(in, out, count, swap); break;
+        case 'u' * 256 + 2: readConverted<std::uint16_t>(in, out, count, swap); break;
+        case 'u' * 256 + 4: readConverted<std::uint32_t>(in, out, count, swap); break;
+        case 'u' * 256 + 8: readConverted<std::uint64_t>(in, out, count, swap); break;
+        default: throw std::runtime_error("Unsupported scalar type");
+    }
+}
+
+template <class Scalar>
+Matrix<Scalar> readBinary(std::istream& in) {
+    MatrixFileHeader h = readBinaryHeader(in);
+    MatrixBuffer<Scalar> elements(h.elements());
+    readBinaryRows(in, h, elements.data(), h.rows);
+    return Matrix<Scalar>(h.rows, h.columns, std::move(elements));
+}
+
+template <class Scalar>
+Matrix<Scalar> readBinary(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open " + path);
+    return readBinary<Scalar>(in);
+}
+
+// Text files (see TextIO.h). By default values are written in the shortest
+// form that reads back exactly; pass TextFormat::csv() or a precision to
+// change that. File streams get a 1 MiB buffer.
+constexpr std::size_t textFileBuffer = 1 << 20;
+
+template <class Scalar>
+void writeText(std::ostream& out, const MatrixRef<const Scalar>& m,
+               const TextFormat& format = TextFormat::whitespace()) {
+    writeTextRows<Scalar>(out, m.getRows(), m.getColumns(),
+                          [&](unsigned i, unsigned j) { return m(i, j); }, format);
+    if (!out)
+        throw std::runtime_error("Write failed");
+}
+
+template <class Scalar>
+void writeText(std::ostream& out, const AbstractMatrix<Scalar>& m,
+               const TextFormat& format = TextFormat::whitespace()) {
+    writeText(out, m.ref(), format);
+}
+
+template <class S>
+void writeText(std::ostream& out, const MatrixView<S>& v,
+               const TextFormat& format = TextFormat::whitespace()) {
+    typedef typename MatrixView<S>::Scalar Scalar;
+    writeText(out, MatrixRef<const Scalar>(v.ref()), format);
+}
+
+template <class M>
+void writeText(const std::string& path, const M& m,
+               const TextFormat& format = TextFormat::whitespace()) {
+    std::unique_ptr<char[]> buffer(new char[textFileBuffer]);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.get(), textFileBuffer);
+    out.open(path, std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot open " + path);
+    writeText(out, m, format);
+    out.close();
+    if (!out)
+        throw std::runtime_error("Write failed");
+}
+
+template <class Scalar>
+Matrix<Scalar> readText(std::istream& in) {
+    MatrixBuffer<Scalar> elements;
+    unsigned columns;
+    unsigned rows = readTextElements(in, elements, columns);
+    return Matrix<Scalar>(rows, columns, std::move(elements));
+}
+
+template <class Scalar>
+Matrix<Scalar> readText(const std::string& path) {
+    std::unique_ptr<char[]> buffer(new char[textFileBuffer]);
+    std::ifstream in;
+    in.rdbuf()->pubsetbuf(buffer.get(), textFileBuffer);
+    in.open(path);
+    if (!in)
+        throw std::runtime_error("Cannot open " + path);
+    return readText<Scalar>(in);
+}
+
+#endif
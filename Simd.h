@@ -0,0 +1,507 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+// Elementwise kernels for contiguous buffers, plus a strided transpose
+// built from in-register W x W tile transposes. For float and double there
+// are SSE2, AVX2 and AVX-512 builds of every kernel; the widest one the CPU
+// supports is picked at runtime. Other scalar types use plain loops.
+enum class SimdIsa { Scalar, Sse2, Avx2, Avx512 };
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#define SIMD_INLINE inline __attribute__((always_inline))
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_X86 0
+#define SIMD_INLINE inline
+#endif
+
+inline SimdIsa detectSimdIsa() {
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdIsa::Avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdIsa::Avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdIsa::Sse2;
+#endif
+    return SimdIsa::Scalar;
+}
+
+// Atomic so the setting may change while kernels run on other threads;
+// kernels already dispatched finish with the instruction set they read.
+inline std::atomic<SimdIsa>& simdIsaSetting() {
+    static std::atomic<SimdIsa> isa{detectSimdIsa()};
+    return isa;
+}
+
+inline SimdIsa getSimdIsa() {
+    return simdIsaSetting().load(std::memory_order_relaxed);
+}
+
+// Restricts the kernels to the given instruction set (e.g. for
+// benchmarking); requests beyond what the CPU supports are clamped.
+inline void setSimdIsa(SimdIsa isa) {
+    SimdIsa supported = detectSimdIsa();
+    simdIsaSetting().store(isa > supported ? supported : isa, std::memory_order_relaxed);
+}
+
+inline const char* simdIsaName(SimdIsa isa) {
+    switch (isa){
+        case SimdIsa::Sse2: return "sse2";
+        case SimdIsa::Avx2: return "avx2";
+        case SimdIsa::Avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// Minimum, maximum, sum and sum of squares of a range, from one pass.
+template <class T>
+struct SimdSummary {
+    T min, max, sum, squares;
+};
+
+// Kernel bodies, written once over W-lane vectors. They are force-inlined
+// into the per-ISA entry points below, which compile them for that target.
+template <class T, unsigned W>
+struct SimdLoops {
+#if SIMD_X86
+    typedef T Vec __attribute__((vector_size(W * sizeof(T))));
+
+    // Vectors are passed by reference so no vector type crosses a call
+    // boundary with the default (non-AVX) ABI.
+    static SIMD_INLINE void load(Vec& v, const T* p) {
+        std::memcpy(&v, p, sizeof(Vec));
+    }
+
+    static SIMD_INLINE void store(T* p, const Vec& v) {
+        std::memcpy(p, &v, sizeof(Vec));
+    }
+
+    static SIMD_INLINE void add(T* a, const T* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + W <= n; i += W){
+            Vec x, y;
+            load(x, a + i);
+            load(y, b + i);
+            x += y;
+            store(a + i, x);
+        }
+        for (; i < n; i++)
+            a[i] += b[i];
+    }
+
+    static SIMD_INLINE void sub(T* a, const T* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + W <= n; i += W){
+            Vec x, y;
+            load(x, a + i);
+            load(y, b + i);
+            x -= y;
+            store(a + i, x);
+        }
+        for (; i < n; i++)
+            a[i] -= b[i];
+    }
+
+    static SIMD_INLINE void scale(T* a, T c, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + W <= n; i += W){
+            Vec x;
+            load(x, a + i);
+            x *= c;
+            store(a + i, x);
+        }
+        for (; i < n; i++)
+            a[i] *= c;
+    }
+
+    static SIMD_INLINE void negate(T* out, const T* in, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + W <= n; i += W){
+            Vec x;
+            load(x, in + i);
+            x = -x;
+            store(out + i, x);
+        }
+        for (; i < n; i++)
+            out[i] = -in[i];
+    }
+
+    // Comparison masks are OR-ed over blocks of Block elements and only
+    // inspected once per block, since extracting mask lanes is expensive.
+    static const unsigned Block = 32 * W;
+
+    template <class Mask>
+    static SIMD_INLINE bool any(const Mask& mask) {
+        for (unsigned l = 0; l < W; l++)
+            if (mask[l])
+                return true;
+        return false;
+    }
+
+    static SIMD_INLINE bool isZero(const T* p, std::size_t n) {
+        std::size_t i = 0;
+        const Vec zero = {};
+        for (; i + Block <= n; i += Block){
+            Vec x;
+            load(x, p + i);
+            auto mask = x != zero;
+            for (unsigned j = W; j < Block; j += W){
+                load(x, p + i + j);
+                mask |= x != zero;
+            }
+            if (any(mask))
+                return false;
+        }
+        for (; i < n; i++)
+            if (p[i] != 0)
+                return false;
+        return true;
+    }
+
+    static SIMD_INLINE bool equal(const T* a, const T* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + Block <= n; i += Block){
+            Vec x, y;
+            load(x, a + i);
+            load(y, b + i);
+            auto mask = x != y;
+            for (unsigned j = W; j < Block; j += W){
+                load(x, a + i + j);
+                load(y, b + i + j);
+                mask |= x != y;
+            }
+            if (any(mask))
+                return false;
+        }
+        for (; i < n; i++)
+            if (a[i] != b[i])
+                return false;
+        return true;
+    }
+
+    static SIMD_INLINE T max(const T* p, std::size_t n) {
+        T result = p[0];
+        std::size_t i = 0;
+        if (n >= W){
+            Vec acc, x;
+            load(acc, p);
+            for (i = W; i + W <= n; i += W){
+                load(x, p + i);
+                acc = acc < x ? x : acc;
+            }
+            for (unsigned l = 0; l < W; l++)
+                if (result < acc[l])
+                    result = acc[l];
+        }
+        for (; i < n; i++)
+            if (result < p[i])
+                result = p[i];
+        return result;
+    }
+
+    static SIMD_INLINE T min(const T* p, std::size_t n) {
+        T result = p[0];
+        std::size_t i = 0;
+        if (n >= W){
+            Vec acc, x;
+            load(acc, p);
+            for (i = W; i + W <= n; i += W){
+                load(x, p + i);
+                acc = x < acc ? x : acc;
+            }
+            for (unsigned l = 0; l < W; l++)
+                if (acc[l] < result)
+                    result = acc[l];
+        }
+        for (; i < n; i++)
+            if (p[i] < result)
+                result = p[i];
+        return result;
+    }
+
+    static SIMD_INLINE SimdSummary<T> summary(const T* p, std::size_t n) {
+        SimdSummary<T> s = {p[0], p[0], 0, 0};
+        std::size_t i = 0;
+        if (n >= W){
+            Vec lo, hi, sum = {}, squares = {}, x;
+            load(lo, p);
+            hi = lo;
+            for (; i + W <= n; i += W){
+                load(x, p + i);
+                lo = x < lo ? x : lo;
+                hi = hi < x ? x : hi;
+                sum += x;
+                squares += x * x;
+            }
+            for (unsigned l = 0; l < W; l++){
+                if (lo[l] < s.min)
+                    s.min = lo[l];
+                if (s.max < hi[l])
+                    s.max = hi[l];
+                s.sum += sum[l];
+                s.squares += squares[l];
+            }
+        }
+        for (; i < n; i++){
+            if (p[i] < s.min)
+                s.min = p[i];
+            if (s.max < p[i])
+                s.max = p[i];
+            s.sum += p[i];
+            s.squares += p[i] * p[i];
+        }
+        return s;
+    }
+
+    // In-register transpose of a W x W tile: stage Bit swaps bit Bit of the
+    // row index with the same bit of the column index, exchanging lanes
+    // between rows i and i | Bit. log2(W) stages swap all of them.
+    template <unsigned Bit, std::size_t... J>
+    static SIMD_INLINE void exchange(Vec& a, Vec& b, std::index_sequence<J...>) {
+        Vec low = __builtin_shufflevector(a, b, ((J & Bit) ? W + (J & ~Bit) : J)...);
+        Vec high = __builtin_shufflevector(a, b, ((J & Bit) ? W + J : (J | Bit))...);
+        a = low;
+        b = high;
+    }
+
+    template <unsigned Bit>
+    static SIMD_INLINE void transposeTile(Vec* r) {
+        if constexpr (Bit < W){
+            for (unsigned i = 0; i < W; i++)
+                if (!(i & Bit))
+                    exchange<Bit>(r[i], r[i | Bit], std::make_index_sequence<W>());
+            transposeTile<Bit * 2>(r);
+        }
+    }
+
+    // dst (cols x rows) = transpose of src (rows x cols); strides in elements.
+    static SIMD_INLINE void transpose(const T* src, std::size_t srcStride, T* dst, std::size_t dstStride,
+                                      std::size_t rows, std::size_t cols) {
+        std::size_t i = 0;
+        for (; i + W <= rows; i += W){
+            std::size_t j = 0;
+            for (; j + W <= cols; j += W){
+                Vec r[W];
+                for (unsigned k = 0; k < W; k++)
+                    load(r[k], src + (i + k) * srcStride + j);
+                transposeTile<1>(r);
+                for (unsigned k = 0; k < W; k++)
+                    store(dst + (j + k) * dstStride + i, r[k]);
+            }
+            for (; j < cols; j++)
+                for (unsigned k = 0; k < W; k++)
+                    dst[j * dstStride + i + k] = src[(i + k) * srcStride + j];
+        }
+        for (; i < rows; i++)
+            for (std::size_t j = 0; j < cols; j++)
+                dst[j * dstStride + i] = src[i * srcStride + j];
+    }
+#endif
+};
+
+template <class T>
+struct SimdLoops<T, 1> {
+    static void add(T* a, const T* b, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            a[i] += b[i];
+    }
+
+    static void sub(T* a, const T* b, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            a[i] -= b[i];
+    }
+
+    static void scale(T* a, T c, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            a[i] *= c;
+    }
+
+    static void negate(T* out, const T* in, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            out[i] = -in[i];
+    }
+
+    static bool isZero(const T* p, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            if (p[i] != 0)
+                return false;
+        return true;
+    }
+
+    static bool equal(const T* a, const T* b, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++)
+            if (a[i] != b[i])
+                return false;
+        return true;
+    }
+
+    static T max(const T* p, std::size_t n) {
+        T result = p[0];
+        for (std::size_t i = 1; i < n; i++)
+            if (result < p[i])
+                result = p[i];
+        return result;
+    }
+
+    static T min(const T* p, std::size_t n) {
+        T result = p[0];
+        for (std::size_t i = 1; i < n; i++)
+            if (p[i] < result)
+                result = p[i];
+        return result;
+    }
+
+    static SimdSummary<T> summary(const T* p, std::size_t n) {
+        SimdSummary<T> s = {p[0], p[0], 0, 0};
+        for (std::size_t i = 0; i < n; i++){
+            if (p[i] < s.min)
+                s.min = p[i];
+            if (s.max < p[i])
+                s.max = p[i];
+            s.sum += p[i];
+            s.squares += p[i] * p[i];
+        }
+        return s;
+    }
+
+    static void transpose(const T* src, std::size_t srcStride, T* dst, std::size_t dstStride,
+                          std::size_t rows, std::size_t cols) {
+        for (std::size_t i = 0; i < rows; i++)
+            for (std::size_t j = 0; j < cols; j++)
+                dst[j * dstStride + i] = src[i * srcStride + j];
+    }
+};
+
+template <class T>
+struct SimdKernels {
+    void (*add)(T*, const T*, std::size_t);
+    void (*sub)(T*, const T*, std::size_t);
+    void (*scale)(T*, T, std::size_t);
+    void (*negate)(T*, const T*, std::size_t);
+    bool (*isZero)(const T*, std::size_t);
+    bool (*equal)(const T*, const T*, std::size_t);
+    T (*max)(const T*, std::size_t);
+    T (*min)(const T*, std::size_t);
+    SimdSummary<T> (*summary)(const T*, std::size_t);
+    void (*transpose)(const T*, std::size_t, T*, std::size_t, std::size_t, std::size_t);
+};
+
+#if SIMD_X86
+#define SIMD_DEFINE_TARGET(Name, isa, bytes)                                                       \
+    template <class T>                                                                             \
+    struct Name {                                                                                  \
+        typedef SimdLoops<T, bytes / sizeof(T)> L;                                                 \
+        SIMD_TARGET(isa) static void add(T* a, const T* b, std::size_t n) { L::add(a, b, n); }     \
+        SIMD_TARGET(isa) static void sub(T* a, const T* b, std::size_t n) { L::sub(a, b, n); }     \
+        SIMD_TARGET(isa) static void scale(T* a, T c, std::size_t n) { L::scale(a, c, n); }        \
+        SIMD_TARGET(isa) static void negate(T* o, const T* i, std::size_t n) { L::negate(o, i, n); } \
+        SIMD_TARGET(isa) static bool isZero(const T* p, std::size_t n) { return L::isZero(p, n); } \
+        SIMD_TARGET(isa) static bool equal(const T* a, const T* b, std::size_t n) {                \
+            return L::equal(a, b, n);                                                              \
+        }                                                                                          \
+        SIMD_TARGET(isa) static T max(const T* p, std::size_t n) { return L::max(p, n); }          \
+        SIMD_TARGET(isa) static T min(const T* p, std::size_t n) { return L::min(p, n); }          \
+        SIMD_TARGET(isa) static SimdSummary<T> summary(const T* p, std::size_t n) {                \
+            return L::summary(p, n);                                                               \
+        }                                                                                          \
+        SIMD_TARGET(isa) static void transpose(const T* s, std::size_t ss, T* d, std::size_t ds,   \
+                                               std::size_t rows, std::size_t cols) {               \
+            L::transpose(s, ss, d, ds, rows, cols);                                                \
+        }                                                                                          \
+        static SimdKernels<T> kernels() {                                                          \
+            return SimdKernels<T>{add, sub, scale, negate, isZero, equal, max, min, summary,       \
+                                  transpose};                                                      \
+        }                                                                                          \
+    };
+
+SIMD_DEFINE_TARGET(SimdSse2, "sse2", 16)
+SIMD_DEFINE_TARGET(SimdAvx2, "avx2", 32)
+SIMD_DEFINE_TARGET(SimdAvx512, "avx512f", 64)
+
+#undef SIMD_DEFINE_TARGET
+#endif
+
+template <class T>
+struct SimdScalar {
+    static SimdKernels<T> kernels() {
+        typedef SimdLoops<T, 1> L;
+        return SimdKernels<T>{L::add, L::sub, L::scale, L::negate, L::isZero, L::equal, L::max, L::min,
+                              L::summary, L::transpose};
+    }
+};
+
+template <class T>
+struct SimdDispatch {
+    static const SimdKernels<T>& kernels() {
+        static const SimdKernels<T> scalar = SimdScalar<T>::kernels();
+        return scalar;
+    }
+};
+
+template <class T>
+struct SimdFloatingDispatch {
+    static const SimdKernels<T>& kernels() {
+#if SIMD_X86
+        static const SimdKernels<T> table[] = {
+            SimdScalar<T>::kernels(),
+            SimdSse2<T>::kernels(),
+            SimdAvx2<T>::kernels(),
+            SimdAvx512<T>::kernels()
+        };
+        return table[(int)getSimdIsa()];
+#else
+        static const SimdKernels<T> scalar = SimdScalar<T>::kernels();
+        return scalar;
+#endif
+    }
+};
+
+template <>
+struct SimdDispatch<float> : SimdFloatingDispatch<float> {};
+
+template <>
+struct SimdDispatch<double> : SimdFloatingDispatch<double> {};
+
+template <class T>
+void simdAdd(T* a, const T* b, std::size_t n) { SimdDispatch<T>::kernels().add(a, b, n); }
+
+template <class T>
+void simdSub(T* a, const T* b, std::size_t n) { SimdDispatch<T>::kernels().sub(a, b, n); }
+
+template <class T>
+void simdScale(T* a, T c, std::size_t n) { SimdDispatch<T>::kernels().scale(a, c, n); }
+
+template <class T>
+void simdNegate(T* out, const T* in, std::size_t n) { SimdDispatch<T>::kernels().negate(out, in, n); }
+
+template <class T>
+bool simdIsZero(const T* p, std::size_t n) { return SimdDispatch<T>::kernels().isZero(p, n); }
+
+template <class T>
+bool simdEqual(const T* a, const T* b, std::size_t n) { return SimdDispatch<T>::kernels().equal(a, b, n); }
+
+template <class T>
+T simdMax(const T* p, std::size_t n) { return SimdDispatch<T>::kernels().max(p, n); }
+
+template <class T>
+T simdMin(const T* p, std::size_t n) { return SimdDispatch<T>::kernels().min(p, n); }
+
+// Requires n > 0, like simdMax() and simdMin().
+template <class T>
+SimdSummary<T> simdSummary(const T* p, std::size_t n) { return SimdDispatch<T>::kernels().summary(p, n); }
+
+template <class T>
+void simdTranspose(const T* src, std::size_t srcStride, T* dst, std::size_t dstStride,
+                   std::size_t rows, std::size_t cols) {
+    SimdDispatch<T>::kernels().transpose(src, srcStride, dst, dstStride, rows, cols);
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "ThreadPool.h"
+#include "Vector.h"
+#include <algorithm>
+
+// Compressed sparse row (CSR) matrix. Row i owns the entries
+// [rowPointers[i], rowPointers[i+1]) of columnIndices and values, with
+// column indices ascending inside a row. Predicates and products run in
+// O(non-zeros) instead of O(rows * columns).
+template <class Scalar_>
+class SparseMatrix {
+public:
+    typedef Scalar_ Scalar;
+
+    struct Triplet {
+        unsigned row, column;
+        Scalar value;
+    };
+
+    // Compressed sparse column form: the same layout with rows and columns
+    // swapped.
+    struct Csc {
+        std::vector<unsigned> columnPointers;
+        std::vector<unsigned> rowIndices;
+        std::vector<Scalar> values;
+    };
+
+    SparseMatrix() : rowPointers(1, 0) {}
+
+    SparseMatrix(unsigned rows, unsigned columns) :
+        rowPointers(rows + 1, 0), rows(rows), columns(columns) {}
+
+    // Duplicate entries are summed; entries that end up zero are dropped.
+    SparseMatrix(unsigned rows, unsigned columns, std::vector<Triplet> triplets) :
+        rowPointers(rows + 1, 0), rows(rows), columns(columns) {
+        for (const Triplet& t : triplets)
+            if (t.row >= rows || t.column >= columns)
+                throw std::out_of_range("SparseMatrix::SparseMatrix");
+        std::sort(triplets.begin(), triplets.end(), [](const Triplet& a, const Triplet& b) {
+            return a.row != b.row ? a.row < b.row : a.column < b.column;
+        });
+        for (std::size_t i = 0; i < triplets.size(); ){
+            Triplet t = triplets[i++];
+            while (i < triplets.size() && triplets[i].row == t.row && triplets[i].column == t.column)
+                t.value += triplets[i++].value;
+            if (t.value != Scalar(0)){
+                columnIndices.push_back(t.column);
+                values.push_back(t.value);
+                rowPointers[t.row + 1]++;
+            }
+        }
+        for (unsigned i = 0; i < rows; i++)
+            rowPointers[i + 1] += rowPointers[i];
+    }
+
+    SparseMatrix(unsigned rows, unsigned columns, std::vector<unsigned> rowPointers,
+                 std::vector<unsigned> columnIndices, std::vector<Scalar> values) :
+        rowPointers(std::move(rowPointers)), columnIndices(std::move(columnIndices)),
+        values(std::move(values)), rows(rows), columns(columns) {
+        if (this->rowPointers.size() != rows + 1 || this->rowPointers[0] != 0
+                || this->rowPointers[rows] != this->values.size()
+                || this->columnIndices.size() != this->values.size())
+            throw std::runtime_error("Wrong number of elements");
+        // Non-decreasing pointers from 0 to values.size() keep every row
+        // inside columnIndices.
+        for (unsigned i = 0; i < rows; i++)
+            if (this->rowPointers[i + 1] < this->rowPointers[i])
+                throw std::runtime_error("Invalid sparse structure");
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned k = this->rowPointers[i]; k < this->rowPointers[i + 1]; k++)
+                if (this->columnIndices[k] >= columns
+                        || (k > this->rowPointers[i] && this->columnIndices[k] <= this->columnIndices[k - 1]))
+                    throw std::runtime_error("Invalid sparse structure");
+    }
+
+    explicit SparseMatrix(const AbstractMatrix<Scalar>& m) :
+        rowPointers(m.getRows() + 1, 0), rows(m.getRows()), columns(m.getColumns()) {
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < rows; i++){
+            for (unsigned j = 0; j < columns; j++)
+                if (dense(i, j) != Scalar(0)){
+                    columnIndices.push_back(j);
+                    values.push_back(dense(i, j));
+                }
+            rowPointers[i + 1] = values.size();
+        }
+    }
+
+    Matrix<Scalar> toDense() const {
+        MatrixBuffer<Scalar> elements(rows * columns, 0);
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned k = rowPointers[i]; k < rowPointers[i + 1]; k++)
+                elements[i * columns + columnIndices[k]] = values[k];
+        return Matrix<Scalar>(rows, columns, std::move(elements));
+    }
+
+    Csc toCsc() const {
+        Csc csc;
+        csc.columnPointers.assign(columns + 1, 0);
+        csc.rowIndices.resize(values.size());
+        csc.values.resize(values.size());
+        for (unsigned c : columnIndices)
+            csc.columnPointers[c + 1]++;
+        for (unsigned j = 0; j < columns; j++)
+            csc.columnPointers[j + 1] += csc.columnPointers[j];
+        std::vector<unsigned> next(csc.columnPointers.begin(), csc.columnPointers.end() - 1);
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned k = rowPointers[i]; k < rowPointers[i + 1]; k++){
+                unsigned position = next[columnIndices[k]]++;
+                csc.rowIndices[position] = i;
+                csc.values[position] = values[k];
+            }
+        return csc;
+    }
+
+    static SparseMatrix fromCsc(unsigned rows, unsigned columns, const Csc& csc) {
+        SparseMatrix transposed(columns, rows, csc.columnPointers, csc.rowIndices, csc.values);
+        return transposed.transpone();
+    }
+
+    SparseMatrix transpone() const {
+        Csc csc = toCsc();
+        SparseMatrix t(columns, rows);
+        t.rowPointers = std::move(csc.columnPointers);
+        t.columnIndices = std::move(csc.rowIndices);
+        t.values = std::move(csc.values);
+        return t;
+    }
+
+    void transponeThis() {
+        *this = transpone();
+    }
+
+    bool isSquare() const { return rows == columns; }
+    bool isVector() const { return rows == 1 || columns == 1; }
+
+    bool isDiagonal() const {
+        if (!isSquare())
+            return false;
+        for (unsigned i = 0; i < rows; i++)
+            for (unsigned k = rowPointers[i]; k < rowPointers[i + 1]; k++)
+                if (columnIndices[k] != i && values[k] != Scalar(0))
+                    return false;
+        return true;
+    }
+
+    bool isSymmetric() const {
+        if (!isSquare())
+            return false;
+        return transpone() == *this;
+    }
+
+    bool isZero() const {
+        for (const Scalar& v : values)
+            if (v != Scalar(0))
+                return false;
+        return true;
+    }
+
+    bool isIdentity() const {
+        if (!isDiagonal())
+            return false;
+        for (unsigned i = 0; i < rows; i++)
+            if ((*this)(i, i) != Scalar(1))
+                return false;
+        return true;
+    }
+
+    unsigned getRows() const { return rows; }
+    unsigned getColumns() const { return columns; }
+    unsigned getNonZeros() const { return values.size(); }
+
+    const std::vector<unsigned>& getRowPointers() const { return rowPointers; }
+    const std::vector<unsigned>& getColumnIndices() const { return columnIndices; }
+    const std::vector<Scalar>& getValues() const { return values; }
+
+    Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("SparseMatrix::operator()");
+        auto first = columnIndices.begin() + rowPointers[r];
+        auto last = columnIndices.begin() + rowPointers[r + 1];
+        auto found = std::lower_bound(first, last, c);
+        if (found == last || *found != c)
+            return Scalar(0);
+        return values[found - columnIndices.begin()];
+    }
+
+    Scalar max() const {
+        Scalar result = values.empty() ? Scalar(0) : *std::max_element(values.begin(), values.end());
+        if (values.size() < (std::size_t)rows * columns && result < Scalar(0))
+            result = 0;
+        return result;
+    }
+
+    Scalar min() const {
+        Scalar result = values.empty() ? Scalar(0) : *std::min_element(values.begin(), values.end());
+        if (values.size() < (std::size_t)rows * columns && Scalar(0) < result)
+            result = 0;
+        return result;
+    }
+
+    Scalar trace() const {
+        if (!isSquare())
+            throw std::runtime_error("Not a square matrix");
+        Scalar trace = 0;
+        for (unsigned i = 0; i < rows; i++)
+            trace += (*this)(i, i);
+        return trace;
+    }
+
+    bool operator==(const SparseMatrix& m) const {
+        if (rows != m.rows || columns != m.columns)
+            return false;
+        for (unsigned i = 0; i < rows; i++){
+            unsigned k = rowPointers[i], l = m.rowPointers[i];
+            unsigned kEnd = rowPointers[i + 1], lEnd = m.rowPointers[i + 1];
+            while (k < kEnd || l < lEnd){
+                if (l == lEnd || (k < kEnd && columnIndices[k] < m.columnIndices[l])){
+                    if (values[k++] != Scalar(0))
+                        return false;
+                } else if (k == kEnd || m.columnIndices[l] < columnIndices[k]){
+                    if (m.values[l++] != Scalar(0))
+                        return false;
+                } else if (values[k++] != m.values[l++])
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator==(const AbstractMatrix<Scalar>& m) const {
+        if (rows != m.getRows() || columns != m.getColumns())
+            return false;
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < rows; i++){
+            unsigned k = rowPointers[i];
+            for (unsigned j = 0; j < columns; j++){
+                Scalar v = 0;
+                if (k < rowPointers[i + 1] && columnIndices[k] == j)
+                    v = values[k++];
+                if (v != dense(i, j))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(const SparseMatrix& m) const { return !(*this == m); }
+    bool operator!=(const AbstractMatrix<Scalar>& m) const { return !(*this == m); }
+
+    SparseMatrix& operator*=(const Scalar& c) {
+        for (auto& v : values)
+            v *= c;
+        return *this;
+    }
+
+    SparseMatrix operator*(const Scalar& c) const {
+        SparseMatrix copy(*this);
+        copy *= c;
+        return copy;
+    }
+
+    // y = A * x for a column vector x.
+    Vector<Scalar> operator*(const Vector<Scalar>& x) const {
+        if (x.getRows() != columns)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> y(rows, 0);
+        const Scalar* xs = x.data();
+        ThreadPool& pool = ThreadPool::global();
+        unsigned grain = pool.useParallel(values.size()) ? 1 + 16384ull * rows / (values.size() + 1) : rows;
+        pool.parallelFor(0, rows, grain, [&](unsigned lo, unsigned hi) {
+            for (unsigned i = lo; i < hi; i++){
+                Scalar sum = 0;
+                for (unsigned k = rowPointers[i]; k < rowPointers[i + 1]; k++)
+                    sum += values[k] * xs[columnIndices[k]];
+                y[i] = sum;
+            }
+        });
+        return Vector<Scalar>(rows, true, std::move(y));
+    }
+
+    // C = A * B for a dense B: every non-zero A(i,k) adds a scaled row of B.
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
+        if (m.getRows() != columns)
+            throw std::runtime_error("Wrong size");
+        unsigned resColumns = m.getColumns();
+        MatrixBuffer<Scalar> elements(rows * resColumns, 0);
+        const Scalar* b = m.data();
+        ThreadPool& pool = ThreadPool::global();
+        unsigned long long work = (unsigned long long)values.size() * resColumns;
+        unsigned grain = pool.useParallel(work) ? 1 + 16384ull * rows / (work + 1) : rows;
+        pool.parallelFor(0, rows, grain, [&](unsigned lo, unsigned hi) {
+            for (unsigned i = lo; i < hi; i++){
+                Scalar* row = elements.data() + i * resColumns;
+                for (unsigned k = rowPointers[i]; k < rowPointers[i + 1]; k++){
+                    Scalar a = values[k];
+                    const Scalar* bRow = b + columnIndices[k] * resColumns;
+                    for (unsigned j = 0; j < resColumns; j++)
+                        row[j] += a * bRow[j];
+                }
+            }
+        });
+        return Matrix<Scalar>(rows, resColumns, std::move(elements));
+    }
+
+private:
+    std::vector<unsigned> rowPointers;
+    std::vector<unsigned> columnIndices;
+    std::vector<Scalar> values;
+    unsigned rows = 0, columns = 0;
+};
+
+template<typename Scalar>
+SparseMatrix<Scalar> operator*(const Scalar& c, const SparseMatrix<Scalar>& m) {
+    return m * c;
+}
+
+// C = A * S for a dense A: every non-zero S(k,j) scales column k of A.
+template<class Scalar>
+Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& a, const SparseMatrix<Scalar>& s) {
+    if (a.getColumns() != s.getRows())
+        throw std::runtime_error("Wrong size");
+    unsigned resColumns = s.getColumns();
+    MatrixBuffer<Scalar> elements(a.getRows() * resColumns, 0);
+    MatrixRef<const Scalar> dense = a.ref();
+    const std::vector<unsigned>& pointers = s.getRowPointers();
+    const std::vector<unsigned>& indices = s.getColumnIndices();
+    const std::vector<Scalar>& values = s.getValues();
+    for (unsigned i = 0; i < a.getRows(); i++){
+        Scalar* row = elements.data() + i * resColumns;
+        for (unsigned k = 0; k < s.getRows(); k++){
+            Scalar factor = dense(i, k);
+            if (factor == Scalar(0))
+                continue;
+            for (unsigned p = pointers[k]; p < pointers[k + 1]; p++)
+                row[indices[p]] += factor * values[p];
+        }
+    }
+    return Matrix<Scalar>(a.getRows(), resColumns, std::move(elements));
+}
+
+template<class Scalar>
+bool operator==(const AbstractMatrix<Scalar>& a, const SparseMatrix<Scalar>& s) {
+    return s == a;
+}
+
+template<class Scalar>
+bool operator!=(const AbstractMatrix<Scalar>& a, const SparseMatrix<Scalar>& s) {
+    return s != a;
+}
+
+template<class Scalar>
+std::ostream& operator<<(std::ostream& out, const SparseMatrix<Scalar>& m){
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return m(i, j); });
+}
+
+#endif
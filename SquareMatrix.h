@@ -2,6 +2,15 @@
 #define SQUARE_MATRIX_H
 
 #include "AbstractMatrix.h"
+#include "Expression.h"
+#include "Gemm.h"
+#include "MatrixView.h"
+#include "Simd.h"
+#include "Strassen.h"
+#include "Transpose.h"
+#include "LU.h"
+#include "Cholesky.h"
+#include "MixedPrecision.h"
 #include <stdexcept>
 
 template <class Scalar>
@@ -12,12 +21,19 @@ public:
     
     SquareMatrix() {}
     
-    SquareMatrix(unsigned size, Scalar value = Scalar()) : data(size * size, value), size(size) {}
+    SquareMatrix(unsigned size, Scalar value = Scalar()) : storage(size * size, value), size(size) {}
 
-    SquareMatrix(unsigned size, std::vector<Scalar> values) : size(size) {
+    SquareMatrix(unsigned size, MatrixBuffer<Scalar> values) : size(size) {
         if (size * size != values.size())
             throw std::runtime_error("Wrong number of elements");
-        data = std::move(values);
+        storage = std::move(values);
+    }
+
+    template <class Allocator>
+    SquareMatrix(unsigned size, const std::vector<Scalar, Allocator>& values) : size(size) {
+        if (size * size != values.size())
+            throw std::runtime_error("Wrong number of elements");
+        storage.assign(values.begin(), values.end());
     }
 
     SquareMatrix(const SquareMatrix& m) = default;
@@ -31,7 +47,7 @@ public:
         if (!m.isSquare())
             throw std::runtime_error("Not a square matrix");
         size = m.getRows();
-        data.assign(m.begin(), m.end());
+        storage = m.copyElements();
     }
     
     SquareMatrix& operator=(const AbstractMatrix<Scalar>& m) {
@@ -39,10 +55,30 @@ public:
             if (!m.isSquare())
                 throw std::runtime_error("Not a square matrix");
             size = m.getRows();
-            data.assign(m.begin(), m.end());
+            storage = m.copyElements();
         }
         return *this;
     }
+    
+    template <class E>
+    SquareMatrix(const MatrixExpression<E>& e) {
+        if (e.self().getRows() != e.self().getColumns())
+            throw std::runtime_error("Not a square matrix");
+        size = e.self().getRows();
+        MATRIX_PROFILE("SquareMatrix::expression", size, size, (unsigned long long)size * size);
+        assignExpression(storage.buffer(), e);
+    }
+    
+    template <class E>
+    SquareMatrix& operator=(const MatrixExpression<E>& e) {
+        if (e.self().getRows() != e.self().getColumns())
+            throw std::runtime_error("Not a square matrix");
+        unsigned s = e.self().getRows();
+        MATRIX_PROFILE("SquareMatrix::expression", s, s, (unsigned long long)s * s);
+        assignExpression(storage.buffer(), e);
+        size = s;
+        return *this;
+    }
 
     virtual bool isSquare() const override {
         return true;
@@ -53,47 +89,73 @@ public:
     }
     
     virtual bool isDiagonal() const override {
-        for (unsigned i = 0; i < size; i++)
-            for (unsigned j = 0; j < size; j++)
-                if (i != j && data[i * size + j] != 0)
-                    return false;
-        return true;
+        return parallelIsDiagonal(ref(), false);
     }
     
     virtual bool isZero() const override {
-        for (auto i = begin(); i != end(); i++)
-            if (*i != 0)
-                return false;
-        return true;
+        return parallelIsZero(storage.data(), storage.size());
+    }
+    
+    virtual Scalar max() const override {
+        return parallelMax(storage.data(), storage.size());
+    }
+    
+    virtual Scalar min() const override {
+        return parallelMin(storage.data(), storage.size());
     }
     
     virtual bool isIdentity() const override {
-        if (!isDiagonal())
-            return false;
-        for (unsigned i = 0; i < size*size; i += size+1 )
-            if (data[i] != 1)
-                return false;
-        return true;
+        return parallelIsDiagonal(ref(), true);
     }
     
     virtual unsigned getRows() const override { return size; }
     virtual unsigned getColumns() const override { return size; }
 
-    virtual iterator begin() override { return data.begin(); }
-    virtual iterator end() override { return data.end(); }
-    virtual const_iterator begin() const override { return data.begin(); }
-    virtual const_iterator end() const override { return data.end(); }
+    virtual iterator begin() override { return storage.data(); }
+    virtual iterator end() override { return storage.data() + storage.size(); }
+    virtual const_iterator begin() const override { return storage.data(); }
+    virtual const_iterator end() const override { return storage.data() + storage.size(); }
+    
+    Scalar* data() { return storage.data(); }
+    const Scalar* data() const { return storage.data(); }
+    MatrixRef<Scalar> ref() { return MatrixRef<Scalar>(storage.data(), size, size); }
+    MatrixRef<const Scalar> ref() const { return MatrixRef<const Scalar>(storage.data(), size, size); }
+
+    // Copy-on-write sharing of the elements with copies; see MatrixStorage.h.
+    void share() { storage.share(); }
+    bool isShared() const { return storage.isShared(); }
+    virtual const MatrixStorage<Scalar>* getStorage() const override { return &storage; }
+    
+    Scalar* row(unsigned r) {
+        assert(r < size);
+        return storage.data() + r * size;
+    }
+    
+    const Scalar* row(unsigned r) const {
+        assert(r < size);
+        return storage.data() + r * size;
+    }
+    
+    Scalar& unchecked(unsigned r, unsigned c) {
+        assert(r < size && c < size);
+        return storage[r * size + c];
+    }
+    
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < size && c < size);
+        return storage[r * size + c];
+    }
 
     virtual Scalar operator()(unsigned r, unsigned c) const override {
         if (r >= size || c >= size)
             throw std::out_of_range("SquareMatrix::operator()");
-        return data[r * size + c];
+        return storage[r * size + c];
     }
 
     virtual Scalar& operator()(unsigned r, unsigned c) override {
         if (r >= size || c >= size)
             throw std::out_of_range("SquareMatrix::operator()");
-        return data[r * size + c];
+        return storage[r * size + c];
     }
     
     bool operator==(const AbstractMatrix<Scalar>& m) const override {
@@ -101,60 +163,54 @@ public:
             return false;
         if (size !=m.getRows())
             return false;
-        for (const_iterator i = begin(), j = m.begin(); j != m.end(); ++i, ++j)
-            if (*i != *j)
-                return false;
-        return true;
-    }
-    
-    SquareMatrix operator-() const {
-        std::vector<Scalar> temp;
-        for (auto element : *this)
-            temp.push_back(-element);
-        return SquareMatrix(size, std::move(temp));
+        return parallelEqual(storage.data(), m.data(), storage.size());
     }
     
     SquareMatrix& operator+=(const AbstractMatrix<Scalar>& m) {
          if (size != m.getRows() || size != m.getColumns())
             throw std::runtime_error("Wrong size");
-        auto m_data = m.begin();
-        for (unsigned i = 0; i < size * size; i++)
-            data[i] += m_data[i];
+        MATRIX_PROFILE("SquareMatrix::operator+=", size, size, storage.size());
+        simdAdd(storage.data(), m.data(), storage.size());
         return *this;
     }
     
-    SquareMatrix operator+(const AbstractMatrix<Scalar>& m) const {
-        SquareMatrix copy(*this);
-        copy += m;
-        return copy;
-    }
-    
     SquareMatrix& operator-=(const AbstractMatrix<Scalar>& m) {
          if (size != m.getRows() || size != m.getColumns())
             throw std::runtime_error("Wrong size");
-        auto m_data = m.begin();
-        for (unsigned i = 0; i < size * size; i++)
-            data[i] -= m_data[i];
+        MATRIX_PROFILE("SquareMatrix::operator-=", size, size, storage.size());
+        simdSub(storage.data(), m.data(), storage.size());
+        return *this;
+    }
+    
+    template <class E>
+    SquareMatrix& operator+=(const MatrixExpression<E>& e) {
+        const E& x = e.self();
+        if (size != x.getRows() || size != x.getColumns())
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("SquareMatrix::operator+=", size, size, storage.size());
+        updateExpression<ExpressionPlus>(storage.data(), x.getColumns(), x);
         return *this;
     }
     
-    SquareMatrix operator-(const AbstractMatrix<Scalar>& m) const {
-        SquareMatrix copy(*this);
-        copy -= m;
-        return copy;
+    template <class E>
+    SquareMatrix& operator-=(const MatrixExpression<E>& e) {
+        const E& x = e.self();
+        if (size != x.getRows() || size != x.getColumns())
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("SquareMatrix::operator-=", size, size, storage.size());
+        updateExpression<ExpressionMinus>(storage.data(), x.getColumns(), x);
+        return *this;
     }
     
-    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) {
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
         if (size != m.getRows())
             throw std::runtime_error("Wrong size");
         unsigned resColumns = m.getColumns();
-        std::vector<Scalar> elements(size * resColumns, 0);
-        for (unsigned i = 0; i < size; i++){
-            Scalar* row = elements.data() + i * resColumns;
-            for (unsigned j = 0; j < size; j++)
-                for (unsigned k = 0; k < m.getColumns(); k++)
-                    row[k] += this->operator()(i,j) * m(j,k);
-        }
+        MATRIX_PROFILE("SquareMatrix::operator*", size, resColumns, 2ull * size * size * resColumns);
+        MatrixBuffer<Scalar> elements(size * resColumns, 0);
+        if (!elements.empty())
+            multiplyInto(size, resColumns, size, storage.data(), size,
+                         m.data(), resColumns, elements.data(), resColumns);
         return Matrix<Scalar>(size, resColumns, std::move(elements));
     }
     
@@ -164,165 +220,175 @@ public:
     }
     
     SquareMatrix& operator*=(const Scalar& c) {
-        for (auto& e : data)
-            e *= c;
+        MATRIX_PROFILE("SquareMatrix::operator*=", size, size, storage.size());
+        simdScale(storage.data(), c, storage.size());
         return *this;
     }
     
-    SquareMatrix operator*(const Scalar& c) {
-        SquareMatrix copy(*this);
-        copy *= c;
-        return copy;
-    }
-    
     
     virtual Scalar trace() const override {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
         Scalar trace = 0;
         for (unsigned i = 0; i < size*size; i += size +1 )
-            trace += data[i];
+            trace += storage[i];
         return trace;
     }
     
     template<typename T = double>
     T det() const {
+        MATRIX_PROFILE("SquareMatrix::det", size, size, 2ull * size * size * size / 3);
         if (size == 1)
-            return data[0];
+            return storage[0];
         if (size == 2)
-            return (data[0]*data[3] - data[1]*data[2]);
-        
-        std::vector<T> v(data.begin(), data.end());
-        SquareMatrix<T> m(size, v);
-        
-        bool swap = false;
-        for (unsigned k = 0; k < size-1; k++){
-            if (m(k,k) == 0){
-                bool detZero = true;
-                for (unsigned i = k+1; i < size; i++)
-                    if (m(i,k) != 0){
-                        m.swapRows(i,k);
-                        swap = !swap;
-                        detZero = false;
-                        break;
-                    }
-                if (detZero)
-                    return 0;
-            }
-            for (unsigned i = k+1; i < size; i++){
-                T factor = m(i,k) / m(k,k);
-                for (unsigned j = k; j < size; j++){
-                    T element = m(i,j) - factor * m(k,j);
-                    m(i,j) = element;
-                }
-            }
-        }
-                
-        T det = m(0,0);
-        for (unsigned i = 1; i < size; i++)
-            det *= m(i,i);
-        
-        if (swap)
-            return -det;
+            return (storage[0]*storage[3] - storage[1]*storage[2]);
         
-        return det;
+        return LU<T>(*this).det();
     }
     
     template<typename T = double>
     SquareMatrix<T> invert() const {
-        if (size == 1)
-            return SquareMatrix<T>(1, 1/(T)data[0]);
-        
-        std::vector<T> v(data.begin(), data.end());
-        SquareMatrix<T> m(size, v);
-        SquareMatrix<T> r(size, 1);
+        MATRIX_PROFILE("SquareMatrix::invert", size, size, 2ull * size * size * size);
+        SquareMatrix<T> r(size, 0);
         r.makeIdentity();
-        
-        for (unsigned k = 0; k < size-1; k++){
-            if (m(k,k) == 0){
-                bool detZero = true;
-                for (unsigned i = k+1; i < size; i++)
-                    if (m(i,k) != 0){
-                        m.swapRows(i,k);
-                        r.swapRows(i,k);
-                        detZero = false;
-                        break;
-                    }
-                if (detZero)
-                    throw std::runtime_error("Singular matrix");
-            }
-            for (unsigned i = k+1; i < size; i++){
-                T factor = m(i,k) / m(k,k);
-                for ( unsigned j = 0; j < size; j++){
-                    m(i,j) -= factor * m(k,j);
-                    r(i,j) -= factor * r(k,j);
-                }
-            }
-        }
-        
-        if (m(size-1, size-1) == 0)
-            throw std::runtime_error("Singular matrix");
-        
-        for (unsigned k = size - 1; k > 0; k--){
-            for (unsigned i = 0; i < k; i++){
-                T factor = m(i,k) / m(k,k);
-                for ( unsigned j = 0; j < size; j++){
-                    m(i,j) -= factor * m(k,j);
-                    r(i,j) -= factor * r(k,j);
-                }
+        if (size != 0)
+            LU<T>(*this).solveInPlace(r.data(), size);
+        return r;
+    }
+    
+    template<typename T = double>
+    T det(Factorization factorization) const {
+        MATRIX_PROFILE("SquareMatrix::det(Factorization)", size, size, 2ull * size * size * size / 3);
+        switch (factorization){
+        case Factorization::Cholesky:
+            return Cholesky<T>(*this).det();
+        case Factorization::LDLT:
+            return LDLT<T>(*this).det();
+        case Factorization::Automatic:
+            if (this->isSymmetric()){
+                Cholesky<T> c(*this);
+                if (c.isPositiveDefinite())
+                    return c.det();
             }
+            return det<T>();
+        default:
+            return det<T>();
         }
-        
-        for (unsigned i = 0; i < size; i++)
-            for (unsigned j = 0; j < size; j++)
-                r(i,j) /= m(i,i);
-        
+    }
+    
+    template<typename T = double>
+    SquareMatrix<T> invert(Factorization factorization) const {
+        MATRIX_PROFILE("SquareMatrix::invert(Factorization)", size, size, 2ull * size * size * size);
+        SquareMatrix<T> r(size, 0);
+        r.makeIdentity();
+        solveInPlace(r.data(), size, factorization);
         return r;
     }
     
+    template<typename T>
+    Vector<T> solve(const Vector<T>& b, Factorization factorization = Factorization::LU) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("SquareMatrix::solve", size, size, 2ull * size * size * size / 3 + 2ull * size * size);
+        Vector<T> x(b);
+        solveInPlace(x.data(), 1, factorization);
+        return x;
+    }
+    
+    template<typename T = double>
+    LU<T> lu() const {
+        MATRIX_PROFILE("SquareMatrix::lu", size, size, 2ull * size * size * size / 3);
+        return LU<T>(*this);
+    }
+    
+    // Factors in float and refines solutions in T; see MixedPrecision.h.
+    template<typename T = double>
+    MixedPrecisionLU<T> mixedPrecisionLU(RefinementOptions options = RefinementOptions()) const {
+        MATRIX_PROFILE("SquareMatrix::mixedPrecisionLU", size, size, 2ull * size * size * size / 3);
+        return MixedPrecisionLU<T>(*this, options);
+    }
+    
+    // Only the lower triangle is read; see Cholesky.h.
+    template<typename T = double>
+    Cholesky<T> cholesky() const {
+        MATRIX_PROFILE("SquareMatrix::cholesky", size, size, (unsigned long long)size * size * size / 3);
+        return Cholesky<T>(*this);
+    }
+    
+    template<typename T = double>
+    LDLT<T> ldlt() const {
+        MATRIX_PROFILE("SquareMatrix::ldlt", size, size, (unsigned long long)size * size * size / 3);
+        return LDLT<T>(*this);
+    }
+    
     void swapRows(unsigned first, unsigned second) {
         if (first >= size || second >= size)
             throw std::out_of_range("SquareMatrix::swapRows");
         for (unsigned i = 0; i < size; i++)
-            std::swap(data[first * size + i], data[second * size + i]);
+            std::swap(storage[first * size + i], storage[second * size + i]);
     }
     
     void swapColumns(unsigned first, unsigned second) {
         if (first >= size || second >= size)
             throw std::out_of_range("SquareMatrix::swapColumns");
         for (unsigned i = 0; i < size; i++)
-            std::swap(data[i * size + first], data[i * size + second]);
+            std::swap(storage[i * size + first], storage[i * size + second]);
     }
     
     SquareMatrix transpone() const {
-        std::vector<Scalar> elements(size * size);
-        for (unsigned i = 0; i < size; i++)
-            for (unsigned j = 0; j < size; j++)
-                elements[j * size + i] = data[i * size + j];
+        MATRIX_PROFILE("SquareMatrix::transpone", size, size, 0);
+        MatrixBuffer<Scalar> elements(size * size);
+        transpose(size, size, storage.data(), size, elements.data(), size);
         return SquareMatrix(size, std::move(elements));
     }
     
     virtual void transponeThis() override {
-        *this = transpone();
+        MATRIX_PROFILE("SquareMatrix::transponeThis", size, size, 0);
+        transposeInPlace(size, storage.data(), size);
     }
     
     virtual void makeIdentity() override {
         for (unsigned i = 0; i < size; i++)
             for (unsigned j = 0; j < size; j++)
                 if (i != j)
-                    data[i * size + j] = 0;
+                    storage[i * size + j] = 0;
                 else
-                    data[i * size + j] = 1;
+                    storage[i * size + j] = 1;
     }
 
 private:
-    std::vector<Scalar> data;
+    // Overwrites the size x columns block b with A^-1 * b.
+    template<typename T>
+    void solveInPlace(T* b, unsigned columns, Factorization factorization) const {
+        if (size == 0)
+            return;
+        switch (factorization){
+        case Factorization::Cholesky:
+            Cholesky<T>(*this).solveInPlace(b, columns);
+            return;
+        case Factorization::LDLT:
+            LDLT<T>(*this).solveInPlace(b, columns);
+            return;
+        case Factorization::MixedPrecision:
+            MixedPrecisionLU<T>(*this).solveInPlace(b, columns);
+            return;
+        case Factorization::Automatic:
+            if (this->isSymmetric()){
+                Cholesky<T> c(*this);
+                if (c.isPositiveDefinite()){
+                    c.solveInPlace(b, columns);
+                    return;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+        LU<T>(*this).solveInPlace(b, columns);
+    }
+
+    MatrixStorage<Scalar> storage;
     unsigned size = 0;
 };
 
-template<typename Scalar>
-SquareMatrix<Scalar> operator*(const Scalar& c, SquareMatrix<Scalar>& m) {
-   return m * c;
-}
-
 #endif
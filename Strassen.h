@@ -0,0 +1,218 @@
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include "Gemm.h"
+#include "MatrixAllocator.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+// Opt-in Strassen-Winograd multiplication for large products: 7 half-size
+// products and 15 block additions per level instead of 8 products, so
+// n x n products cost O(n^2.807). It is used by the operator* of Matrix,
+// SquareMatrix and the views once every dimension exceeds the crossover;
+// smaller blocks use the classical engine (gemm). Results differ from the
+// classical product by rounding, and the error grows by a small constant
+// factor per level, so it is off by default:
+//
+//     setMultiplyAlgorithm(MultiplyAlgorithm::Strassen);
+//     setStrassenCrossover(512);      // optional; the default is 256
+enum class MultiplyAlgorithm { Classical, Strassen };
+
+// Both settings are atomic so they may change while products run on other
+// threads; products already started keep the values they read.
+inline std::atomic<MultiplyAlgorithm>& multiplyAlgorithmSetting() {
+    static std::atomic<MultiplyAlgorithm> algorithm{MultiplyAlgorithm::Classical};
+    return algorithm;
+}
+
+inline MultiplyAlgorithm getMultiplyAlgorithm() {
+    return multiplyAlgorithmSetting().load(std::memory_order_relaxed);
+}
+
+inline void setMultiplyAlgorithm(MultiplyAlgorithm algorithm) {
+    multiplyAlgorithmSetting().store(algorithm, std::memory_order_relaxed);
+}
+
+inline std::atomic<unsigned>& strassenCrossoverSetting() {
+    static std::atomic<unsigned> crossover{256};
+    return crossover;
+}
+
+inline unsigned getStrassenCrossover() {
+    return strassenCrossoverSetting().load(std::memory_order_relaxed);
+}
+
+// Blocks whose smallest dimension is at most crossover are multiplied
+// classically.
+inline void setStrassenCrossover(unsigned crossover) {
+    strassenCrossoverSetting().store(std::max(crossover, 16u), std::memory_order_relaxed);
+}
+
+// Number of halvings until the smallest of m, n, k is at most crossover.
+inline unsigned strassenDepth(unsigned m, unsigned n, unsigned k, unsigned crossover) {
+    unsigned smallest = std::min(m, std::min(n, k)), depth = 0;
+    while (smallest > crossover){
+        smallest = (smallest + 1) / 2;
+        depth++;
+    }
+    return depth;
+}
+
+// Elements of the temporaries needed by strassenStep below.
+inline std::size_t strassenScratch(unsigned m, unsigned n, unsigned k, unsigned depth) {
+    std::size_t total = 0;
+    for (; depth > 0; depth--){
+        m /= 2;
+        n /= 2;
+        k /= 2;
+        total += (std::size_t)m * std::max(k, n) + (std::size_t)k * n;
+    }
+    return total;
+}
+
+// C = A + B, or A - B with Subtract; any operand may alias C.
+template <bool Subtract, class Scalar>
+void strassenAdd(unsigned rows, unsigned columns, const Scalar* a, unsigned lda,
+                 const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc) {
+    ThreadPool& pool = ThreadPool::global();
+    unsigned long long work = (unsigned long long)rows * columns;
+    unsigned grain = pool.useParallel(work) ? 1 + 16384ull * rows / (work + 1) : rows;
+    pool.parallelFor(0, rows, grain, [=](unsigned lo, unsigned hi) {
+        for (unsigned i = lo; i < hi; i++){
+            const Scalar* x = a + (std::size_t)i * lda;
+            const Scalar* y = b + (std::size_t)i * ldb;
+            Scalar* z = c + (std::size_t)i * ldc;
+            for (unsigned j = 0; j < columns; j++)
+                z[j] = Subtract ? x[j] - y[j] : x[j] + y[j];
+        }
+    });
+}
+
+// C = A * B with m, n and k divisible by 2^depth. Winograd's variant,
+// scheduled as in Boyer, Dumas, Pernet and Zhou (2009) so that besides C
+// each level needs only X (m/2 x max(k, n)/2) and Y (k/2 x n/2).
+template <class Scalar>
+void strassenStep(unsigned m, unsigned n, unsigned k, const Scalar* a, unsigned lda,
+                  const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc, unsigned depth, Scalar* scratch) {
+    if (depth == 0){
+        for (unsigned i = 0; i < m; i++)
+            std::fill(c + (std::size_t)i * ldc, c + (std::size_t)i * ldc + n, Scalar());
+        gemm(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+    unsigned m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    const Scalar* a11 = a;
+    const Scalar* a12 = a + k2;
+    const Scalar* a21 = a + (std::size_t)m2 * lda;
+    const Scalar* a22 = a21 + k2;
+    const Scalar* b11 = b;
+    const Scalar* b12 = b + n2;
+    const Scalar* b21 = b + (std::size_t)k2 * ldb;
+    const Scalar* b22 = b21 + n2;
+    Scalar* c11 = c;
+    Scalar* c12 = c + n2;
+    Scalar* c21 = c + (std::size_t)m2 * ldc;
+    Scalar* c22 = c21 + n2;
+    unsigned ldx = std::max(k2, n2), ldy = n2;
+    Scalar* x = scratch;
+    Scalar* y = x + (std::size_t)m2 * ldx;
+    Scalar* next = y + (std::size_t)k2 * ldy;
+    auto multiply = [&](const Scalar* p, unsigned ldp, const Scalar* q, unsigned ldq, Scalar* r, unsigned ldr) {
+        strassenStep(m2, n2, k2, p, ldp, q, ldq, r, ldr, depth - 1, next);
+    };
+
+    strassenAdd<true>(m2, k2, a11, lda, a21, lda, x, ldx);      // S3 = A11 - A21
+    strassenAdd<true>(k2, n2, b22, ldb, b12, ldb, y, ldy);      // T3 = B22 - B12
+    multiply(x, ldx, y, ldy, c21, ldc);                         // P7 = S3 T3
+    strassenAdd<false>(m2, k2, a21, lda, a22, lda, x, ldx);     // S1 = A21 + A22
+    strassenAdd<true>(k2, n2, b12, ldb, b11, ldb, y, ldy);      // T1 = B12 - B11
+    multiply(x, ldx, y, ldy, c22, ldc);                         // P5 = S1 T1
+    strassenAdd<true>(m2, k2, x, ldx, a11, lda, x, ldx);        // S2 = S1 - A11
+    strassenAdd<true>(k2, n2, b22, ldb, y, ldy, y, ldy);        // T2 = B22 - T1
+    multiply(x, ldx, y, ldy, c12, ldc);                         // P6 = S2 T2
+    strassenAdd<true>(m2, k2, a12, lda, x, ldx, x, ldx);        // S4 = A12 - S2
+    multiply(x, ldx, b22, ldb, c11, ldc);                       // P3 = S4 B22
+    multiply(a11, lda, b11, ldb, x, ldx);                       // P1 = A11 B11
+    strassenAdd<false>(m2, n2, x, ldx, c12, ldc, c12, ldc);     // U2 = P1 + P6
+    strassenAdd<false>(m2, n2, c12, ldc, c21, ldc, c21, ldc);   // U3 = U2 + P7
+    strassenAdd<false>(m2, n2, c12, ldc, c22, ldc, c12, ldc);   // U4 = U2 + P5
+    strassenAdd<false>(m2, n2, c21, ldc, c22, ldc, c22, ldc);   // C22 = U3 + P5
+    strassenAdd<false>(m2, n2, c12, ldc, c11, ldc, c12, ldc);   // C12 = U4 + P3
+    strassenAdd<true>(k2, n2, y, ldy, b21, ldb, y, ldy);        // T4 = T2 - B21
+    multiply(a22, lda, y, ldy, c11, ldc);                       // P4 = A22 T4
+    strassenAdd<true>(m2, n2, c21, ldc, c11, ldc, c21, ldc);    // C21 = U3 - P4
+    multiply(a12, lda, b21, ldb, c11, ldc);                     // P2 = A12 B21
+    strassenAdd<false>(m2, n2, x, ldx, c11, ldc, c11, ldc);     // C11 = P1 + P2
+}
+
+// Copies a rows x columns block into a zero-padded paddedRows x
+// paddedColumns buffer.
+template <class Scalar>
+MatrixBuffer<Scalar> strassenPad(const Scalar* a, unsigned lda, unsigned rows, unsigned columns,
+                                 unsigned paddedRows, unsigned paddedColumns) {
+    MatrixBuffer<Scalar> padded((std::size_t)paddedRows * paddedColumns, Scalar());
+    for (unsigned i = 0; i < rows; i++)
+        std::copy(a + (std::size_t)i * lda, a + (std::size_t)i * lda + columns,
+                  padded.data() + (std::size_t)i * paddedColumns);
+    return padded;
+}
+
+// C = A * B by Strassen-Winograd down to blocks of at most crossover.
+// Dimensions that do not halve evenly down to the leaves are padded with
+// zeros, by less than 2^depth rows or columns. Scratch memory is allocated
+// once: the padded operands if needed, plus about a third of the size of A
+// and B for the temporaries of all levels.
+template <class Scalar>
+void strassen(unsigned m, unsigned n, unsigned k, const Scalar* a, unsigned lda,
+              const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc,
+              unsigned crossover = getStrassenCrossover()) {
+    unsigned depth = strassenDepth(m, n, k, crossover);
+    unsigned block = 1u << depth;
+    auto roundUp = [&](unsigned x) { return (x + block - 1) / block * block; };
+    unsigned mp = roundUp(m), np = roundUp(n), kp = roundUp(k);
+    MatrixBuffer<Scalar> scratch(strassenScratch(mp, np, kp, depth));
+    if (mp == m && np == n && kp == k){
+        strassenStep(m, n, k, a, lda, b, ldb, c, ldc, depth, scratch.data());
+        return;
+    }
+    MatrixBuffer<Scalar> paddedA, paddedB;
+    if (mp != m || kp != k){
+        paddedA = strassenPad(a, lda, m, k, mp, kp);
+        a = paddedA.data();
+        lda = kp;
+    }
+    if (kp != k || np != n){
+        paddedB = strassenPad(b, ldb, k, n, kp, np);
+        b = paddedB.data();
+        ldb = np;
+    }
+    if (mp == m && np == n){
+        strassenStep(m, n, kp, a, lda, b, ldb, c, ldc, depth, scratch.data());
+        return;
+    }
+    MatrixBuffer<Scalar> paddedC((std::size_t)mp * np);
+    strassenStep(mp, np, kp, a, lda, b, ldb, paddedC.data(), np, depth, scratch.data());
+    for (unsigned i = 0; i < m; i++)
+        std::copy(paddedC.data() + (std::size_t)i * np, paddedC.data() + (std::size_t)i * np + n,
+                  c + (std::size_t)i * ldc);
+}
+
+inline bool useStrassen(unsigned m, unsigned n, unsigned k, unsigned crossover = getStrassenCrossover()) {
+    return getMultiplyAlgorithm() == MultiplyAlgorithm::Strassen &&
+           std::min(m, std::min(n, k)) > crossover;
+}
+
+// C = A * B for a zero-initialized C, by the selected algorithm. The
+// crossover is read once, so the decision and the recursion agree.
+template <class Scalar>
+void multiplyInto(unsigned m, unsigned n, unsigned k, const Scalar* a, unsigned lda,
+                  const Scalar* b, unsigned ldb, Scalar* c, unsigned ldc) {
+    unsigned crossover = getStrassenCrossover();
+    if (useStrassen(m, n, k, crossover))
+        strassen(m, n, k, a, lda, b, ldb, c, ldc, crossover);
+    else
+        gemm(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+#endif
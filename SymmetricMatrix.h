@@ -0,0 +1,184 @@
+#ifndef SYMMETRIC_MATRIX_H
+#define SYMMETRIC_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Cholesky.h"
+#include "LU.h"
+#include "Matrix.h"
+#include "Simd.h"
+#include "Vector.h"
+
+// Symmetric matrix in packed storage: only the lower triangle is kept, row
+// by row, so an n x n matrix takes n (n + 1) / 2 elements instead of n^2.
+// Element (r, c) and (c, r) are the same element. Factorizations unpack
+// into a temporary square buffer.
+template <class Scalar_>
+class SymmetricMatrix {
+public:
+    typedef Scalar_ Scalar;
+
+    SymmetricMatrix() {}
+
+    SymmetricMatrix(unsigned size, Scalar value = Scalar()) :
+        packed(packedSize(size), value), size(size) {}
+
+    // The lower triangle row by row: (0,0), (1,0), (1,1), (2,0), ...
+    SymmetricMatrix(unsigned size, MatrixBuffer<Scalar> values) : packed(std::move(values)), size(size) {
+        if (packed.size() != packedSize(size))
+            throw std::runtime_error("Wrong number of elements");
+    }
+
+    explicit SymmetricMatrix(const AbstractMatrix<Scalar>& m) : packed(packedSize(m.getRows())), size(m.getRows()) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        if (!m.isSymmetric())
+            throw std::runtime_error("Not a symmetric matrix");
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++)
+            std::copy(dense.row(i), dense.row(i) + i + 1, packed.data() + packedSize(i));
+    }
+
+    static std::size_t packedSize(unsigned size) { return (std::size_t)size * (size + 1) / 2; }
+
+    Matrix<Scalar> toDense() const { return Matrix<Scalar>(size, size, unpack<Scalar>(true)); }
+
+    unsigned getRows() const { return size; }
+    unsigned getColumns() const { return size; }
+    bool isSquare() const { return true; }
+    bool isSymmetric() const { return true; }
+
+    const MatrixBuffer<Scalar>& getPacked() const { return packed; }
+    Scalar* data() { return packed.data(); }
+    const Scalar* data() const { return packed.data(); }
+
+    Scalar unchecked(unsigned r, unsigned c) const { return packed[index(r, c)]; }
+
+    Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= size || c >= size)
+            throw std::out_of_range("SymmetricMatrix::operator()");
+        return packed[index(r, c)];
+    }
+
+    Scalar& operator()(unsigned r, unsigned c) {
+        if (r >= size || c >= size)
+            throw std::out_of_range("SymmetricMatrix::operator()");
+        return packed[index(r, c)];
+    }
+
+    bool operator==(const SymmetricMatrix& m) const { return size == m.size && packed == m.packed; }
+    bool operator!=(const SymmetricMatrix& m) const { return !(*this == m); }
+
+    Scalar trace() const {
+        Scalar trace = 0;
+        for (unsigned i = 0; i < size; i++)
+            trace += packed[packedSize(i) + i];
+        return trace;
+    }
+
+    SymmetricMatrix& operator+=(const SymmetricMatrix& m) {
+        if (size != m.size)
+            throw std::runtime_error("Wrong size");
+        simdAdd(packed.data(), m.packed.data(), packed.size());
+        return *this;
+    }
+
+    SymmetricMatrix& operator-=(const SymmetricMatrix& m) {
+        if (size != m.size)
+            throw std::runtime_error("Wrong size");
+        simdSub(packed.data(), m.packed.data(), packed.size());
+        return *this;
+    }
+
+    SymmetricMatrix& operator*=(const Scalar& c) {
+        simdScale(packed.data(), c, packed.size());
+        return *this;
+    }
+
+    // y = A * x. Every stored element is read once and used for both of
+    // its positions, so rows are not independent and the product is
+    // sequential.
+    Vector<Scalar> operator*(const Vector<Scalar>& x) const {
+        if (x.getRows() * x.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> y(size, 0);
+        const Scalar* xs = x.data();
+        for (unsigned i = 0; i < size; i++){
+            const Scalar* row = packed.data() + packedSize(i);
+            Scalar sum = 0;
+            for (unsigned j = 0; j < i; j++){
+                sum += row[j] * xs[j];
+                y[j] += row[j] * xs[i];
+            }
+            y[i] += sum + row[i] * xs[i];
+        }
+        return Vector<Scalar>(size, true, std::move(y));
+    }
+
+    // Cholesky when the matrix is positive definite, LU otherwise.
+    template<typename T = double>
+    T det() const {
+        Cholesky<T> c = cholesky<T>();
+        if (c.isPositiveDefinite())
+            return c.det();
+        return LU<T>(size, unpack<T>(true)).det();
+    }
+
+    template<typename T = double>
+    SymmetricMatrix<T> invert() const {
+        Cholesky<T> c = cholesky<T>();
+        MatrixBuffer<T> r((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            r[(std::size_t)i * size + i] = 1;
+        if (c.isPositiveDefinite())
+            c.solveInPlace(r.data(), size);
+        else if (size != 0)
+            LU<T>(size, unpack<T>(true)).solveInPlace(r.data(), size);
+        MatrixBuffer<T> result(packedSize(size));
+        for (unsigned i = 0; i < size; i++)
+            std::copy(r.data() + (std::size_t)i * size, r.data() + (std::size_t)i * size + i + 1,
+                      result.data() + packedSize(i));
+        return SymmetricMatrix<T>(size, std::move(result));
+    }
+
+    template<typename T = double>
+    Cholesky<T> cholesky() const {
+        return Cholesky<T>(size, unpack<T>(false));
+    }
+
+    template<typename T = double>
+    LDLT<T> ldlt() const {
+        return LDLT<T>(size, unpack<T>(false));
+    }
+
+private:
+    static std::size_t index(unsigned r, unsigned c) {
+        return r >= c ? packedSize(r) + c : packedSize(c) + r;
+    }
+
+    // Square row-major copy: the lower triangle, or with full the whole
+    // matrix.
+    template<typename T>
+    MatrixBuffer<T> unpack(bool full) const {
+        MatrixBuffer<T> square((std::size_t)size * size, T());
+        for (unsigned i = 0; i < size; i++){
+            const Scalar* row = packed.data() + packedSize(i);
+            for (unsigned j = 0; j <= i; j++){
+                square[(std::size_t)i * size + j] = row[j];
+                if (full)
+                    square[(std::size_t)j * size + i] = row[j];
+            }
+        }
+        return square;
+    }
+
+    MatrixBuffer<Scalar> packed;
+    unsigned size = 0;
+};
+
+template <class Scalar>
+std::ostream& operator<<(std::ostream& out, const SymmetricMatrix<Scalar>& m){
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return m.unchecked(i, j); });
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef TEXT_IO_H
+#define TEXT_IO_H
+
+#include "MatrixAllocator.h"
+#include <charconv>
+#include <cstring>
+#include <istream>
+#include <locale>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+// Matrix text: one row per line, elements separated by whitespace or by a
+// comma or semicolon (CSV). Numbers are formatted with std::to_chars into a
+// large buffer that is handed to the stream in blocks, never flushed per
+// row, and parsed with std::from_chars one line at a time, so a file of any
+// size can be streamed through readTextRows without holding it in memory.
+struct TextFormat {
+    const char* separator;
+    bool trailingSeparator;
+    int precision;          // significant digits, or -1 for the shortest exact text
+
+    // What operator<< prints: every element followed by two spaces.
+    static TextFormat whitespace(int precision = -1) { return TextFormat{"  ", true, precision}; }
+    static TextFormat csv(int precision = -1) { return TextFormat{",", false, precision}; }
+};
+
+// Scalars handled by <charconv>. Other types, and character types (which
+// streams print as characters), go through the stream operators.
+template <class Scalar>
+struct TextScalar {
+    static constexpr bool fast = std::is_arithmetic<Scalar>::value &&
+        !std::is_same<Scalar, bool>::value && !std::is_same<Scalar, char>::value &&
+        !std::is_same<Scalar, signed char>::value && !std::is_same<Scalar, unsigned char>::value;
+};
+
+// Collects text in a 64 KiB block and writes it to the stream when the
+// block is full or on flush(), which must be called when done.
+class TextWriter {
+public:
+    static constexpr std::size_t bufferSize = 1 << 16;
+
+    explicit TextWriter(std::ostream& out) :
+        out(out), buffer(new char[bufferSize]), cursor(buffer.get()) {}
+
+    TextWriter(const TextWriter&) = delete;
+    TextWriter& operator=(const TextWriter&) = delete;
+
+    void write(const char* s, std::size_t n) {
+        if (n > (std::size_t)(buffer.get() + bufferSize - cursor)){
+            flush();
+            if (n > bufferSize){
+                out.write(s, (std::streamsize)n);
+                return;
+            }
+        }
+        std::memcpy(cursor, s, n);
+        cursor += n;
+    }
+
+    void put(char c) {
+        if (cursor == buffer.get() + bufferSize)
+            flush();
+        *cursor++ = c;
+    }
+
+    template <class Scalar>
+    void scalar(Scalar value, int precision) {
+        std::to_chars_result r = format(cursor, buffer.get() + bufferSize, value, precision);
+        if (r.ec != std::errc()){
+            flush();
+            r = format(cursor, buffer.get() + bufferSize, value, precision);
+        }
+        cursor = r.ptr;
+    }
+
+    void flush() {
+        out.write(buffer.get(), cursor - buffer.get());
+        cursor = buffer.get();
+    }
+
+private:
+    template <class Scalar>
+    static std::to_chars_result format(char* first, char* last, Scalar value, int precision) {
+        if constexpr (std::is_floating_point<Scalar>::value){
+            if (precision >= 0)
+                return std::to_chars(first, last, value, std::chars_format::general, precision);
+        }
+        return std::to_chars(first, last, value);
+    }
+
+    std::ostream& out;
+    std::unique_ptr<char[]> buffer;
+    char* cursor;
+};
+
+// Writes rows x columns elements, at(r, c), in the given format.
+template <class Scalar, class At>
+void writeTextRows(std::ostream& out, unsigned rows, unsigned columns, At at, const TextFormat& format) {
+    std::size_t separatorLength = std::strlen(format.separator);
+    if constexpr (TextScalar<Scalar>::fast){
+        TextWriter writer(out);
+        for (unsigned i = 0; i < rows; i++){
+            for (unsigned j = 0; j < columns; j++){
+                if (j && !format.trailingSeparator)
+                    writer.write(format.separator, separatorLength);
+                writer.scalar<Scalar>(at(i, j), format.precision);
+                if (format.trailingSeparator)
+                    writer.write(format.separator, separatorLength);
+            }
+            writer.put('\n');
+        }
+        writer.flush();
+    }
+    else
+        for (unsigned i = 0; i < rows; i++){
+            for (unsigned j = 0; j < columns; j++){
+                if (j && !format.trailingSeparator)
+                    out.write(format.separator, separatorLength);
+                out << at(i, j);
+                if (format.trailingSeparator)
+                    out.write(format.separator, separatorLength);
+            }
+            out.put('\n');
+        }
+}
+
+// operator<< of every matrix type: the whitespace format at the stream's
+// precision. Streams with formatting flags, a field width or a locale set
+// are printed element by element through the stream instead.
+template <class Scalar, class At>
+std::ostream& printMatrix(std::ostream& out, unsigned rows, unsigned columns, At at) {
+    const std::ios::fmtflags custom = std::ios::floatfield | std::ios::showpos | std::ios::showpoint |
+        std::ios::uppercase | std::ios::showbase | std::ios::hex | std::ios::oct;
+    if (TextScalar<Scalar>::fast && !(out.flags() & custom) && out.width() == 0
+            && out.getloc() == std::locale::classic())
+        writeTextRows<Scalar>(out, rows, columns, at, TextFormat::whitespace((int)out.precision()));
+    else
+        for (unsigned i = 0; i < rows; i++){
+            for (unsigned j = 0; j < columns; j++)
+                out << at(i, j) << "  ";
+            out << '\n';
+        }
+    return out;
+}
+
+inline bool isTextBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isTextSeparator(char c) {
+    return isTextBlank(c) || c == ',' || c == ';';
+}
+
+// Parses one number at first; returns the end of it, or nullptr if there
+// is no number there or it runs into something other than a separator.
+template <class Scalar>
+const char* parseTextScalar(const char* first, const char* last, Scalar& value) {
+    const char* end;
+    if constexpr (TextScalar<Scalar>::fast){
+        if (last - first > 1 && *first == '+' && first[1] != '-')
+            first++;
+        std::from_chars_result r = std::from_chars(first, last, value);
+        if (r.ec != std::errc())
+            return nullptr;
+        end = r.ptr;
+    }
+    else{
+        end = first;
+        while (end != last && !isTextSeparator(*end))
+            end++;
+        std::istringstream in(std::string(first, end));
+        in.imbue(std::locale::classic());
+        if (!(in >> value) || in.peek() != std::istringstream::traits_type::eof())
+            return nullptr;
+    }
+    return end == last || isTextSeparator(*end) ? end : nullptr;
+}
+
+// Appends the numbers on one line to row. Numbers are separated by blanks
+// and at most one comma or semicolon; a trailing one is allowed. Returns
+// false if the line is anything else.
+template <class Scalar, class Row>
+bool parseTextRow(const char* p, const char* last, Row& row) {
+    while (p != last && isTextBlank(*p))
+        p++;
+    while (p != last){
+        Scalar value;
+        if (!(p = parseTextScalar(p, last, value)))
+            return false;
+        row.push_back(value);
+        while (p != last && isTextBlank(*p))
+            p++;
+        if (p != last && (*p == ',' || *p == ';'))
+            p++;
+        while (p != last && isTextBlank(*p))
+            p++;
+    }
+    return true;
+}
+
+// Reads matrix text a line at a time and calls f(row, columns) for every
+// row; the row buffer is reused, so only one line is in memory at once.
+// Blank lines before the first row are skipped, and the first blank line
+// after it (or the end of the stream) ends the matrix. Returns the number
+// of rows read.
+template <class Scalar, class F>
+unsigned readTextRows(std::istream& in, F f) {
+    std::string line;
+    MatrixBuffer<Scalar> row;
+    unsigned rows = 0;
+    std::size_t columns = 0;
+    while (std::getline(in, line)){
+        row.clear();
+        if (!parseTextRow<Scalar>(line.data(), line.data() + line.size(), row))
+            throw std::runtime_error("Malformed matrix text");
+        if (row.empty()){
+            if (rows)
+                break;
+            continue;
+        }
+        if (rows && row.size() != columns)
+            throw std::runtime_error("Wrong number of elements");
+        columns = row.size();
+        f(static_cast<const Scalar*>(row.data()), (unsigned)columns);
+        rows++;
+    }
+    if (in.bad())
+        throw std::runtime_error("Read failed");
+    return rows;
+}
+
+// Reads a whole matrix into elements, row-major. Returns the number of
+// rows and sets columns.
+template <class Scalar>
+unsigned readTextElements(std::istream& in, MatrixBuffer<Scalar>& elements, unsigned& columns) {
+    columns = 0;
+    return readTextRows<Scalar>(in, [&](const Scalar* row, unsigned n) {
+        elements.insert(elements.end(), row, row + n);
+        columns = n;
+    });
+}
+
+#endif
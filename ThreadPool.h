@@ -0,0 +1,208 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent work-stealing pool used by the parallel kernels. Every worker
+// owns a deque: it pops its own tasks from the back and steals from the
+// front of the others. A thread waiting in parallelFor() executes pending
+// tasks too, so nested parallel calls cannot deadlock.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency()) {
+        start(threads);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        stop();
+    }
+
+    static ThreadPool& global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    unsigned getThreadCount() const { return threadCount; }
+
+    // Must not be called while a parallelFor() is running.
+    void setThreadCount(unsigned threads) {
+        if (threads == 0)
+            threads = 1;
+        if (threads == threadCount)
+            return;
+        stop();
+        start(threads);
+    }
+
+    // Number of scalar multiply-adds below which kernels stay serial.
+    unsigned long long getSerialThreshold() const { return serialThreshold; }
+    void setSerialThreshold(unsigned long long flops) { serialThreshold = flops; }
+
+    bool useParallel(unsigned long long flops) const {
+        return threadCount > 1 && flops >= serialThreshold;
+    }
+
+    // Calls f(lo, hi) on chunks of [begin, end) of at least grain elements
+    // and returns once every chunk has finished. The first exception thrown
+    // by a chunk is rethrown in the caller.
+    template <class F>
+    void parallelFor(unsigned begin, unsigned end, unsigned grain, F f) {
+        if (begin >= end)
+            return;
+        if (grain == 0)
+            grain = 1;
+        unsigned count = end - begin;
+        unsigned chunks = std::min((count + grain - 1) / grain, 4 * threadCount);
+        if (chunks <= 1 || threadCount <= 1){
+            f(begin, end);
+            return;
+        }
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>(chunks);
+        for (unsigned c = 0; c < chunks; c++){
+            unsigned lo = begin + (unsigned long long)count * c / chunks;
+            unsigned hi = begin + (unsigned long long)count * (c + 1) / chunks;
+            push([batch, f, lo, hi]() {
+                try {
+                    f(lo, hi);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    if (!batch->error)
+                        batch->error = std::current_exception();
+                }
+                batch->finish();
+            });
+        }
+        wait(*batch);
+    }
+
+private:
+    typedef std::function<void()> Task;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct Batch {
+        explicit Batch(unsigned count) : remaining(count) {}
+        void finish() {
+            if (--remaining == 0){
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+        std::atomic<unsigned> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+
+    void start(unsigned threads) {
+        threadCount = threads == 0 ? 1 : threads;
+        stopping = false;
+        queues.clear();
+        for (unsigned i = 0; i < threadCount; i++)
+            queues.emplace_back(new Queue);
+        for (unsigned i = 1; i < threadCount; i++)
+            workers.emplace_back(&ThreadPool::run, this, i);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    void push(Task task) {
+        unsigned index = nextQueue++ % threadCount;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    bool tryRun(unsigned self) {
+        Task task;
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()){
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+            }
+        }
+        for (unsigned i = 1; !task && i < threadCount; i++){
+            Queue& victim = *queues[(self + i) % threadCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()){
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+        if (!task)
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending--;
+        }
+        task();
+        return true;
+    }
+
+    void run(unsigned self) {
+        for (;;){
+            if (tryRun(self))
+                continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0)
+                return;
+        }
+    }
+
+    void wait(Batch& batch) {
+        while (batch.remaining > 0)
+            if (!tryRun(0)){
+                std::unique_lock<std::mutex> lock(batch.mutex);
+                batch.done.wait_for(lock, std::chrono::microseconds(100),
+                                    [&batch] { return batch.remaining == 0; });
+            }
+        if (batch.error)
+            std::rethrow_exception(batch.error);
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    unsigned pending = 0;
+    bool stopping = false;
+    std::atomic<unsigned> nextQueue{0};
+    unsigned threadCount = 1;
+    unsigned long long serialThreshold = 64 * 64 * 64;
+};
+
+#endif
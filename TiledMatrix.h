@@ -0,0 +1,652 @@
+#ifndef TILED_MATRIX_H
+#define TILED_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Gemm.h"
+#include "Matrix.h"
+#include "Serialization.h"
+#include "Simd.h"
+#include "Transpose.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Out-of-core matrices for data larger than memory. A TiledMatrix lives in
+// a file as square tiles of tileSize x tileSize elements, each row-major
+// and stored contiguously, tile rows one after another. Edge tiles are
+// padded to full size with zeros. Tiles are brought into memory by the
+// process-wide TileCache, which keeps the most recently used ones within
+// a memory budget and writes modified ones back when it evicts them:
+//
+//     setOutOfCoreMemoryBudget(std::size_t(8) << 30);
+//     TiledMatrix<double> a("a.tiles"), b("b.tiles");
+//     TiledMatrix<double> c = a.multiply(b, "c.tiles");
+//
+// Products, transposes and sums run tile by tile and ask the cache to read
+// the tiles of the next step in the background while the current one is
+// computed. Results without a path go to an unlinked temporary file that
+// disappears with the matrix.
+
+inline std::atomic<std::size_t>& outOfCoreMemoryBudgetSetting() {
+    static std::atomic<std::size_t> budget{std::size_t(1) << 30};
+    return budget;
+}
+
+inline std::size_t getOutOfCoreMemoryBudget() {
+    return outOfCoreMemoryBudgetSetting();
+}
+
+// Bytes of tiles the cache may hold. Pinned tiles are never evicted, so a
+// budget below the few tiles an operation needs at once is exceeded.
+inline void setOutOfCoreMemoryBudget(std::size_t bytes) {
+    outOfCoreMemoryBudgetSetting() = bytes;
+}
+
+inline void readFully(int fd, char* buffer, std::size_t bytes, std::uint64_t offset) {
+    while (bytes > 0){
+        ssize_t done = ::pread(fd, buffer, bytes, (off_t)offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            throw std::runtime_error("Tile read failed");
+        buffer += done;
+        bytes -= done;
+        offset += done;
+    }
+}
+
+inline void writeFully(int fd, const char* buffer, std::size_t bytes, std::uint64_t offset) {
+    while (bytes > 0){
+        ssize_t done = ::pwrite(fd, buffer, bytes, (off_t)offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            throw std::runtime_error("Tile write failed");
+        buffer += done;
+        bytes -= done;
+        offset += done;
+    }
+}
+
+// LRU cache of file blocks, keyed by file descriptor and offset. acquire()
+// pins a block until its Handle is released; prefetch() starts reading a
+// block on a background thread if it fits in the budget. Evicting a dirty
+// block writes it back first, under the cache lock.
+class TileCache {
+    struct Entry {
+        int fd;
+        std::uint64_t offset;
+        std::size_t bytes;
+        std::unique_ptr<char[]> data;
+        std::shared_future<void> ready;
+        unsigned pins = 0;
+        bool dirty = false;
+    };
+
+public:
+    class Handle {
+    public:
+        Handle() {}
+        Handle(TileCache* cache, Entry* entry) : cache(cache), entry(entry) {}
+        ~Handle() { release(); }
+
+        Handle(Handle&& h) : cache(h.cache), entry(h.entry) { h.entry = nullptr; }
+
+        Handle& operator=(Handle&& h) {
+            if (this != &h){
+                release();
+                cache = h.cache;
+                entry = h.entry;
+                h.entry = nullptr;
+            }
+            return *this;
+        }
+
+        char* data() const { return entry->data.get(); }
+
+        void markDirty() {
+            std::lock_guard<std::mutex> guard(cache->lock);
+            entry->dirty = true;
+        }
+
+        void release() {
+            if (entry){
+                std::lock_guard<std::mutex> guard(cache->lock);
+                entry->pins--;
+                entry = nullptr;
+            }
+        }
+
+    private:
+        TileCache* cache = nullptr;
+        Entry* entry = nullptr;
+    };
+
+    static TileCache& global() {
+        static TileCache cache;
+        return cache;
+    }
+
+    // With load unset a block that is not cached starts out zero instead
+    // of being read, for blocks that are about to be overwritten.
+    Handle acquire(int fd, std::uint64_t offset, std::size_t bytes, bool load = true) {
+        std::shared_future<void> ready;
+        Entry* entry;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entry = &find(fd, offset, bytes, load ? std::launch::deferred : std::launch::async, load);
+            entry->pins++;
+            ready = entry->ready;
+        }
+        try{
+            ready.get();
+        }
+        catch (...){
+            std::lock_guard<std::mutex> guard(lock);
+            entry->pins--;
+            erase(fd, offset);
+            throw;
+        }
+        return Handle(this, entry);
+    }
+
+    void prefetch(int fd, std::uint64_t offset, std::size_t bytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (index.count(std::make_pair(fd, offset)))
+            return;
+        if (!makeRoom(bytes))
+            return;
+        find(fd, offset, bytes, std::launch::async, true);
+    }
+
+    // Writes back every dirty block of fd.
+    void flush(int fd) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (Entry& e : entries)
+            if (e.fd == fd)
+                writeBack(e);
+    }
+
+    // Forgets every block of fd, writing dirty ones back unless discard is
+    // set. No block of fd may be pinned.
+    void drop(int fd, bool discard) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto e = entries.begin(); e != entries.end(); ){
+            auto next = std::next(e);
+            if (e->fd == fd){
+                e->ready.wait();
+                if (!discard)
+                    writeBack(*e);
+                resident -= e->bytes;
+                index.erase(std::make_pair(e->fd, e->offset));
+                entries.erase(e);
+            }
+            e = next;
+        }
+    }
+
+    std::size_t getResidentBytes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return resident;
+    }
+
+private:
+    typedef std::list<Entry>::iterator Position;
+
+    // Called with the lock held: the cached entry, moved to the front, or
+    // a new one whose contents are read by policy.
+    Entry& find(int fd, std::uint64_t offset, std::size_t bytes, std::launch policy, bool load) {
+        auto found = index.find(std::make_pair(fd, offset));
+        if (found != index.end()){
+            entries.splice(entries.begin(), entries, found->second);
+            return *found->second;
+        }
+        makeRoom(bytes);
+        entries.emplace_front();
+        Entry& e = entries.front();
+        e.fd = fd;
+        e.offset = offset;
+        e.bytes = bytes;
+        e.data.reset(new char[bytes]());
+        if (load){
+            Entry* p = &e;
+            e.ready = std::async(policy, [p] { readFully(p->fd, p->data.get(), p->bytes, p->offset); }).share();
+        } else{
+            std::promise<void> done;
+            done.set_value();
+            e.ready = done.get_future().share();
+        }
+        index[std::make_pair(fd, offset)] = entries.begin();
+        resident += bytes;
+        return e;
+    }
+
+    void erase(int fd, std::uint64_t offset) {
+        auto found = index.find(std::make_pair(fd, offset));
+        if (found == index.end() || found->second->pins != 0)
+            return;
+        resident -= found->second->bytes;
+        entries.erase(found->second);
+        index.erase(found);
+    }
+
+    // Evicts unpinned entries from the back until bytes more fit in the
+    // budget. Returns false if they still do not.
+    bool makeRoom(std::size_t bytes) {
+        std::size_t budget = getOutOfCoreMemoryBudget();
+        for (auto e = entries.end(); resident + bytes > budget && e != entries.begin(); ){
+            --e;
+            if (e->pins != 0)
+                continue;
+            e->ready.wait();
+            writeBack(*e);
+            resident -= e->bytes;
+            index.erase(std::make_pair(e->fd, e->offset));
+            e = entries.erase(e);
+        }
+        return resident + bytes <= budget;
+    }
+
+    void writeBack(Entry& e) {
+        if (!e.dirty)
+            return;
+        e.ready.wait();
+        writeFully(e.fd, e.data.get(), e.bytes, e.offset);
+        e.dirty = false;
+    }
+
+    std::mutex lock;
+    std::list<Entry> entries;                   // most recently used first
+    std::map<std::pair<int, std::uint64_t>, Position> index;
+    std::size_t resident = 0;
+};
+
+// Header of a tiled matrix file, laid out like MatrixFileHeader with the
+// tile size in place of the alignment. Tiles start at dataOffset.
+struct TiledFileHeader {
+    static constexpr std::uint16_t currentVersion = 1;
+
+    char magic[8];
+    std::uint32_t byteOrder;
+    std::uint16_t version;
+    std::uint16_t headerSize;
+    char scalarKind;
+    std::uint8_t scalarSize;
+    std::uint8_t reserved0[2];
+    std::uint32_t tileSize;
+    std::uint64_t rows;
+    std::uint64_t columns;
+    std::uint64_t dataOffset;
+    std::uint8_t reserved[16];
+};
+
+static_assert(sizeof(TiledFileHeader) == 64, "TiledFileHeader must be 64 bytes");
+
+template <class Scalar>
+class TiledMatrix {
+public:
+    static constexpr unsigned defaultTileSize = 1024;
+
+    // A pinned tile: tileSize x tileSize elements with stride tileSize, of
+    // which the top-left getRows() x getColumns() are inside the matrix.
+    // Call markDirty() after writing; the padding must stay zero.
+    class Tile {
+    public:
+        Tile(TileCache::Handle handle, unsigned rows, unsigned columns, unsigned stride) :
+            handle(std::move(handle)), rows(rows), columns(columns), stride(stride) {}
+
+        Scalar* data() const { return reinterpret_cast<Scalar*>(handle.data()); }
+        unsigned getRows() const { return rows; }
+        unsigned getColumns() const { return columns; }
+        unsigned getStride() const { return stride; }
+        MatrixRef<Scalar> ref() const { return MatrixRef<Scalar>(data(), rows, columns, stride); }
+        void markDirty() { handle.markDirty(); }
+
+    private:
+        TileCache::Handle handle;
+        unsigned rows, columns, stride;
+    };
+
+    // Creates path, all zeros. The file is sparse where the filesystem
+    // allows it.
+    TiledMatrix(const std::string& path, unsigned rows, unsigned columns, unsigned tileSize = defaultTileSize) :
+        rows(rows), columns(columns), tileSize(tileSize) {
+        if (tileSize == 0)
+            throw std::runtime_error("Wrong tile size");
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Cannot create " + path);
+        initialize();
+    }
+
+    // Opens an existing tiled matrix file for reading and writing.
+    explicit TiledMatrix(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + path);
+        try{
+            TiledFileHeader h;
+            readFully(fd, reinterpret_cast<char*>(&h), sizeof(h), 0);
+            if (std::memcmp(h.magic, "PATILED", 8) != 0)
+                throw std::runtime_error("Not a tiled matrix file");
+            if (h.byteOrder != MatrixFileHeader::nativeOrder)
+                throw std::runtime_error("Matrix file has foreign byte order");
+            if (h.version > TiledFileHeader::currentVersion)
+                throw std::runtime_error("Unsupported matrix file version");
+            if (h.scalarKind != BinaryScalar<Scalar>::kind || h.scalarSize != sizeof(Scalar))
+                throw std::runtime_error("Wrong scalar type");
+            if (h.tileSize == 0 || h.rows > UINT_MAX || h.columns > UINT_MAX || h.dataOffset < sizeof(h))
+                throw std::runtime_error("Corrupt matrix file header");
+            rows = h.rows;
+            columns = h.columns;
+            tileSize = h.tileSize;
+            dataOffset = h.dataOffset;
+            struct stat info;
+            if (::fstat(fd, &info) != 0 || (std::uint64_t)info.st_size < dataOffset + tileBytes() * tileCount())
+                throw std::runtime_error("Truncated matrix file");
+        }
+        catch (...){
+            ::close(fd);
+            throw;
+        }
+    }
+
+    // An unnamed matrix in a temporary file that is removed at once and
+    // vanishes when the matrix is destroyed.
+    static TiledMatrix temporary(unsigned rows, unsigned columns, unsigned tileSize = defaultTileSize) {
+        std::string path = (std::filesystem::temp_directory_path() / "matrix-XXXXXX").string();
+        int fd = ::mkstemp(&path[0]);
+        if (fd < 0)
+            throw std::runtime_error("Cannot create a temporary file");
+        ::unlink(path.c_str());
+        return TiledMatrix(fd, rows, columns, tileSize);
+    }
+
+    template <class M>
+    static TiledMatrix fromMatrix(const std::string& path, const M& m, unsigned tileSize = defaultTileSize) {
+        TiledMatrix t(path, m.getRows(), m.getColumns(), tileSize);
+        t.assign(MatrixRef<const Scalar>(m.ref()));
+        return t;
+    }
+
+    ~TiledMatrix() { close(); }
+
+    TiledMatrix(const TiledMatrix&) = delete;
+    TiledMatrix& operator=(const TiledMatrix&) = delete;
+
+    TiledMatrix(TiledMatrix&& m) :
+        fd(m.fd), rows(m.rows), columns(m.columns), tileSize(m.tileSize), dataOffset(m.dataOffset),
+        discard(m.discard) {
+        m.fd = -1;
+    }
+
+    TiledMatrix& operator=(TiledMatrix&& m) {
+        if (this != &m){
+            close();
+            fd = m.fd;
+            rows = m.rows;
+            columns = m.columns;
+            tileSize = m.tileSize;
+            dataOffset = m.dataOffset;
+            discard = m.discard;
+            m.fd = -1;
+        }
+        return *this;
+    }
+
+    unsigned getRows() const { return rows; }
+    unsigned getColumns() const { return columns; }
+    unsigned getTileSize() const { return tileSize; }
+    unsigned getTileRows() const { return (rows + tileSize - 1) / tileSize; }
+    unsigned getTileColumns() const { return (columns + tileSize - 1) / tileSize; }
+
+    // With load unset a tile that is not cached is not read but starts out
+    // zero, for tiles that are about to be overwritten completely.
+    Tile tile(unsigned tileRow, unsigned tileColumn, bool load = true) const {
+        if (tileRow >= getTileRows() || tileColumn >= getTileColumns())
+            throw std::out_of_range("TiledMatrix::tile");
+        return Tile(TileCache::global().acquire(fd, tileOffset(tileRow, tileColumn), tileBytes(), load),
+                    std::min(tileSize, rows - tileRow * tileSize),
+                    std::min(tileSize, columns - tileColumn * tileSize), tileSize);
+    }
+
+    void prefetch(unsigned tileRow, unsigned tileColumn) const {
+        if (tileRow < getTileRows() && tileColumn < getTileColumns())
+            TileCache::global().prefetch(fd, tileOffset(tileRow, tileColumn), tileBytes());
+    }
+
+    // Writes the modified tiles back to the file.
+    void flush() const {
+        TileCache::global().flush(fd);
+    }
+
+    Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("TiledMatrix::operator()");
+        return tile(r / tileSize, c / tileSize).data()[(std::size_t)(r % tileSize) * tileSize + c % tileSize];
+    }
+
+    void set(unsigned r, unsigned c, Scalar value) {
+        if (r >= rows || c >= columns)
+            throw std::out_of_range("TiledMatrix::set");
+        Tile t = tile(r / tileSize, c / tileSize);
+        t.data()[(std::size_t)(r % tileSize) * tileSize + c % tileSize] = value;
+        t.markDirty();
+    }
+
+    // Copies a matrix of the same shape in, tile by tile.
+    void assign(const MatrixRef<const Scalar>& m) {
+        if (m.getRows() != rows || m.getColumns() != columns)
+            throw std::runtime_error("Wrong size");
+        forEachTile([&](unsigned i, unsigned j) {
+            Tile t = tile(i, j, false);
+            for (unsigned r = 0; r < t.getRows(); r++)
+                std::copy(m.row(i * tileSize + r) + j * tileSize, m.row(i * tileSize + r) + j * tileSize + t.getColumns(),
+                          t.data() + (std::size_t)r * tileSize);
+            t.markDirty();
+        });
+    }
+
+    Matrix<Scalar> toDense() const {
+        Matrix<Scalar> m(rows, columns);
+        MatrixRef<Scalar> dense = m.ref();
+        forEachTile([&](unsigned i, unsigned j) {
+            prefetchNext(i, j);
+            Tile t = tile(i, j);
+            for (unsigned r = 0; r < t.getRows(); r++)
+                std::copy(t.data() + (std::size_t)r * tileSize, t.data() + (std::size_t)r * tileSize + t.getColumns(),
+                          dense.row(i * tileSize + r) + j * tileSize);
+        });
+        return m;
+    }
+
+    // C = A * B into path (or a temporary file). For every tile of C the
+    // tile row of A and the tile column of B stream through the cache; with
+    // a budget of a full tile row of A plus a few tiles, A is read once and
+    // B once per tile row of A.
+    TiledMatrix multiply(const TiledMatrix& b, const std::string& path = std::string()) const {
+        if (columns != b.rows)
+            throw std::runtime_error("Wrong size");
+        if (tileSize != b.tileSize)
+            throw std::runtime_error("Wrong tile size");
+        TiledMatrix c = create(path, rows, b.columns);
+        unsigned inner = getTileColumns();
+        c.forEachTile([&](unsigned i, unsigned j) {
+            Tile result = c.tile(i, j, false);
+            for (unsigned k = 0; k < inner; k++){
+                if (k + 1 < inner){
+                    prefetch(i, k + 1);
+                    b.prefetch(k + 1, j);
+                } else if (j + 1 < c.getTileColumns())
+                    b.prefetch(0, j + 1);
+                else{
+                    prefetch(i + 1, 0);
+                    b.prefetch(0, 0);
+                }
+                Tile left = tile(i, k), right = b.tile(k, j);
+                gemm(result.getRows(), result.getColumns(), left.getColumns(), left.data(), tileSize,
+                     right.data(), tileSize, result.data(), tileSize);
+            }
+            result.markDirty();
+        });
+        return c;
+    }
+
+    TiledMatrix operator*(const TiledMatrix& b) const {
+        return multiply(b);
+    }
+
+    TiledMatrix transpone(const std::string& path = std::string()) const {
+        TiledMatrix t = create(path, columns, rows);
+        forEachTile([&](unsigned i, unsigned j) {
+            prefetchNext(i, j);
+            Tile source = tile(i, j);
+            Tile target = t.tile(j, i, false);
+            transpose(tileSize, tileSize, source.data(), tileSize, target.data(), tileSize);
+            target.markDirty();
+        });
+        return t;
+    }
+
+    TiledMatrix add(const TiledMatrix& m, const std::string& path = std::string()) const {
+        return combine(m, path, [](Scalar* a, const Scalar* b, std::size_t n) { simdAdd(a, b, n); });
+    }
+
+    TiledMatrix subtract(const TiledMatrix& m, const std::string& path = std::string()) const {
+        return combine(m, path, [](Scalar* a, const Scalar* b, std::size_t n) { simdSub(a, b, n); });
+    }
+
+    TiledMatrix operator+(const TiledMatrix& m) const { return add(m); }
+    TiledMatrix operator-(const TiledMatrix& m) const { return subtract(m); }
+
+    TiledMatrix& operator+=(const TiledMatrix& m) {
+        update(m, [](Scalar* a, const Scalar* b, std::size_t n) { simdAdd(a, b, n); });
+        return *this;
+    }
+
+    TiledMatrix& operator-=(const TiledMatrix& m) {
+        update(m, [](Scalar* a, const Scalar* b, std::size_t n) { simdSub(a, b, n); });
+        return *this;
+    }
+
+private:
+    TiledMatrix(int fd, unsigned rows, unsigned columns, unsigned tileSize) :
+        fd(fd), rows(rows), columns(columns), tileSize(tileSize), discard(true) {
+        if (tileSize == 0){
+            ::close(fd);
+            throw std::runtime_error("Wrong tile size");
+        }
+        initialize();
+    }
+
+    TiledMatrix create(const std::string& path, unsigned r, unsigned c) const {
+        return path.empty() ? temporary(r, c, tileSize) : TiledMatrix(path, r, c, tileSize);
+    }
+
+    void initialize() {
+        TiledFileHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "PATILED", 8);
+        h.byteOrder = MatrixFileHeader::nativeOrder;
+        h.version = TiledFileHeader::currentVersion;
+        h.headerSize = sizeof(h);
+        h.scalarKind = BinaryScalar<Scalar>::kind;
+        h.scalarSize = sizeof(Scalar);
+        h.tileSize = tileSize;
+        h.rows = rows;
+        h.columns = columns;
+        h.dataOffset = dataOffset;
+        try{
+            writeFully(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0);
+            if (::ftruncate(fd, (off_t)(dataOffset + tileBytes() * tileCount())) != 0)
+                throw std::runtime_error("Cannot size matrix file");
+        }
+        catch (...){
+            ::close(fd);
+            throw;
+        }
+    }
+
+    void close() {
+        if (fd < 0)
+            return;
+        TileCache::global().drop(fd, discard);
+        ::close(fd);
+        fd = -1;
+    }
+
+    std::uint64_t tileBytes() const { return (std::uint64_t)tileSize * tileSize * sizeof(Scalar); }
+    std::uint64_t tileCount() const { return (std::uint64_t)getTileRows() * getTileColumns(); }
+
+    std::uint64_t tileOffset(unsigned tileRow, unsigned tileColumn) const {
+        return dataOffset + ((std::uint64_t)tileRow * getTileColumns() + tileColumn) * tileBytes();
+    }
+
+    template <class F>
+    void forEachTile(F f) const {
+        for (unsigned i = 0; i < getTileRows(); i++)
+            for (unsigned j = 0; j < getTileColumns(); j++)
+                f(i, j);
+    }
+
+    void prefetchNext(unsigned i, unsigned j) const {
+        if (j + 1 < getTileColumns())
+            prefetch(i, j + 1);
+        else
+            prefetch(i + 1, 0);
+    }
+
+    template <class F>
+    TiledMatrix combine(const TiledMatrix& m, const std::string& path, F f) const {
+        checkShape(m);
+        TiledMatrix result = create(path, rows, columns);
+        forEachTile([&](unsigned i, unsigned j) {
+            prefetchNext(i, j);
+            m.prefetchNext(i, j);
+            Tile left = tile(i, j), right = m.tile(i, j);
+            Tile target = result.tile(i, j, false);
+            std::copy(left.data(), left.data() + tileBytes() / sizeof(Scalar), target.data());
+            f(target.data(), right.data(), tileBytes() / sizeof(Scalar));
+            target.markDirty();
+        });
+        return result;
+    }
+
+    template <class F>
+    void update(const TiledMatrix& m, F f) {
+        checkShape(m);
+        forEachTile([&](unsigned i, unsigned j) {
+            prefetchNext(i, j);
+            m.prefetchNext(i, j);
+            Tile target = tile(i, j), right = m.tile(i, j);
+            f(target.data(), right.data(), tileBytes() / sizeof(Scalar));
+            target.markDirty();
+        });
+    }
+
+    void checkShape(const TiledMatrix& m) const {
+        if (rows != m.rows || columns != m.columns)
+            throw std::runtime_error("Wrong size");
+        if (tileSize != m.tileSize)
+            throw std::runtime_error("Wrong tile size");
+    }
+
+    int fd = -1;
+    unsigned rows = 0, columns = 0, tileSize = defaultTileSize;
+    std::uint64_t dataOffset = sizeof(TiledFileHeader);
+    bool discard = false;   // temporary file: dirty tiles need not be written
+};
+
+#endif
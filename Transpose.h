@@ -0,0 +1,86 @@
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include "Simd.h"
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Out-of-place transpose dst (columns x rows) = src^T, strides in elements.
+// The block is halved along its longer side until both fit a 32 x 32 leaf,
+// so every level of the cache sees tiles that fit it without the tile size
+// being tuned; leaves are transposed with the SIMD tile kernel.
+template <class Scalar>
+void transpose(unsigned rows, unsigned columns, const Scalar* src, std::size_t srcStride,
+               Scalar* dst, std::size_t dstStride) {
+    if (rows <= 32 && columns <= 32){
+        simdTranspose(src, srcStride, dst, dstStride, rows, columns);
+        return;
+    }
+    // Split points are multiples of 16 so leaves hold whole SIMD tiles.
+    if (rows >= columns){
+        unsigned half = (rows / 2 + 15) / 16 * 16;
+        transpose(half, columns, src, srcStride, dst, dstStride);
+        transpose(rows - half, columns, src + half * srcStride, srcStride, dst + half, dstStride);
+    }
+    else{
+        unsigned half = (columns / 2 + 15) / 16 * 16;
+        transpose(rows, half, src, srcStride, dst, dstStride);
+        transpose(rows, columns - half, src + half, srcStride, dst + half * dstStride, dstStride);
+    }
+}
+
+// In-place transpose of a size x size block. Mirrored tile pairs are
+// swapped through one tile-sized buffer, so the extra memory is constant.
+template <class Scalar>
+void transposeInPlace(unsigned size, Scalar* a, std::size_t stride) {
+    const unsigned tile = 32;
+    Scalar buffer[tile * tile];
+    for (unsigned i = 0; i < size; i += tile){
+        unsigned ti = std::min(tile, size - i);
+        Scalar* diagonal = a + i * stride + i;
+        simdTranspose(diagonal, stride, buffer, ti, ti, ti);
+        for (unsigned r = 0; r < ti; r++)
+            std::copy(buffer + r * ti, buffer + (r + 1) * ti, diagonal + r * stride);
+        for (unsigned j = i + tile; j < size; j += tile){
+            unsigned tj = std::min(tile, size - j);
+            Scalar* upper = a + i * stride + j;
+            Scalar* lower = a + j * stride + i;
+            simdTranspose(upper, stride, buffer, ti, ti, tj);
+            simdTranspose(lower, stride, upper, stride, tj, ti);
+            for (unsigned r = 0; r < tj; r++)
+                std::copy(buffer + r * ti, buffer + (r + 1) * ti, lower + r * stride);
+        }
+    }
+}
+
+// In-place transpose of a contiguous rows x columns matrix. Square ones use
+// the tiled swap above; otherwise element k moves to k * rows mod (n - 1)
+// and each permutation cycle is followed once, marking visited elements in
+// a bit set (one bit per element instead of a second copy of the matrix).
+template <class Scalar>
+void transposeInPlace(unsigned rows, unsigned columns, Scalar* a) {
+    if (rows == columns){
+        transposeInPlace(rows, a, columns);
+        return;
+    }
+    std::size_t count = (std::size_t)rows * columns;
+    if (rows == 1 || columns == 1)
+        return;
+    std::size_t last = count - 1;
+    std::vector<bool> visited(count);
+    for (std::size_t start = 1; start < last; start++){
+        if (visited[start])
+            continue;
+        Scalar value = a[start];
+        std::size_t k = start;
+        do {
+            k = k * rows % last;
+            std::swap(a[k], value);
+            visited[k] = true;
+        } while (k != start);
+    }
+}
+
+#endif
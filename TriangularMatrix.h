@@ -0,0 +1,404 @@
+#ifndef TRIANGULAR_MATRIX_H
+#define TRIANGULAR_MATRIX_H
+
+#include "AbstractMatrix.h"
+#include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "Vector.h"
+
+// Upper or lower triangular square matrix in packed storage: only the
+// triangle is kept, row by row, n (n + 1) / 2 elements. det() is the
+// product of the diagonal, solve() is a single O(n^2) substitution, and
+// products touch only the stored half.
+template <class Scalar_>
+class TriangularMatrix {
+public:
+    typedef Scalar_ Scalar;
+
+    TriangularMatrix() {}
+
+    TriangularMatrix(unsigned size, bool upper, Scalar value = Scalar()) :
+        packed(packedSize(size), value), size(size), upper(upper) {}
+
+    // The triangle row by row: for lower (0,0), (1,0), (1,1), (2,0), ...,
+    // for upper (0,0), (0,1), ..., (0,n-1), (1,1), ...
+    TriangularMatrix(unsigned size, bool upper, MatrixBuffer<Scalar> values) :
+        packed(std::move(values)), size(size), upper(upper) {
+        if (packed.size() != packedSize(size))
+            throw std::runtime_error("Wrong number of elements");
+    }
+
+    // The upper or lower triangle of m; the other one must be zero.
+    TriangularMatrix(const AbstractMatrix<Scalar>& m, bool upper) :
+        packed(packedSize(m.getRows())), size(m.getRows()), upper(upper) {
+        if (!m.isSquare())
+            throw std::runtime_error("Not a square matrix");
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++){
+            const Scalar* row = dense.row(i);
+            for (unsigned j = 0; j < size; j++)
+                if ((upper ? j < i : j > i) && row[j] != Scalar(0))
+                    throw std::runtime_error("Not a triangular matrix");
+            std::copy(row + first(i), row + last(i), packed.data() + rowStart(i));
+        }
+    }
+
+    static std::size_t packedSize(unsigned size) { return (std::size_t)size * (size + 1) / 2; }
+
+    Matrix<Scalar> toDense() const {
+        MatrixBuffer<Scalar> elements((std::size_t)size * size, 0);
+        for (unsigned i = 0; i < size; i++)
+            std::copy(row(i), row(i) + (last(i) - first(i)), elements.data() + (std::size_t)i * size + first(i));
+        return Matrix<Scalar>(size, size, std::move(elements));
+    }
+
+    unsigned getRows() const { return size; }
+    unsigned getColumns() const { return size; }
+    bool isUpper() const { return upper; }
+    bool isLower() const { return !upper; }
+    bool isSquare() const { return true; }
+    bool isVector() const { return size == 1; }
+    bool isZero() const { return simdIsZero(packed.data(), packed.size()); }
+
+    bool isDiagonal() const {
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = first(i); j < last(i); j++)
+                if (i != j && at(i, j) != Scalar(0))
+                    return false;
+        return true;
+    }
+
+    bool isIdentity() const {
+        if (!isDiagonal())
+            return false;
+        for (unsigned i = 0; i < size; i++)
+            if (at(i, i) != Scalar(1))
+                return false;
+        return true;
+    }
+
+    const MatrixBuffer<Scalar>& getPacked() const { return packed; }
+    Scalar* data() { return packed.data(); }
+    const Scalar* data() const { return packed.data(); }
+
+    // Stored part of row r, columns [first(r), last(r)).
+    const Scalar* row(unsigned r) const {
+        assert(r < size);
+        return packed.data() + rowStart(r);
+    }
+
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < size && c < size);
+        return stored(r, c) ? at(r, c) : Scalar(0);
+    }
+
+    Scalar operator()(unsigned r, unsigned c) const {
+        if (r >= size || c >= size)
+            throw std::out_of_range("TriangularMatrix::operator()");
+        return stored(r, c) ? at(r, c) : Scalar(0);
+    }
+
+    // Only elements of the stored triangle can be written.
+    Scalar& operator()(unsigned r, unsigned c) {
+        if (r >= size || c >= size || !stored(r, c))
+            throw std::out_of_range("TriangularMatrix::operator()");
+        return packed[rowStart(r) + c - first(r)];
+    }
+
+    bool operator==(const TriangularMatrix& m) const {
+        if (size != m.size)
+            return false;
+        if (upper == m.upper)
+            return packed == m.packed;
+        return isDiagonal() && m.isDiagonal() && toDense() == m.toDense();
+    }
+
+    bool operator!=(const TriangularMatrix& m) const { return !(*this == m); }
+
+    bool operator==(const AbstractMatrix<Scalar>& m) const {
+        if (size != m.getRows() || size != m.getColumns())
+            return false;
+        MatrixRef<const Scalar> dense = m.ref();
+        for (unsigned i = 0; i < size; i++)
+            for (unsigned j = 0; j < size; j++)
+                if (dense(i, j) != unchecked(i, j))
+                    return false;
+        return true;
+    }
+
+    bool operator!=(const AbstractMatrix<Scalar>& m) const { return !(*this == m); }
+
+    Scalar max() const {
+        Scalar result = simdMax(packed.data(), packed.size());
+        return size > 1 && result < Scalar(0) ? Scalar(0) : result;
+    }
+
+    Scalar min() const {
+        Scalar result = simdMin(packed.data(), packed.size());
+        return size > 1 && Scalar(0) < result ? Scalar(0) : result;
+    }
+
+    Scalar trace() const {
+        Scalar trace = 0;
+        for (unsigned i = 0; i < size; i++)
+            trace += at(i, i);
+        return trace;
+    }
+
+    TriangularMatrix& operator+=(const TriangularMatrix& m) {
+        if (size != m.size || upper != m.upper)
+            throw std::runtime_error("Wrong size");
+        simdAdd(packed.data(), m.packed.data(), packed.size());
+        return *this;
+    }
+
+    TriangularMatrix& operator-=(const TriangularMatrix& m) {
+        if (size != m.size || upper != m.upper)
+            throw std::runtime_error("Wrong size");
+        simdSub(packed.data(), m.packed.data(), packed.size());
+        return *this;
+    }
+
+    TriangularMatrix& operator*=(const Scalar& c) {
+        simdScale(packed.data(), c, packed.size());
+        return *this;
+    }
+
+    // y = T * x for a column vector x.
+    Vector<Scalar> operator*(const Vector<Scalar>& x) const {
+        if (x.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        MatrixBuffer<Scalar> y(size);
+        const Scalar* xs = x.data();
+        for (unsigned i = 0; i < size; i++){
+            const Scalar* r = row(i);
+            Scalar sum = 0;
+            for (unsigned j = first(i); j < last(i); j++)
+                sum += r[j - first(i)] * xs[j];
+            y[i] = sum;
+        }
+        return Vector<Scalar>(size, true, std::move(y));
+    }
+
+    // C = T * B in blocks of 64 rows. A block of a lower triangle only
+    // reaches columns up to its last row, one of an upper triangle only
+    // from its first row on, so each block is unpacked into a dense panel
+    // of that width and multiplied by gemm, about half the work of the
+    // dense product.
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
+        if (m.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        const unsigned block = 64;
+        unsigned columns = m.getColumns();
+        MatrixBuffer<Scalar> elements((std::size_t)size * columns, 0);
+        MatrixBuffer<Scalar> panel;
+        for (unsigned i0 = 0; i0 < size && columns != 0; i0 += block){
+            unsigned i1 = std::min(size, i0 + block);
+            unsigned k0 = upper ? i0 : 0, k1 = upper ? size : i1, width = k1 - k0;
+            panel.assign((std::size_t)(i1 - i0) * width, 0);
+            for (unsigned i = i0; i < i1; i++)
+                std::copy(row(i), row(i) + (last(i) - first(i)),
+                          panel.data() + (std::size_t)(i - i0) * width + first(i) - k0);
+            gemm(i1 - i0, columns, width, panel.data(), width, m.data() + (std::size_t)k0 * columns, columns,
+                 elements.data() + (std::size_t)i0 * columns, columns);
+        }
+        return Matrix<Scalar>(size, columns, std::move(elements));
+    }
+
+    // The product of two triangles of the same kind is again one.
+    TriangularMatrix operator*(const TriangularMatrix& m) const {
+        if (size != m.size || upper != m.upper)
+            throw std::runtime_error("Wrong size");
+        TriangularMatrix result(size, upper, Scalar(0));
+        for (unsigned i = 0; i < size; i++){
+            Scalar* c = result.packed.data() + rowStart(i);
+            const Scalar* r = row(i);
+            for (unsigned k = first(i); k < last(i); k++){
+                Scalar a = r[k - first(i)];
+                const Scalar* bRow = m.row(k);
+                // Row k of m covers [first(k), last(k)), which lies inside
+                // [first(i), last(i)) for k in the stored range of row i.
+                Scalar* ck = c + (m.first(k) - first(i));
+                for (unsigned j = 0; j < m.last(k) - m.first(k); j++)
+                    ck[j] += a * bRow[j];
+            }
+        }
+        return result;
+    }
+
+    template<typename T = double>
+    T det() const {
+        T det = 1;
+        for (unsigned i = 0; i < size; i++)
+            det *= (T)at(i, i);
+        return det;
+    }
+
+    // Column by column substitution against the identity; the inverse is
+    // triangular of the same kind.
+    template<typename T = double>
+    TriangularMatrix<T> invert() const {
+        checkSingular();
+        TriangularMatrix<T> inverse(size, upper, T(0));
+        std::vector<T> column(size);
+        for (unsigned j = 0; j < size; j++){
+            column[j] = 1 / (T)at(j, j);
+            if (upper){
+                for (unsigned i = j; i-- > 0; ){
+                    const Scalar* r = row(i);
+                    T sum = 0;
+                    for (unsigned k = i + 1; k <= j; k++)
+                        sum += (T)r[k - i] * column[k];
+                    column[i] = -sum / (T)r[0];
+                }
+                for (unsigned i = 0; i <= j; i++)
+                    inverse.element(i, j) = column[i];
+            } else{
+                for (unsigned i = j + 1; i < size; i++){
+                    const Scalar* r = row(i);
+                    T sum = 0;
+                    for (unsigned k = j; k < i; k++)
+                        sum += (T)r[k] * column[k];
+                    column[i] = -sum / (T)r[i];
+                }
+                for (unsigned i = j; i < size; i++)
+                    inverse.element(i, j) = column[i];
+            }
+        }
+        return inverse;
+    }
+
+    template<typename T>
+    Vector<T> solve(const Vector<T>& b) const {
+        if (b.getRows() * b.getColumns() != size)
+            throw std::runtime_error("Wrong size");
+        Vector<T> x(b);
+        solveInPlace(x.data(), 1);
+        return x;
+    }
+
+    template<typename T>
+    Matrix<T> solve(const AbstractMatrix<T>& b) const {
+        if (b.getRows() != size)
+            throw std::runtime_error("Wrong size");
+        Matrix<T> x(b);
+        solveInPlace(x.data(), b.getColumns());
+        return x;
+    }
+
+    // Overwrites the row-major size x columns block b with T^-1 * b by
+    // forward (lower) or backward (upper) substitution.
+    template<typename T>
+    void solveInPlace(T* b, unsigned columns) const {
+        checkSingular();
+        for (unsigned step = 0; step < size; step++){
+            unsigned i = upper ? size - 1 - step : step;
+            const Scalar* r = row(i);
+            T* bi = b + (std::size_t)i * columns;
+            for (unsigned k = first(i); k < last(i); k++){
+                if (k == i)
+                    continue;
+                T factor = (T)r[k - first(i)];
+                const T* bk = b + (std::size_t)k * columns;
+                for (unsigned j = 0; j < columns; j++)
+                    bi[j] -= factor * bk[j];
+            }
+            T diagonal = (T)at(i, i);
+            for (unsigned j = 0; j < columns; j++)
+                bi[j] /= diagonal;
+        }
+    }
+
+    TriangularMatrix transpone() const {
+        TriangularMatrix t(size, !upper);
+        for (unsigned i = 0; i < size; i++){
+            const Scalar* r = row(i);
+            for (unsigned j = first(i); j < last(i); j++)
+                t.element(j, i) = r[j - first(i)];
+        }
+        return t;
+    }
+
+    void transponeThis() {
+        *this = transpone();
+    }
+
+    void makeIdentity() {
+        std::fill(packed.begin(), packed.end(), Scalar(0));
+        for (unsigned i = 0; i < size; i++)
+            packed[rowStart(i) + i - first(i)] = 1;
+    }
+
+private:
+    template <class> friend class TriangularMatrix;
+
+    unsigned first(unsigned r) const { return upper ? r : 0; }
+    unsigned last(unsigned r) const { return upper ? size : r + 1; }
+    bool stored(unsigned r, unsigned c) const { return upper ? c >= r : c <= r; }
+
+    std::size_t rowStart(unsigned r) const {
+        return upper ? packedSize(size) - packedSize(size - r) : packedSize(r);
+    }
+
+    Scalar at(unsigned r, unsigned c) const { return packed[rowStart(r) + c - first(r)]; }
+    Scalar& element(unsigned r, unsigned c) { return packed[rowStart(r) + c - first(r)]; }
+
+    void checkSingular() const {
+        for (unsigned i = 0; i < size; i++)
+            if (at(i, i) == Scalar(0))
+                throw std::runtime_error("Singular matrix");
+    }
+
+    MatrixBuffer<Scalar> packed;
+    unsigned size = 0;
+    bool upper = false;
+};
+
+template<typename Scalar>
+TriangularMatrix<Scalar> operator*(const Scalar& c, const TriangularMatrix<Scalar>& m) {
+    TriangularMatrix<Scalar> r(m);
+    r *= c;
+    return r;
+}
+
+// C = A * T: row i of C adds the stored part of row k of T scaled by A(i,k).
+template<class Scalar>
+Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& a, const TriangularMatrix<Scalar>& t) {
+    if (a.getColumns() != t.getRows())
+        throw std::runtime_error("Wrong size");
+    unsigned rows = a.getRows(), size = t.getRows();
+    MatrixBuffer<Scalar> elements((std::size_t)rows * size, 0);
+    MatrixRef<const Scalar> dense = a.ref();
+    for (unsigned i = 0; i < rows; i++){
+        Scalar* c = elements.data() + (std::size_t)i * size;
+        for (unsigned k = 0; k < size; k++){
+            Scalar factor = dense(i, k);
+            if (factor == Scalar(0))
+                continue;
+            const Scalar* r = t.row(k);
+            unsigned first = t.isUpper() ? k : 0, last = t.isUpper() ? size : k + 1;
+            for (unsigned j = first; j < last; j++)
+                c[j] += factor * r[j - first];
+        }
+    }
+    return Matrix<Scalar>(rows, size, std::move(elements));
+}
+
+template<class Scalar>
+bool operator==(const AbstractMatrix<Scalar>& a, const TriangularMatrix<Scalar>& t) {
+    return t == a;
+}
+
+template<class Scalar>
+bool operator!=(const AbstractMatrix<Scalar>& a, const TriangularMatrix<Scalar>& t) {
+    return t != a;
+}
+
+template <class Scalar>
+std::ostream& operator<<(std::ostream& out, const TriangularMatrix<Scalar>& m){
+    return printMatrix<Scalar>(out, m.getRows(), m.getColumns(),
+                               [&](unsigned i, unsigned j) { return m.unchecked(i, j); });
+}
+
+#endif
@@ -2,6 +2,10 @@
 #define VECTOR_H
 
 #include "AbstractMatrix.h"
+#include "Expression.h"
+#include "Gemm.h"
+#include "MatrixView.h"
+#include "Simd.h"
 
 template <class Scalar>
 class Vector final : public AbstractMatrix<Scalar> {
@@ -12,19 +16,34 @@ public:
     Vector() {}
     
     Vector(unsigned size, bool vertical, Scalar value) :
-        data(size, value), size(size), vertical(vertical) {}
+        storage(size, value), size(size), vertical(vertical) {}
     
-    Vector(unsigned size, bool vertical, std::vector<Scalar> values) :
+    Vector(unsigned size, bool vertical, MatrixBuffer<Scalar> values) :
         size(size), vertical(vertical) {
             if (size != values.size())
                 throw std::runtime_error("Wrong number of elements");
-            data = std::move(values);
+            storage = std::move(values);
     }
     
-    Vector(unsigned size, std::vector<Scalar> values) : size(size) {
+    template <class Allocator>
+    Vector(unsigned size, bool vertical, const std::vector<Scalar, Allocator>& values) :
+        size(size), vertical(vertical) {
+            if (size != values.size())
+                throw std::runtime_error("Wrong number of elements");
+            storage.assign(values.begin(), values.end());
+    }
+    
+    Vector(unsigned size, MatrixBuffer<Scalar> values) : size(size) {
+        if (size != values.size())
+            throw std::runtime_error("Wrong number of elements");
+        storage = std::move(values);
+    }
+    
+    template <class Allocator>
+    Vector(unsigned size, const std::vector<Scalar, Allocator>& values) : size(size) {
         if (size != values.size())
             throw std::runtime_error("Wrong number of elements");
-        data = std::move(values);
+        storage.assign(values.begin(), values.end());
     }
 
     Vector(const Vector& m) = default;
@@ -42,7 +61,7 @@ public:
             size = m.getRows();
             vertical = true;
         }
-        data.assign(m.begin(), m.end());
+        storage = m.copyElements();
     }
     
     Vector& operator=(const AbstractMatrix<Scalar>& m){
@@ -56,13 +75,30 @@ public:
                 size = m.getRows();
                 vertical = true;
             }
-            data.assign(m.begin(), m.end());
+            storage = m.copyElements();
         }
         return *this;
     }
     
+    template <class E>
+    Vector(const MatrixExpression<E>& e) {
+        *this = e;
+    }
+    
+    template <class E>
+    Vector& operator=(const MatrixExpression<E>& e) {
+        unsigned r = e.self().getRows(), c = e.self().getColumns();
+        if (r != 1 && c != 1)
+            throw std::runtime_error("Not a vector");
+        MATRIX_PROFILE("Vector::expression", r, c, (unsigned long long)r * c);
+        assignExpression(storage.buffer(), e);
+        vertical = r != 1;
+        size = vertical ? r : c;
+        return *this;
+    }
+    
     virtual bool isSquare() const override {
-        return data.size() == 1;
+        return storage.size() == 1;
     }
     
     virtual bool isVector() const override {
@@ -74,16 +110,21 @@ public:
     }
     
     virtual bool isZero() const override {
-        for (auto i = begin(); i != end(); i++)
-            if (*i != 0)
-                return false;
-        return true;
+        return parallelIsZero(storage.data(), storage.size());
+    }
+    
+    virtual Scalar max() const override {
+        return parallelMax(storage.data(), storage.size());
+    }
+    
+    virtual Scalar min() const override {
+        return parallelMin(storage.data(), storage.size());
     }
     
     virtual bool isIdentity() const override {
         if (!isDiagonal())
             return false;
-        return data[0] == 1;
+        return storage[0] == 1;
     }
     
     virtual unsigned getRows() const override {
@@ -98,94 +139,119 @@ public:
         return size;
     }
 
-    virtual iterator begin() override { return data.begin(); }
-    virtual iterator end() override { return data.end(); }
-    virtual const_iterator begin() const override { return data.begin(); }
-    virtual const_iterator end() const override { return data.end(); }
+    virtual iterator begin() override { return storage.data(); }
+    virtual iterator end() override { return storage.data() + storage.size(); }
+    virtual const_iterator begin() const override { return storage.data(); }
+    virtual const_iterator end() const override { return storage.data() + storage.size(); }
+    
+    Scalar* data() { return storage.data(); }
+    const Scalar* data() const { return storage.data(); }
+    MatrixRef<Scalar> ref() { return MatrixRef<Scalar>(storage.data(), getRows(), getColumns()); }
+    MatrixRef<const Scalar> ref() const { return MatrixRef<const Scalar>(storage.data(), getRows(), getColumns()); }
+
+    // Copy-on-write sharing of the elements with copies; see MatrixStorage.h.
+    void share() { storage.share(); }
+    bool isShared() const { return storage.isShared(); }
+    virtual const MatrixStorage<Scalar>* getStorage() const override { return &storage; }
+    
+    Scalar* row(unsigned r) {
+        assert(r < getRows());
+        return storage.data() + r * getColumns();
+    }
+    
+    const Scalar* row(unsigned r) const {
+        assert(r < getRows());
+        return storage.data() + r * getColumns();
+    }
+    
+    Scalar& unchecked(unsigned r, unsigned c) {
+        assert(r < getRows() && c < getColumns());
+        return storage[r * getColumns() + c];
+    }
+    
+    Scalar unchecked(unsigned r, unsigned c) const {
+        assert(r < getRows() && c < getColumns());
+        return storage[r * getColumns() + c];
+    }
     
     virtual Scalar operator()(unsigned r, unsigned c) const override {
         if (r >= getRows() || c >= getColumns())
             throw std::out_of_range("Vector::operator()");
-        return data[r * getColumns() + c];
+        return storage[r * getColumns() + c];
     }
 
     virtual Scalar& operator()(unsigned r, unsigned c) override {
         if (r >= getRows() || c >= getColumns())
             throw std::out_of_range("Vector::operator()");
-        return data[r * getColumns() + c];
+        return storage[r * getColumns() + c];
     }
 
     virtual Scalar operator()(unsigned p) const {
         if (p >= size)
             throw std::out_of_range("Vector::operator()");
-        return data[p];
+        return storage[p];
     }
 
     virtual Scalar& operator()(unsigned p) {
         if (p >= size)
             throw std::out_of_range("Vector::operator()");
-        return data[p];
+        return storage[p];
     }
     
     bool operator==(const AbstractMatrix<Scalar>& m) const override {
         if (getRows() !=m.getRows() || getColumns() != m.getColumns())
             return false;
-        for (const_iterator i = begin(), j = m.begin(); j != m.end(); ++i, ++j)
-            if (*i != *j)
-                return false;
-        return true;
-    }
-    
-    Vector operator-() {
-        std::vector<Scalar> temp;
-        temp.reserve(data.size());
-        for (auto element : *this)
-            temp.push_back(-element);
-        return Vector(size, vertical, std::move(temp));
+        return parallelEqual(storage.data(), m.data(), storage.size());
     }
     
     Vector& operator+=(const AbstractMatrix<Scalar>& m) {
         if (getRows() != m.getRows() || getColumns() != m.getColumns())
             throw std::runtime_error("Wrong size");
-        auto m_data = m.begin();
-        for (unsigned i = 0; i < size; i++)
-            data[i] += m_data[i];
-        return *this;;
-    }
-    
-    Vector operator+(const AbstractMatrix<Scalar>& m){
-        Vector copy(*this);
-        copy += m;
-        return copy;
+        MATRIX_PROFILE("Vector::operator+=", getRows(), getColumns(), storage.size());
+        simdAdd(storage.data(), m.data(), storage.size());
+        return *this;
     }
     
     Vector& operator-=(const AbstractMatrix<Scalar>& m) {
         if (getRows() != m.getRows() || getColumns() != m.getColumns())
             throw std::runtime_error("Wrong size");
-        auto m_data = m.begin();
-        for (unsigned i = 0; i < size; i++)
-            data[i] -= m_data[i];
-        return *this;;
+        MATRIX_PROFILE("Vector::operator-=", getRows(), getColumns(), storage.size());
+        simdSub(storage.data(), m.data(), storage.size());
+        return *this;
     }
     
-    Vector operator-(const AbstractMatrix<Scalar>& m){
-        Vector copy(*this);
-        copy -= m;
-        return copy;
+    template <class E>
+    Vector& operator+=(const MatrixExpression<E>& e) {
+        const E& x = e.self();
+        if (getRows() != x.getRows() || getColumns() != x.getColumns())
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("Vector::operator+=", getRows(), getColumns(), storage.size());
+        updateExpression<ExpressionPlus>(storage.data(), x.getColumns(), x);
+        return *this;
     }
     
-    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) {
+    template <class E>
+    Vector& operator-=(const MatrixExpression<E>& e) {
+        const E& x = e.self();
+        if (getRows() != x.getRows() || getColumns() != x.getColumns())
+            throw std::runtime_error("Wrong size");
+        MATRIX_PROFILE("Vector::operator-=", getRows(), getColumns(), storage.size());
+        updateExpression<ExpressionMinus>(storage.data(), x.getColumns(), x);
+        return *this;
+    }
+    
+    Matrix<Scalar> operator*(const AbstractMatrix<Scalar>& m) const {
         if (getColumns() != m.getRows())
             throw std::runtime_error("Wrong size");
         unsigned resRows = getRows();
         unsigned resColumns = m.getColumns();
-        std::vector<Scalar> elements(resRows * resColumns, 0);
-        for (unsigned i = 0; i < resRows; i++){
-            Scalar* row = elements.data() + i * resColumns;
-            for (unsigned j = 0; j < getColumns(); j++)
-                for (unsigned k = 0; k < resColumns; k++)
-                    row[k] += this->operator()(i,j) * m(j,k);
-        }
+        MATRIX_PROFILE("Vector::operator*", resRows, resColumns, 2ull * resRows * resColumns * getColumns());
+        MatrixBuffer<Scalar> elements(resRows * resColumns, 0);
+        // One dimension of a vector product is 1, never above the Strassen
+        // crossover, so multiplyInto() would pick gemm anyway.
+        if (!elements.empty() && getColumns() != 0)
+            gemm(resRows, resColumns, getColumns(), storage.data(), getColumns(),
+                 m.data(), resColumns, elements.data(), resColumns);
         return Matrix<Scalar>(resRows, resColumns, std::move(elements));
     }
     
@@ -195,45 +261,41 @@ public:
     }
     
     Vector& operator*=(const Scalar& c) {
-        for (auto& e : data)
-            e *= c;
+        MATRIX_PROFILE("Vector::operator*=", getRows(), getColumns(), storage.size());
+        simdScale(storage.data(), c, storage.size());
         return *this;
     }
     
-    Vector operator*(const Scalar& c) {
-        Vector copy(*this);
-        copy *= c;
-        return copy;
-    }
-    
     virtual Scalar trace() const override {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
-        return data[0];
+        return storage[0];
     }
     
     template<typename T = double>
     T det() const {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
-        return (T)data[0];
+        return (T)storage[0];
     }
     
     template<typename T = double>
     Vector<T> invert() const {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
-        return Vector<T>(1,1/(T)data[0]);
+        return Vector<T>(1, vertical, 1/(T)storage[0]);
     }
     
     void swapElements(unsigned first, unsigned second) {
         if (first >= size || second >= size)
             throw std::out_of_range("Vector::swapRows");
-        std::swap(data[first], data[second]);
+        std::swap(storage[first], storage[second]);
     }
     
     Vector transpone() const {
-        return Vector(size, !vertical, data);
+        Vector v(*this);
+        v.vertical = !vertical;
+        return v;
     }
     
      virtual void transponeThis() override {
@@ -243,18 +305,13 @@ public:
     virtual void makeIdentity() override {
         if (!isSquare())
             throw std::runtime_error("Not a square matrix");
-        data[0] = 1;
+        storage[0] = 1;
     }
 
 private:
-    std::vector<Scalar> data;
-    unsigned size;
+    MatrixStorage<Scalar> storage;
+    unsigned size = 0;
     bool vertical = false;
 };
 
-template<typename Scalar>
-Vector<Scalar> operator*(const Scalar& c, Vector<Scalar>& m) {
-   return m * c;
-}
-
 #endif
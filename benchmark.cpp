@@ -0,0 +1,868 @@
+#include "AlignedMatrix.h"
+#include "BandedMatrix.h"
+#include "DiagonalMatrix.h"
+#include "Krylov.h"
+#include "MappedMatrix.h"
+#include "Matrix.h"
+#include "MatrixAllocator.h"
+#include "MatrixBatch.h"
+#include "MixedPrecision.h"
+#include "Serialization.h"
+#include "SquareMatrix.h"
+#include "SymmetricMatrix.h"
+#include "TiledMatrix.h"
+#include "TriangularMatrix.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Vector.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+template<class F>
+double seconds(F f, unsigned repeats = 3){
+    double best = 1e300;
+    for (unsigned r = 0; r < repeats; r++){
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+std::vector<double> randomValues(unsigned count){
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> distribution(-1, 1);
+    std::vector<double> values(count);
+    for (auto& v : values)
+        v = distribution(generator);
+    return values;
+}
+
+void threadScaling(unsigned n){
+    Matrix<double> a(n, n, randomValues(n * n));
+    Matrix<double> b(n, n, randomValues(n * n));
+    SquareMatrix<double> s(n / 4, randomValues((n / 4) * (n / 4)));
+
+    std::cout << "thread scaling, product " << n << "x" << n
+              << ", det/invert " << n / 4 << "x" << n / 4 << std::endl;
+    std::cout << "threads\tproduct[s]\tGFLOP/s\tspeedup\tdet[s]\tinvert[s]" << std::endl;
+    double base = 0;
+    for (unsigned threads : {1, 2, 4, 8, 16}){
+        ThreadPool::global().setThreadCount(threads);
+        double product = seconds([&] { Matrix<double> c = a * b; });
+        double det = seconds([&] { volatile double d = s.det(); (void)d; });
+        double invert = seconds([&] { SquareMatrix<double> i = s.invert(); });
+        if (threads == 1)
+            base = product;
+        std::cout << threads << "\t" << product << "\t" << 2.0 * n * n * n / product / 1e9
+                  << "\t" << base / product << "\t" << det << "\t" << invert << std::endl;
+    }
+}
+
+// Reductions and predicates over one large matrix by thread count. The
+// early-exit isZero() and == find a difference in the middle; "separate"
+// is max(), min() and a sum as three passes, "summary" the fused pass.
+void reductionTable(unsigned rows, unsigned columns){
+    Matrix<double> a(rows, columns, randomValues(rows * columns));
+    Matrix<double> b(a), zero(rows, columns, 0.0), nonzero(zero);
+    b(rows / 2, 0) += 1;
+    nonzero(rows / 2, 0) = 1;
+    SquareMatrix<double> identity(columns);
+    identity.makeIdentity();
+    const Matrix<double>& elements = a;
+    volatile double sink = 0;
+
+    std::cout << "reductions, " << rows << "x" << columns << ", s" << std::endl;
+    std::cout << "threads\tmax\tisZero\tisZero (early)\t==\t== (early)\tisIdentity\tseparate\tsummary" << std::endl;
+    for (unsigned threads : {1u, 2u, 4u, 8u, std::thread::hardware_concurrency()}){
+        ThreadPool::global().setThreadCount(threads);
+        std::cout << threads
+                  << "\t" << seconds([&] { sink = sink + a.max(); })
+                  << "\t" << seconds([&] { sink = sink + zero.isZero(); })
+                  << "\t" << seconds([&] { sink = sink + nonzero.isZero(); })
+                  << "\t" << seconds([&] { sink = sink + (a == a); })
+                  << "\t" << seconds([&] { sink = sink + (a == b); })
+                  << "\t" << seconds([&] { sink = sink + identity.isIdentity(); })
+                  << "\t" << seconds([&] {
+                         sink = sink + a.max() + a.min() + std::accumulate(elements.begin(), elements.end(), 0.0);
+                     })
+                  << "\t" << seconds([&] { sink = sink + a.summary().sum; }) << std::endl;
+    }
+    ThreadPool::global().setThreadCount(std::thread::hardware_concurrency());
+}
+
+template<class F>
+void reportAccess(const char* name, unsigned n, F f){
+    volatile double sink = 0;
+    double time = seconds([&] { sink = sink + f(); }, 5);
+    std::cout << name << "\t" << time * 1e9 / ((double)n * n) << std::endl;
+}
+
+void elementAccess(unsigned n){
+    Matrix<double> m(n, n, randomValues(n * n));
+    const AbstractMatrix<double>& abstract = m;
+    const Matrix<double>& concrete = m;
+
+    std::cout << "element access, " << n << "x" << n << std::endl;
+    std::cout << "access\tns/element" << std::endl;
+    reportAccess("virtual operator()", n, [&] {
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++)
+            for (unsigned j = 0; j < n; j++)
+                sum += abstract(i, j);
+        return sum;
+    });
+    reportAccess("unchecked()", n, [&] {
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++)
+            for (unsigned j = 0; j < n; j++)
+                sum += concrete.unchecked(i, j);
+        return sum;
+    });
+    reportAccess("MatrixRef", n, [&] {
+        MatrixRef<const double> ref = abstract.ref();
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++)
+            for (unsigned j = 0; j < n; j++)
+                sum += ref(i, j);
+        return sum;
+    });
+    reportAccess("row pointer", n, [&] {
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++){
+            const double* row = concrete.row(i);
+            for (unsigned j = 0; j < n; j++)
+                sum += row[j];
+        }
+        return sum;
+    });
+}
+
+template<class Scalar>
+void simdTable(const char* type, unsigned n){
+    std::vector<double> values = randomValues(n);
+    Matrix<Scalar> a(1, n, std::vector<Scalar>(values.begin(), values.end()));
+    Matrix<Scalar> b(a), c(a), zero(1, n, 0);
+    volatile bool flag = false;
+    volatile Scalar sink = 0;
+
+    std::cout << "elementwise kernels, " << type << ", " << n << " elements, ns/element" << std::endl;
+    std::cout << "isa\t+=\t*=\tunary -\tisZero\tmax\t==" << std::endl;
+    for (SimdIsa isa : {SimdIsa::Scalar, SimdIsa::Sse2, SimdIsa::Avx2, SimdIsa::Avx512}){
+        setSimdIsa(isa);
+        if (getSimdIsa() != isa)
+            continue;
+        double scale = 1e9 / n;
+        std::cout << simdIsaName(isa)
+                  << "\t" << seconds([&] { b += c; }, 10) * scale
+                  << "\t" << seconds([&] { b *= (Scalar)0.5; }, 10) * scale
+                  << "\t" << seconds([&] { b = -b; }, 10) * scale
+                  << "\t" << seconds([&] { flag = zero.isZero(); }, 10) * scale
+                  << "\t" << seconds([&] { sink = a.max(); }, 10) * scale
+                  << "\t" << seconds([&] { flag = a == c; }, 10) * scale << std::endl;
+    }
+    setSimdIsa(detectSimdIsa());
+}
+
+void batchTable(unsigned elements){
+    volatile double sink = 0;
+    std::cout << "batched small matrices, double, ns/matrix" << std::endl;
+    std::cout << "size\tcount\tisa\tdet obj\tdet batch\tinvert obj\tinvert batch\t* obj\t* batch" << std::endl;
+    for (unsigned size : {3, 4, 8, 16}){
+        unsigned count = elements / (size * size);
+        std::vector<double> values = randomValues(count * size * size);
+        std::vector<SquareMatrix<double>> objects;
+        MatrixBatch<double> batch(count, size);
+        for (unsigned b = 0; b < count; b++){
+            SquareMatrix<double> m(size, std::vector<double>(values.begin() + b * size * size,
+                                                             values.begin() + (b + 1) * size * size));
+            for (unsigned i = 0; i < size; i++)
+                m(i, i) += size;
+            batch.set(b, m);
+            objects.push_back(m);
+        }
+        double scale = 1e9 / count;
+        double detObjects = seconds([&] {
+            double sum = 0;
+            for (const auto& m : objects)
+                sum += m.det();
+            sink = sum;
+        }, 1) * scale;
+        double invertObjects = seconds([&] {
+            for (const auto& m : objects)
+                sink = m.invert()(0, 0);
+        }, 1) * scale;
+        double multiplyObjects = seconds([&] {
+            for (unsigned b = 0; b < count; b++)
+                sink = (objects[b] * objects[count - 1 - b])(0, 0);
+        }, 1) * scale;
+        for (SimdIsa isa : {SimdIsa::Scalar, SimdIsa::Avx512}){
+            setSimdIsa(isa);
+            std::cout << size << "\t" << count << "\t" << simdIsaName(getSimdIsa())
+                      << "\t" << detObjects
+                      << "\t" << seconds([&] { sink = batch.det()[0]; }) * scale
+                      << "\t" << invertObjects
+                      << "\t" << seconds([&] { sink = batch.invert()(0, 0, 0); }) * scale
+                      << "\t" << multiplyObjects
+                      << "\t" << seconds([&] { sink = (batch * batch)(0, 0, 0); }) * scale << std::endl;
+        }
+        setSimdIsa(detectSimdIsa());
+    }
+}
+
+// Strassen-Winograd against the classical engine. The error is the largest
+// difference from the classical product, relative to max|A| * max|B| * n.
+void strassenTable(unsigned maxSize){
+    std::cout << "Strassen-Winograd, double, square products" << std::endl;
+    std::cout << "n\tcrossover\tlevels\tclassical[s]\tstrassen[s]\tspeedup\trel. error" << std::endl;
+    for (unsigned n = 1024; n <= maxSize; n = n * 3 / 2){
+        Matrix<double> a(n, n, randomValues(n * n));
+        SquareMatrix<double> b(n, randomValues(n * n));
+        b.transponeThis();
+        setMultiplyAlgorithm(MultiplyAlgorithm::Classical);
+        Matrix<double> reference;
+        double classical = seconds([&] { reference = a * b; }, 1);
+        setMultiplyAlgorithm(MultiplyAlgorithm::Strassen);
+        for (unsigned crossover : {256, 512, 1024}){
+            if (crossover >= n)
+                continue;
+            setStrassenCrossover(crossover);
+            Matrix<double> c;
+            double time = seconds([&] { c = a * b; }, 1);
+            double error = 0;
+            for (unsigned i = 0; i < n; i++)
+                for (unsigned j = 0; j < n; j++)
+                    error = std::max(error, std::abs(c(i, j) - reference(i, j)));
+            std::cout << n << "\t" << crossover << "\t" << strassenDepth(n, n, n, crossover)
+                      << "\t" << classical << "\t" << time << "\t" << classical / time
+                      << "\t" << error / (a.max() * b.max() * n) << std::endl;
+        }
+    }
+    setMultiplyAlgorithm(MultiplyAlgorithm::Classical);
+    setStrassenCrossover(256);
+}
+
+// Krylov solvers on the 5-point Laplacian of a grid x grid mesh (sparse,
+// symmetric positive definite) against dense LU. Residuals are relative,
+// ||b - A x|| / ||b||.
+void krylovTable(unsigned maxGrid){
+    std::cout << "Krylov solvers, double, 2D Laplacian, tolerance 1e-8" << std::endl;
+    std::cout << "unknowns	method	iterations	time[s]	residual" << std::endl;
+    for (unsigned grid = 32; grid <= maxGrid; grid *= 2){
+        unsigned n = grid * grid;
+        std::vector<SparseMatrix<double>::Triplet> triplets;
+        for (unsigned i = 0; i < n; i++){
+            triplets.push_back({i, i, 4});
+            if (i % grid)
+                triplets.push_back({i, i - 1, -1}), triplets.push_back({i - 1, i, -1});
+            if (i >= grid)
+                triplets.push_back({i, i - grid, -1}), triplets.push_back({i - grid, i, -1});
+        }
+        SparseMatrix<double> a(n, n, triplets);
+        std::vector<double> values = randomValues(n);
+        Vector<double> b(n, true, values);
+        auto residual = [&](const Vector<double>& x) {
+            MatrixBuffer<double> r(n);
+            residualVector(a, b.data(), x.data(), r.data(), n);
+            return parallelNorm(r.data(), n) / parallelNorm(b.data(), n);
+        };
+        auto report = [&](const char* method, unsigned iterations, double time, const Vector<double>& x) {
+            std::cout << n << "\t" << method << "\t" << iterations << "\t" << time << "\t" << residual(x) << std::endl;
+        };
+        if (n <= 4096){
+            Matrix<double> dense = a.toDense();
+            Vector<double> x;
+            double time = seconds([&] { x = LU<double>(dense).solve(b); }, 1);
+            report("dense LU", 0, time, x);
+        }
+        JacobiPreconditioner<double> jacobi(a);
+        Ilu0Preconditioner<double> ilu(a);
+        auto run = [&](const char* method, auto solve) {
+            Vector<double> x;
+            SolverResult<double> result;
+            double time = seconds([&] { x = Vector<double>(); result = solve(x); }, 1);
+            report(method, result.iterations, time, x);
+        };
+        SolverOptions<double> options;
+        options.maxIterations = 10 * n;
+        run("CG", [&](Vector<double>& x) { return conjugateGradient(a, b, x, options); });
+        run("CG+Jacobi", [&](Vector<double>& x) { return conjugateGradient(a, b, x, options, jacobi); });
+        run("CG+ILU(0)", [&](Vector<double>& x) { return conjugateGradient(a, b, x, options, ilu); });
+        run("BiCGSTAB+ILU(0)", [&](Vector<double>& x) { return biCGStab(a, b, x, options, ilu); });
+        run("GMRES(30)+ILU(0)", [&](Vector<double>& x) { return gmres(a, b, x, options, ilu); });
+    }
+}
+
+// Solving A x = b in double against float factors refined in double, for
+// a well-conditioned (diagonally dominant) A and a Hilbert-like
+// ill-conditioned one that makes the mixed solver fall back.
+void mixedPrecisionTable(unsigned n){
+    SquareMatrix<double> a(n, randomValues(n * n));
+    for (unsigned i = 0; i < n; i++)
+        a(i, i) += n / 10.0;
+    SquareMatrix<double> hilbert(n);
+    for (unsigned i = 0; i < n; i++)
+        for (unsigned j = 0; j < n; j++)
+            hilbert(i, j) = 1.0 / (i + j + 1);
+    Vector<double> b(n, true, randomValues(n));
+
+    std::cout << "mixed precision solve " << n << "x" << n << std::endl;
+    std::cout << "matrix\tdouble LU[s]\tmixed[s]\titerations\tfallback\tmax difference" << std::endl;
+    for (auto m : {std::make_pair("random", &a), std::make_pair("hilbert", &hilbert)}){
+        Vector<double> exact, x;
+        double full = seconds([&] { exact = m.second->lu().solve(b); }, 1);
+        RefinementResult result;
+        double mixed = seconds([&] { x = m.second->mixedPrecisionLU().solve(b, &result); }, 1);
+        double difference = 0;
+        for (unsigned i = 0; i < n; i++)
+            difference = std::max(difference, std::abs(x(i) - exact(i)));
+        std::cout << m.first << "\t" << full << "\t" << mixed << "\t" << result.iterations << "\t"
+                  << result.fullPrecision << "\t" << difference << std::endl;
+    }
+}
+
+// LU against the symmetric factorizations on a covariance matrix X X^T / n
+// plus a small ridge, which is symmetric positive definite.
+void symmetricTable(unsigned n){
+    Matrix<double> x(n, n, randomValues(n * n));
+    SquareMatrix<double> a(x * x.transpone());
+    a *= 1.0 / n;
+    for (unsigned i = 0; i < n; i++)
+        a(i, i) += 0.01;
+    SquareMatrix<double> inverse = a.invert();
+
+    std::cout << "symmetric positive definite " << n << "x" << n << ", double" << std::endl;
+    std::cout << "factorization\tdet[s]\tinvert[s]\tmax error of inverse" << std::endl;
+    for (auto f : {std::make_pair("LU", Factorization::LU), std::make_pair("Cholesky", Factorization::Cholesky),
+                   std::make_pair("LDL^T", Factorization::LDLT), std::make_pair("automatic", Factorization::Automatic)}){
+        double det = seconds([&] { volatile double d = a.det(f.second); (void)d; });
+        SquareMatrix<double> r;
+        double invert = seconds([&] { r = a.invert(f.second); });
+        double error = 0;
+        for (unsigned i = 0; i < n; i++)
+            for (unsigned j = 0; j < n; j++)
+                error = std::max(error, std::abs(r(i, j) - inverse(i, j)));
+        std::cout << f.first << "\t" << det << "\t" << invert << "\t" << error << std::endl;
+    }
+    SymmetricMatrix<double> packed(a);
+    double det = seconds([&] { volatile double d = packed.det(); (void)d; });
+    std::cout << "packed storage: " << packed.getPacked().size() * sizeof(double) / 1e6 << " MB instead of "
+              << a.getRows() * a.getColumns() * sizeof(double) / 1e6 << " MB, det " << det << " s" << std::endl;
+}
+
+// Dense LU and products against the diagonal, triangular and banded
+// types holding the same matrix.
+void structuredTable(unsigned n){
+    std::vector<double> values = randomValues(n * n);
+    Matrix<double> b(n, 64, randomValues(n * 64));
+    Vector<double> x(n, true, randomValues(n));
+    auto report = [&](const char* name, Matrix<double> dense, auto& structured) {
+        double denseProduct = seconds([&] { Matrix<double> c = dense * b; });
+        double product = seconds([&] { Matrix<double> c = structured * b; });
+        double denseSolve = seconds([&] { Vector<double> y = LU<double>(dense).solve(x); }, 1);
+        double solve = seconds([&] { Vector<double> y = structured.solve(x); });
+        double denseDet = seconds([&] { volatile double d = LU<double>(dense).det(); (void)d; }, 1);
+        double det = seconds([&] { volatile double d = structured.det(); (void)d; });
+        std::cout << name << "\t" << denseProduct << "\t" << product << "\t" << denseSolve << "\t" << solve
+                  << "\t" << denseDet << "\t" << det << std::endl;
+    };
+
+    std::cout << "structured " << n << "x" << n << ", product with " << n << "x64, double" << std::endl;
+    std::cout << "type\tdense product[s]\tproduct[s]\tdense solve[s]\tsolve[s]\tdense det[s]\tdet[s]" << std::endl;
+    MatrixBuffer<double> diagonal(n);
+    for (unsigned i = 0; i < n; i++)
+        diagonal[i] = 2 + values[i];
+    DiagonalMatrix<double> d(n, diagonal);
+    report("diagonal", d.toDense(), d);
+    TriangularMatrix<double> t(n, false);
+    for (unsigned i = 0; i < n; i++)
+        for (unsigned j = 0; j <= i; j++)
+            t(i, j) = i == j ? n : values[i * n + j];
+    report("lower triangular", t.toDense(), t);
+    BandedMatrix<double> banded(n, 4, 4);
+    for (unsigned i = 0; i < n; i++)
+        for (unsigned j = banded.first(i); j < banded.last(i); j++)
+            banded(i, j) = i == j ? 10 : values[i * n + j];
+    report("banded 4/4", banded.toDense(), banded);
+}
+
+// Out-of-core product of two n x n matrices held in tiled files in dir,
+// with the tile cache limited to budget bytes. The default n = 92682 makes
+// each double matrix 64 GiB, and the default budget of 12 GiB fits a 16 GiB
+// machine. The inputs are filled tile by tile and never exist in memory.
+void outOfCoreTable(unsigned n, std::size_t budget, const std::string& dir){
+    setOutOfCoreMemoryBudget(budget);
+    std::string pathA = dir + "/benchmark-a.tiles", pathB = dir + "/benchmark-b.tiles";
+    std::string pathC = dir + "/benchmark-c.tiles";
+    double fill = seconds([&] {
+        for (const std::string& path : {pathA, pathB}){
+            TiledMatrix<double> m(path, n, n);
+            std::mt19937 generator(42);
+            std::uniform_real_distribution<double> distribution(-1, 1);
+            for (unsigned i = 0; i < m.getTileRows(); i++)
+                for (unsigned j = 0; j < m.getTileColumns(); j++){
+                    TiledMatrix<double>::Tile t = m.tile(i, j, false);
+                    for (unsigned r = 0; r < t.getRows(); r++)
+                        for (unsigned c = 0; c < t.getColumns(); c++)
+                            t.data()[(std::size_t)r * t.getStride() + c] = distribution(generator);
+                    t.markDirty();
+                }
+        }
+    }, 1);
+    TiledMatrix<double> a(pathA), b(pathB);
+    double bytes = (double)n * n * sizeof(double);
+    std::cout << "out-of-core product " << n << "x" << n << " (" << bytes / (1 << 30) << " GiB per matrix), tile "
+              << a.getTileSize() << ", budget " << (double)budget / (1 << 30) << " GiB" << std::endl;
+    std::cout << "fill[s]\tproduct[s]\tGFLOP/s\ttranspose[s]\tsum[s]" << std::endl;
+    double product = seconds([&] { TiledMatrix<double> c = a.multiply(b, pathC); c.flush(); }, 1);
+    double transpose = seconds([&] { TiledMatrix<double> t = a.transpone(pathC); t.flush(); }, 1);
+    double sum = seconds([&] { TiledMatrix<double> s = a.add(b, pathC); s.flush(); }, 1);
+    std::cout << fill << "\t" << product << "\t" << 2.0 * n * n * n / product / 1e9 << "\t" << transpose
+              << "\t" << sum << std::endl;
+    for (const std::string& path : {pathA, pathB, pathC})
+        std::remove(path.c_str());
+}
+
+void transposeTable(unsigned n){
+    Matrix<double> square(n, n, randomValues(n * n));
+    Matrix<double> wide(n / 2, n, randomValues(n / 2 * n));
+    std::vector<double> out((size_t)n * n);
+    double bytes = 16.0 * n * n;
+
+    std::cout << "transpose, " << n << "x" << n << " and " << n / 2 << "x" << n << ", GB/s" << std::endl;
+    std::cout << "naive loop\ttranspone()\tin-place square\tin-place rectangular" << std::endl;
+    double naive = seconds([&] {
+        const double* in = square.data();
+        for (unsigned i = 0; i < n; i++)
+            for (unsigned j = 0; j < n; j++)
+                out[(size_t)j * n + i] = in[(size_t)i * n + j];
+    });
+    double copy = seconds([&] { Matrix<double> t = square.transpone(); });
+    double inPlace = seconds([&] { square.transponeThis(); });
+    double rectangular = seconds([&] { wide.transponeThis(); });
+    std::cout << bytes / naive / 1e9 << "\t" << bytes / copy / 1e9 << "\t" << bytes / inPlace / 1e9
+              << "\t" << bytes / 2 / rectangular / 1e9 << std::endl;
+}
+
+// Contiguous Matrix against padded AlignedMatrix at a size whose rows are
+// not a whole number of cache lines, for sums, products and A * B^T.
+void layoutTable(unsigned n){
+    n |= 1;
+    Matrix<double> a(n, n, randomValues(n * n)), b(n, n, randomValues(n * n));
+    AlignedMatrix<double> paddedA(a), paddedB(b);
+    AlignedMatrix<double> columnA(a, MatrixLayout::ColumnMajor), columnB(b, MatrixLayout::ColumnMajor);
+
+    std::cout << "layout " << n << "x" << n << " (stride " << paddedA.getStride() << "), double, s" << std::endl;
+    std::cout << "operation	Matrix	row-major	column-major" << std::endl;
+    std::cout << "a += b	" << seconds([&] { a += b; }) << "	" << seconds([&] { paddedA += paddedB; })
+              << "	" << seconds([&] { columnA += columnB; }) << std::endl;
+    std::cout << "a * b	" << seconds([&] { Matrix<double> c = a * b; }, 1)
+              << "	" << seconds([&] { AlignedMatrix<double> c = paddedA * paddedB; }, 1)
+              << "	" << seconds([&] { AlignedMatrix<double> c = columnA * columnB; }, 1) << std::endl;
+    std::cout << "a * b^T	" << seconds([&] { Matrix<double> c = a * b.transpone(); }, 1)
+              << "	" << seconds([&] { AlignedMatrix<double> c = paddedA * paddedB.transpone(); }, 1)
+              << "	" << seconds([&] { AlignedMatrix<double> c = columnA * columnB.transpone(); }, 1) << std::endl;
+}
+
+void viewTable(unsigned n){
+    Matrix<double> a(n, n, randomValues(n * n));
+    unsigned half = n / 2;
+    Matrix<double> c;
+    volatile double sink = 0;
+
+    std::cout << "views, " << half << "x" << half << " blocks of " << n << "x" << n << ", ms" << std::endl;
+    std::cout << "operation\tcopied blocks\tviews" << std::endl;
+    std::cout << "block + block\t"
+              << seconds([&] { c = Matrix<double>(a.block(0, 0, half, half)) +
+                                   Matrix<double>(a.block(half, half, half, half)); }) * 1e3 << "\t"
+              << seconds([&] { c = a.block(0, 0, half, half) + a.block(half, half, half, half); }) * 1e3
+              << std::endl;
+    std::cout << "block * block\t"
+              << seconds([&] { c = Matrix<double>(a.block(0, 0, half, half)) *
+                                   Matrix<double>(a.block(half, half, half, half)); }) * 1e3 << "\t"
+              << seconds([&] { c = a.block(0, 0, half, half) * a.block(half, half, half, half); }) * 1e3
+              << std::endl;
+    std::cout << "column max\t"
+              << seconds([&] {
+                     for (unsigned j = 0; j < n; j++){
+                         Vector<double> column = Matrix<double>(a.columnView(j));
+                         sink = sink + column.max();
+                     }
+                 }) * 1e3 << "\t"
+              << seconds([&] {
+                     for (unsigned j = 0; j < n; j++){
+                         VectorView<const double> column = a.columnView(j);
+                         double best = column[0];
+                         for (unsigned i = 1; i < n; i++)
+                             best = std::max(best, column[i]);
+                         sink = sink + best;
+                     }
+                 }) * 1e3 << std::endl;
+}
+
+void binaryIo(unsigned n){
+    Matrix<double> m(n, n, randomValues(n * n));
+    std::string path = (std::filesystem::temp_directory_path() / "matrix-benchmark.bin").string();
+    double gigabytes = 8.0 * n * n / 1e9;
+    volatile double sink = 0;
+
+    std::cout << "binary I/O, " << n << "x" << n << " doubles, " << gigabytes << " GB" << std::endl;
+    std::cout << "text <<[s]\twrite[s]\tread[s]\tmap[s]\tmap+scan[s]" << std::endl;
+    double text = seconds([&] {
+        std::ofstream out(path + ".txt");
+        out << m;
+    }, 1);
+    double write = seconds([&] { writeBinary(path, m); });
+    double read = seconds([&] { Matrix<double> r = readBinary<double>(path); sink = r(0, 0); });
+    double map = seconds([&] { MappedMatrix<double> r(path); sink = r.getRows(); });
+    double scan = seconds([&] { MappedMatrix<double> r(path); sink = r.max(); });
+    std::cout << text << "\t" << write << "\t" << read << "\t" << map << "\t" << scan << std::endl;
+    std::remove(path.c_str());
+    std::remove((path + ".txt").c_str());
+}
+
+void textIo(unsigned n){
+    Matrix<double> m(n, n, randomValues(n * n));
+    std::string path = (std::filesystem::temp_directory_path() / "matrix-benchmark.txt").string();
+    volatile double sink = 0;
+    auto megabytes = [&] { return std::filesystem::file_size(path) / 1e6; };
+
+    std::cout << "text I/O, " << n << "x" << n << " doubles" << std::endl;
+    std::cout << "operation\ts\tMB/s" << std::endl;
+    auto report = [&](const char* name, double time) {
+        std::cout << name << "\t" << time << "\t" << megabytes() / time << std::endl;
+    };
+    // The element-by-element stream loop operator<< used to be, endl included.
+    report("stream << endl", seconds([&] {
+        std::ofstream out(path);
+        for (unsigned i = 0; i < m.getRows(); i++){
+            for (unsigned j = 0; j < m.getColumns(); j++)
+                out << m(i, j) << "  ";
+            out << std::endl;
+        }
+    }, 1));
+    report("operator<<", seconds([&] {
+        std::ofstream out(path);
+        out << m;
+    }));
+    report("writeText csv", seconds([&] { writeText(path, m, TextFormat::csv()); }));
+    report("writeText exact", seconds([&] { writeText(path, m); }));
+    report("stream >>", seconds([&] {
+        std::ifstream in(path);
+        std::vector<double> values;
+        double v;
+        while (in >> v)
+            values.push_back(v);
+        sink = values.size();
+    }, 1));
+    report("readText", seconds([&] { Matrix<double> r = readText<double>(path); sink = r(0, 0); }));
+    report("readTextRows", seconds([&] {
+        std::ifstream in(path);
+        double sum = 0;
+        readTextRows<double>(in, [&](const double* row, unsigned) { sum += row[0]; });
+        sink = sum;
+    }));
+    std::remove(path.c_str());
+}
+
+template<class Reset>
+double requestLoop(std::pmr::memory_resource* resource, Reset reset, unsigned size, unsigned requests){
+    Matrix<double> a(size, size, randomValues(size * size));
+    Matrix<double> b(size, size, randomValues(size * size));
+    volatile double sink = 0;
+    return seconds([&] {
+        for (unsigned r = 0; r < requests; r++){
+            {
+                MatrixResourceScope scope(resource);
+                Matrix<double> c = a * b + a - b * 0.5;
+                Matrix<double> d = c.transpone() * c;
+                sink = sink + d(0, 0);
+            }
+            reset();
+        }
+    }) * 1e6 / requests;
+}
+
+void allocators(unsigned requests){
+    std::cout << "allocators, a few small products per request, us/request" << std::endl;
+    std::cout << "size\tdefault\tarena\tpool\tpmr pool" << std::endl;
+    for (unsigned size : {4, 8, 16, 32}){
+        unsigned count = requests * 4 / size;
+        MatrixArena arena;
+        MatrixPool pool;
+        std::pmr::unsynchronized_pool_resource pmrPool;
+        std::cout << size
+                  << "\t" << requestLoop(std::pmr::get_default_resource(), [] {}, size, count)
+                  << "\t" << requestLoop(&arena, [&] { arena.reset(); }, size, count)
+                  << "\t" << requestLoop(&pool, [] {}, size, count)
+                  << "\t" << requestLoop(&pmrPool, [] {}, size, count) << std::endl;
+    }
+}
+
+// Memory resource that tracks the bytes currently allocated and their peak.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::size_t current = 0, peak = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        current += bytes;
+        peak = std::max(peak, current);
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        current -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+// A cache of copies of one n x n matrix that are only read, with and
+// without share(), then the first write to one copy.
+void sharingTable(unsigned n, unsigned copies){
+    std::cout << "sharing, " << copies << " read-only copies of " << n << "x" << n << ", double" << std::endl;
+    std::cout << "storage	copy[s]	read[s]	peak[MB]	first write[s]" << std::endl;
+    for (bool shared : {false, true}){
+        CountingResource counter;
+        MatrixResourceScope scope(&counter);
+        Matrix<double> m(n, n, randomValues(n * n));
+        if (shared)
+            m.share();
+        std::vector<Matrix<double>> cache;
+        double copy = seconds([&] {
+            cache.clear();
+            for (unsigned i = 0; i < copies; i++)
+                cache.push_back(m);
+        }, 1);
+        volatile double sink = 0;
+        double read = seconds([&] {
+            for (const Matrix<double>& c : cache)
+                sink = sink + c.max();
+        }, 1);
+        double write = seconds([&] { cache[0](0, 0) = 1; }, 1);
+        std::cout << (shared ? "shared" : "owned") << "\t" << copy << "\t" << read << "\t" << counter.peak / 1e6
+                  << "\t" << write << std::endl;
+    }
+}
+
+struct SuiteResult {
+    std::string className, operation;
+    unsigned size, elements;
+    double seconds, flops, bytes;
+};
+
+// Time per call. Fast calls are batched until a batch takes at least a
+// millisecond and the best of three batches is kept; calls that take more
+// than half a second are timed once.
+template<class F>
+double perCall(F f){
+    unsigned batch = 1;
+    for (;;){
+        auto run = [&] {
+            for (unsigned i = 0; i < batch; i++)
+                f();
+        };
+        double time = seconds(run, 1);
+        if (time >= 0.5)
+            return time / batch;
+        if (time >= 1e-3)
+            return seconds(run, 3) / batch;
+        batch = time > 0 ? std::max(batch * 2, (unsigned)(batch * 2e-3 / time)) : batch * 16;
+    }
+}
+
+Matrix<double> makeOperand(Matrix<double>*, unsigned n, bool random){
+    return random ? Matrix<double>(n, n, randomValues(n * n)) : Matrix<double>(n, n, 0.0);
+}
+
+SquareMatrix<double> makeOperand(SquareMatrix<double>*, unsigned n, bool random){
+    return random ? SquareMatrix<double>(n, randomValues(n * n)) : SquareMatrix<double>(n, 0.0);
+}
+
+Vector<double> makeOperand(Vector<double>*, unsigned n, bool random){
+    return random ? Vector<double>(n, false, randomValues(n)) : Vector<double>(n, false, 0.0);
+}
+
+// Runs every public operation of M on size n operands (n x n matrices,
+// 1 x n vectors). Bytes are the compulsory memory traffic of the operation,
+// except for operator<<, where they are the characters written.
+template<class M>
+void suiteClass(const char* className, unsigned n, std::vector<SuiteResult>& results){
+    M a = makeOperand((M*)nullptr, n, true);
+    M b = makeOperand((M*)nullptr, n, true);
+    M identity = makeOperand((M*)nullptr, n, false);
+    if (identity.isSquare())
+        identity.makeIdentity();
+    Matrix<double> square(n, n, randomValues(n * n));
+    double elements = (double)a.getRows() * a.getColumns();
+    double cube = (double)n * n * n;
+    volatile double sink = 0;
+    volatile bool flag = false;
+
+    auto add = [&](const char* operation, double time, double flops, double bytes){
+        results.push_back(SuiteResult{className, operation, n, (unsigned)elements, time, flops, bytes});
+    };
+
+    add("construct", perCall([&] { M c = makeOperand((M*)nullptr, n, false); sink = c.data()[0]; }),
+        0, 8 * elements);
+    add("copy", perCall([&] { M c(a); sink = c.data()[0]; }), 0, 16 * elements);
+    add("move", perCall([&] { M c(std::move(a)); a = std::move(c); }) / 2, 0, 0);
+    add("+", perCall([&] { M c = a + b; sink = c.data()[0]; }), elements, 24 * elements);
+    add("-", perCall([&] { M c = a - b; sink = c.data()[0]; }), elements, 24 * elements);
+    add("scalar *", perCall([&] { M c = a * 2.0; sink = c.data()[0]; }), elements, 16 * elements);
+    if (std::is_same<M, Vector<double>>::value)
+        add("*", perCall([&] { Matrix<double> c = a * square; sink = c.data()[0]; }),
+            2.0 * n * n, 8 * ((double)n * n + 2 * n));
+    else
+        add("*", perCall([&] { Matrix<double> c = a * b; sink = c.data()[0]; }), 2 * cube, 24 * elements);
+    if constexpr (!std::is_same<M, Vector<double>>::value){
+        add("det", perCall([&] { sink = a.det(); }), 2 * cube / 3, 16 * elements);
+        add("invert", perCall([&] { auto c = a.invert(); sink = c.data()[0]; }), 2 * cube, 24 * elements);
+    }
+    add("transpone", perCall([&] { M c = a.transpone(); sink = c.data()[0]; }), 0, 16 * elements);
+    double scanned = identity.isSquare() ? 8 * elements : 0;
+    add("isIdentity", perCall([&] { flag = identity.isIdentity(); }), 0, scanned);
+    add("isDiagonal", perCall([&] { flag = identity.isDiagonal(); }), 0, scanned);
+    std::ostringstream text;
+    text << a;
+    add("operator<<", perCall([&] { std::ostringstream out; out << a; sink = out.tellp(); }),
+        0, (double)text.str().size());
+}
+
+void writeJson(std::ostream& out, const std::vector<SuiteResult>& results){
+    out << "{\n  \"scalar\": \"double\",\n  \"threads\": " << ThreadPool::global().getThreadCount()
+        << ",\n  \"simd\": \"" << simdIsaName(getSimdIsa()) << "\",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++){
+        const SuiteResult& r = results[i];
+        out << (i ? "," : "") << "\n    {\"class\": \"" << r.className << "\", \"operation\": \""
+            << r.operation << "\", \"size\": " << r.size << ", \"elements\": " << r.elements
+            << ", \"seconds\": " << r.seconds << ", \"gflops\": ";
+        if (r.flops > 0)
+            out << r.flops / r.seconds / 1e9;
+        else
+            out << "null";
+        out << ", \"bytesPerElement\": " << r.bytes / r.elements
+            << ", \"gbytesPerSecond\": " << r.bytes / r.seconds / 1e9 << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void suite(unsigned maxSize, const char* jsonPath){
+    std::vector<SuiteResult> results;
+    std::cout << "suite, sizes 2.." << maxSize << std::endl;
+    std::cout << "class\toperation\tsize\tseconds\tGFLOP/s\tbytes/element\tGB/s" << std::endl;
+    for (unsigned n = 2; n <= maxSize; n *= 2){
+        size_t first = results.size();
+        suiteClass<Matrix<double>>("Matrix", n, results);
+        suiteClass<SquareMatrix<double>>("SquareMatrix", n, results);
+        suiteClass<Vector<double>>("Vector", n, results);
+        for (size_t i = first; i < results.size(); i++){
+            const SuiteResult& r = results[i];
+            std::cout << r.className << "\t" << r.operation << "\t" << r.size << "\t" << r.seconds << "\t";
+            if (r.flops > 0)
+                std::cout << r.flops / r.seconds / 1e9;
+            else
+                std::cout << "-";
+            std::cout << "\t" << r.bytes / r.elements
+                      << "\t" << r.bytes / r.seconds / 1e9 << std::endl;
+        }
+    }
+    if (jsonPath){
+        std::ofstream file(jsonPath);
+        writeJson(file, results);
+    }
+}
+
+// Usage: benchmark [section...] [--size n] [--max n] [--json file]
+//                  [--ooc-size n] [--budget GB] [--dir path]
+// Sections are suite, threads, reductions, access, simd, strassen, batch,
+// krylov, mixed, symmetric, structured, transpose, layout, views, io, text,
+// alloc and sharing; all run by default. outofcore runs only when named,
+// since it writes three 64 GiB files by default.
+// --size sets the matrix size of the fixed-size tables (default 2000),
+// --max the largest size of the suite sweep (default 4096), and --json
+// writes the suite results to a file. --ooc-size (default 92682), --budget
+// (tile cache in GiB, default 12) and --dir (default the temporary directory)
+// configure outofcore.
+int main(int argc, char** argv){
+    unsigned n = 2000, maxSize = 4096;
+    const char* jsonPath = nullptr;
+    unsigned outOfCoreSize = 92682;
+    double budget = 12;
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::set<std::string> sections;
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc)
+            n = std::atoi(argv[++i]);
+        else if (arg == "--max" && i + 1 < argc)
+            maxSize = std::atoi(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (arg == "--ooc-size" && i + 1 < argc)
+            outOfCoreSize = std::atoi(argv[++i]);
+        else if (arg == "--budget" && i + 1 < argc)
+            budget = std::atof(argv[++i]);
+        else if (arg == "--dir" && i + 1 < argc)
+            dir = argv[++i];
+        else
+            sections.insert(arg);
+    }
+    auto enabled = [&](const char* section) { return sections.empty() || sections.count(section); };
+
+    if (enabled("suite"))
+        suite(maxSize, jsonPath);
+    if (enabled("threads"))
+        threadScaling(n);
+    if (enabled("reductions"))
+        reductionTable(4 * n, n);
+    if (enabled("access"))
+        elementAccess(n);
+    if (enabled("simd")){
+        simdTable<float>("float", 1 << 20);
+        simdTable<double>("double", 1 << 20);
+    }
+    if (enabled("strassen"))
+        strassenTable(std::max(n, 2048u));
+    if (enabled("batch"))
+        batchTable(1 << 18);
+    if (enabled("krylov"))
+        krylovTable(256);
+    if (enabled("mixed"))
+        mixedPrecisionTable(n);
+    if (enabled("symmetric"))
+        symmetricTable(n);
+    if (enabled("structured"))
+        structuredTable(n);
+    if (enabled("transpose"))
+        transposeTable(n);
+    if (enabled("layout"))
+        layoutTable(n);
+    if (enabled("views"))
+        viewTable(n);
+    if (enabled("io"))
+        binaryIo(n);
+    if (enabled("text"))
+        textIo(n);
+    if (enabled("alloc"))
+        allocators(10000);
+    if (enabled("sharing"))
+        sharingTable(n, 64);
+    if (sections.count("outofcore"))
+        outOfCoreTable(outOfCoreSize, (std::size_t)(budget * (1 << 30)), dir);
+}
@@ -1,7 +1,10 @@
 #include "AbstractMatrix.h"
+#include "Krylov.h"
+#include "SparseMatrix.h"
 #include "Matrix.h"
 #include "SquareMatrix.h"
 #include "Vector.h"
+#include <cmath>
 #include <vector>
 #include <iostream>
 
@@ -31,4 +34,44 @@ int main(){
             << "; is zero? " << b.isZero() << std::endl;
     b.makeIdentity();
     std::cout << "; is identity? " << b.isIdentity() << ";  is diagonal? " << b.isDiagonal() ; 
+
+    SquareMatrix<double> p(2, {0,1,1,0});
+    std::cout << "\np: is symmetric? " << p.isSymmetric() << "; det p (LDL^T) = " << p.det(Factorization::LDLT)
+            << std::endl << "odwrotna do p (LDL^T) =\n" << p.invert(Factorization::LDLT);
+
+    SquareMatrix<double> s(3, {4,1,0,1,3,1,0,1,2});
+    Vector<double> rhs(3, {1,2,3}), x;
+    SolverResult<double> cg = conjugateGradient(s, rhs, x);
+    std::cout << "s=\n" << s << "CG: s x = " << rhs << "converged? " << cg.converged
+            << "; x =\n" << x.transpone();
+
+    try{
+        SparseMatrix<double> bad(2, 2, {0, 5, 2}, {0, 1}, {1.0, 2.0});
+        std::cout << "CSR {0, 5, 2}: accepted" << std::endl;
+    }
+    catch (const std::runtime_error& error){
+        std::cout << "CSR {0, 5, 2}: " << error.what() << std::endl;
+    }
+
+    // 67 does not halve evenly down to the crossover, so Strassen pads.
+    std::vector<double> big(67 * 67);
+    for (unsigned r = 0; r < 67; r++)
+        for (unsigned c = 0; c < 67; c++)
+            big[r * 67 + c] = ((double)((r * 7 + c * 3) % 11) - 5) / 7 + (r == c ? 10 : 0);
+    SquareMatrix<double> m(67, big);
+    SquareMatrix<double> classical = m * m;
+    setMultiplyAlgorithm(MultiplyAlgorithm::Strassen);
+    setStrassenCrossover(16);
+    SquareMatrix<double> strassen = m * m;
+    setMultiplyAlgorithm(MultiplyAlgorithm::Classical);
+    double difference = 0, residual = 0;
+    for (unsigned r = 0; r < 67; r++)
+        for (unsigned c = 0; c < 67; c++)
+            difference = std::max(difference, std::abs(strassen(r, c) - classical(r, c)));
+    SquareMatrix<double> identity = m * m.invert();
+    for (unsigned r = 0; r < 67; r++)
+        for (unsigned c = 0; c < 67; c++)
+            residual = std::max(residual, std::abs(identity(r, c) - (r == c ? 1 : 0)));
+    std::cout << "67x67: max |Strassen - classical| = " << difference
+            << "; max |m * m^-1 - I| = " << residual << std::endl;
 }